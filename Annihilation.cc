@@ -0,0 +1,112 @@
+//Annihilation.cc - Positron interactions: annihilation at rest into two back-to-back 0.511 MeV photons.
+//
+//Positrons are treated as annihilating only once they have stopped (in-flight annihilation is neglected.) Whatever kinetic energy
+// is left when the positron is handed over is dumped locally, as in Localdump.cc. The photon pair is emitted isotropically.
+//
+//Programming notes:
+//  -Do not make items here "const", because they will not show up when loading.
+//  -Avoid using macro variables here because they will be obliterated during loading.
+//  -Wrap dynamically-loaded code with extern "C", otherwise C++ compilation will mangle function names, etc.
+//
+// From man page for dlsym/dlopen:  For running some 'initialization' code prior to finishing loading:
+// "Instead,  libraries  should  export  routines using the __attribute__((constructor)) and __attribute__((destructor)) function attributes.  See the gcc info pages for
+//       information on these.  Constructor routines are executed before dlopen() returns, and destructor routines are executed before dlclose() returns."
+//   ---for instance, we can use this to seed a random number generator with a random seed. However, in order to pass in a specific seed (and pass that seed to the library)
+//      we need to define an explicitly callable initialization function. In general, these libraries should have both so that we can quickly adjust behaviour if desired.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <memory>
+#include <cmath>
+
+#include "./Misc.h"
+
+#include "./Constants.h"
+#include "./Structs.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+std::string MODULE_NAME(__FILE__);
+std::string FILE_TYPE("INTERACTION");
+std::string INTERACTION_TYPE("ANNIHILATION");
+
+bool VERBOSE = false;
+
+#ifdef __GNUG__
+    __attribute__((constructor)) static void init_on_dynamic_load(void){
+        //Do something automatic here.
+        if(VERBOSE) FUNCINFO("Loaded lib_annihilation.so");
+        return;
+    }
+
+    __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
+        //Cleanup memory (if needed) automatically here.
+        if(VERBOSE) FUNCINFO("Closed lib_annihilation.so");
+        return;
+    }
+#else
+    #warning Being compiled with non-gcc compiler. Unable to use gcc-specific function declarations like 'attribute.' Proceed at your own risk!
+#endif
+
+void toggle_verbosity(bool in){
+    VERBOSE = in;
+    return;
+}
+
+
+//Draws an isotropic unit vector. Drawn per event (rather than ahead of time) so that the directions only depend on the
+// generator's state when the event happens, which keeps reseeded runs (e.g. per gantry angle) reproducible.
+static vec3<double> isotropic_direction(const struct Functions &Loaded_Functions){
+    const double cos_theta = 2.0*Loaded_Functions.PRNG_source() - 1.0;
+    const double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+    const double phi       = 2.0*M_PI*Loaded_Functions.PRNG_source();
+    return vec3<double>(sin_theta*cos(phi), sin_theta*sin(phi), cos_theta);
+}
+
+
+//Emits the photon pair from a positron annihilating at rest at pos. Also used by the charged particle transport routines, which
+// hand over positrons once they stop.
+void annihilation_photons(const vec3<double> &pos, const double &weight, const struct Functions &Loaded_Functions){
+    vec3<double> d = isotropic_direction(Loaded_Functions);
+
+    std::unique_ptr<base_particle> B = Loaded_Functions.photon_factory( electron_mass, pos, d * electron_mass );
+    B->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, B->get_energy(), B->get_position3()));
+    B->set_weight( weight );
+    Loaded_Functions.particle_sink( std::move( B ) );
+
+    std::unique_ptr<base_particle> C = Loaded_Functions.photon_factory( electron_mass, pos, d * (-electron_mass) );
+    C->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, C->get_energy(), C->get_position3()));
+    C->set_weight( weight );
+    Loaded_Functions.particle_sink( std::move( C ) );
+    return;
+}
+
+
+void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions){
+    //Implements a positron annihilation event. Dumps the remaining kinetic energy locally and destroys the positron.
+    //
+    //It is called 'scatter' to maintain logical consistency for function naming within the interaction files.
+
+    if(A->get_type() != Particletype::Positron){
+        FUNCERR("Annihilation only implemented for positrons. Attempted to perform annihilation on particle of type " << (int)(A->get_type()));
+    }
+
+    if(USE_CSDA){
+        Loaded_Functions.voxel_localdump( (A->get_energy() - A->get_mass()), A->get_position3(), A->get_weight(), Loaded_Functions);
+    }
+    annihilation_photons( A->get_position3(), A->get_weight(), Loaded_Functions );
+
+    Loaded_Functions.particle_graveyard( std::move( A ) );
+    return;
+}
+
+
+#ifdef __cplusplus
+    }
+#endif
+
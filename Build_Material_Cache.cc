@@ -0,0 +1,55 @@
+//Build_Material_Cache.cc - Compiles the material data files (see Materials.cc) into the binary cache which lib_materials.so maps
+// when it is loaded. Rerun it whenever a data file changes; until then, the module ignores the (stale) cache and reads the files.
+//
+//Usage:  build_material_cache [-d <material directory>] [-o <cache file>] [-l <lib_materials.so>]
+//
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <getopt.h>
+
+#include "./Misc.h"
+#include "./Dynamic_Loading.h"
+
+//Used for: bool write_material_cache(const std::string &filename);
+typedef bool (*FUNCTION_write_material_cache)(const std::string &);
+
+
+int main(int argc, char *argv[]){
+    std::string directory("./Materials/");
+    std::string cache_file;
+    std::string library("./lib_materials.so");
+
+    int opt;
+    while((opt = getopt(argc, argv, "hd:o:l:")) != -1){
+        if(opt == 'd'){
+            directory = optarg;
+        }else if(opt == 'o'){
+            cache_file = optarg;
+        }else if(opt == 'l'){
+            library = optarg;
+        }else{
+            std::cout << "Usage: " << argv[0] << " [-d <material directory>] [-o <cache file>] [-l <lib_materials.so>]" << std::endl;
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if(directory.empty() || (directory.back() != '/')) directory += '/';
+    if(cache_file.empty()) cache_file = directory + "Materials.cache";
+
+    //Have the module read the data files (rather than any existing cache), then dump what it built.
+    setenv("TRANSPORT_MATERIALS", directory.c_str(), 1);
+    setenv("TRANSPORT_MATERIALS_CACHE", "", 1);
+
+    void *loaded_library = load_library(library);
+    if(!check_for_item_in_library(loaded_library, "write_material_cache")){
+        FUNCERR("'" << library << "' cannot write a material cache");
+    }
+    FUNCTION_write_material_cache write_material_cache = reinterpret_cast<FUNCTION_write_material_cache>(load_item_from_library(loaded_library, "write_material_cache"));
+    if(!write_material_cache(cache_file)) FUNCERR("Unable to write material cache '" << cache_file << "'");
+
+    FUNCINFO("Wrote material cache '" << cache_file << "'");
+    close_library(loaded_library);
+    return 0;
+}
@@ -33,6 +33,10 @@ std::string FILE_TYPE("INTERACTION");
 std::string INTERACTION_TYPE("COMPTON");
 
 bool VERBOSE = false;
+bool KERMA_APPROXIMATION = false; //If true, charged particles are not created. Their kinetic energy is scored where the photon interacts.
+
+int Handle_Photon_Angular_Distribution  = -1; //Logging channels. Resolved by resolve_logging_handles().
+int Handle_Fraction_Transferred_Compton = -1;
 
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
@@ -55,6 +59,19 @@ void toggle_verbosity(bool in){
     return;
 }
 
+void toggle_kerma_approximation(bool in){
+    KERMA_APPROXIMATION = in;
+    return;
+}
+
+
+//Called once all modules have been loaded. Channels are only opened if they will be used.
+void resolve_logging_handles(const struct Functions &Loaded_Functions){
+    if(LoggingQuantities::PhotonAngularSampled)       Handle_Photon_Angular_Distribution  = Loaded_Functions.logging_channel("Photon_Angular_Distribution");
+    if(LoggingQuantities::FractionTransferredCompton) Handle_Fraction_Transferred_Compton = Loaded_Functions.logging_channel("Fraction_Transferred_Compton");
+    return;
+}
+
 
 //Used for the rejection-method scheme. 
 inline double normalized_maximum_value(const double &alpha){
@@ -125,7 +142,7 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
     //Log the photon angular distribution as a function of photon energy.
     if(LoggingQuantities::PhotonAngularSampled){
-        Loaded_Functions.generic_logging("Photon_Angular_Distribution") << incoming_photon_E << " " << theta << " " << R << std::endl;
+        Loaded_Functions.logging_by_channel(Handle_Photon_Angular_Distribution) << incoming_photon_E << " " << theta << " " << R << '\n';
     }
 
     //Determine how much energy the outgoing photon will have.
@@ -141,6 +158,27 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     const double electron_E = (photon_alive) ? (electron_mass + incoming_photon_E - photon_E) : (electron_mass + incoming_photon_E);
 
 
+    //Log the fraction of kinetic energy transferred to recoil electrons as a function of incoming photon energy.
+    if(LoggingQuantities::FractionTransferredCompton){
+        Loaded_Functions.logging_by_channel(Handle_Fraction_Transferred_Compton) << incoming_photon_E << " " <<  ((electron_E-electron_mass)/incoming_photon_E) << '\n';
+    }
+
+    //In the kerma approximation the electron is never created. Its kinetic energy is scored here, and the incoming photon
+    // object is reused for the scattered photon so that nothing is allocated.
+    if(KERMA_APPROXIMATION){
+        Loaded_Functions.voxel_localdump( (electron_E - electron_mass), A->get_position3(), A->get_weight(), Loaded_Functions);
+
+        if(photon_alive){
+            const vec3<double> C_momentum = rotate_unit_vector_in_plane((A->get_relativistic_three_momentum3()).unit(), theta, R) * photon_E;
+            A->set_energy( photon_E );
+            A->set_relativistic_three_momentum3( C_momentum );
+            Loaded_Functions.particle_sink( std::move( A ) );
+        }else{
+            Loaded_Functions.particle_graveyard( std::move( A ) );
+        }
+        return;
+    }
+
     //Create an electron at the position of the photon.                                                             
     const double B_mom_mag  = sqrt( electron_E*electron_E - electron_mass*electron_mass );
 
@@ -152,11 +190,7 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
     std::unique_ptr<base_particle> B = Loaded_Functions.electron_factory( electron_E, A->get_position3(), B_momentum );
     B->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, B->get_energy(), B->get_position3()));
-
-    //Log the fraction of kinetic energy transferred to recoil electrons as a function of incoming photon energy.
-    if(LoggingQuantities::FractionTransferredCompton){
-        Loaded_Functions.generic_logging("Fraction_Transferred_Compton") << incoming_photon_E << " " <<  ((electron_E-electron_mass)/incoming_photon_E) << std::endl;
-    }
+    B->set_weight( A->get_weight() );
 
     //Push the electron back into memory.
     Loaded_Functions.particle_sink( std::move( B ) );
@@ -178,6 +212,7 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
         std::unique_ptr<base_particle> C = Loaded_Functions.photon_factory( photon_E, A->get_position3(), C_momentum );
         C->Interactions = A->Interactions;
+        C->set_weight( A->get_weight() );
 
         //Push the electron back into memory, and let the photon be destroyed.
         Loaded_Functions.particle_sink( std::move( C ) );
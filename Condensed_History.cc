@@ -0,0 +1,343 @@
+//Condensed_History.cc - Condensed-history transport for electrons and positrons. Replaces the straight-line, constant stopping
+// power SlowDown routine with a series of short steps. Each step loses energy, is deflected by multiple scattering, and deposits
+// the energy it lost along itself in the voxel tally.
+//
+//Step lengths and energy losses come from precomputed CSDA range and inverse-range tables, so a step costs two O(1) lookups.
+// Each step is a fixed fraction (STEP_FRACTION) of the residual range, so the fractional energy lost per step is roughly constant.
+// On each step:
+//   -Energy loss: the mean follows from the tables. Straggling is Gaussian, with the variance given by the Moller cross section
+//    (which caps a single energy transfer at T/2.) It is truncated symmetrically about the mean, so the mean loss is unchanged.
+//   -Deflection: Highland's formula gives the width of the multiple-scattering angular distribution, applied at the step's end.
+//   -Deposition: the energy lost is spread evenly along the (straight) step.
+//
+//For water, the stopping power is the Bethe formula for electrons (ICRU 37) with the Sternheimer density-effect correction, plus
+// a rough radiative term. For other media the material database's stopping power is used, and their tables are built the first
+// time a particle enters them.
+//
+//Steps are stopped at material boundaries if the geometry provides distance_to_boundary (otherwise the material is only checked
+// at the start of each step.) Particles leaving the media with data (e.g., into vacuum, a detector, or a black region) are handed
+// back to the core, which transports them from there and returns them here if they enter a medium again.
+//
+//Range rejection: if the residual range is shorter than the distance to both the nearest material boundary (in any direction,
+// from the geometry's safety_distance) and the nearest face of the scoring voxel (from voxel_safety), nothing the particle does
+// can change where its energy ends up. The rest of its energy is deposited on the spot. Wherever escape is possible, particles are
+// transported as usual. It needs both routines; without them every particle is transported to the end of its range.
+//
+//Not included: secondary (delta-ray and bremsstrahlung) particles, so all energy lost is deposited along the track. Positrons
+// use the electron stopping power and annihilate at rest at the end of their range (if an annihilation module is loaded.)
+// Straggling and scattering use each medium's Z/A and radiation length, from its data file. A medium whose file does not give
+// them falls back to water's (with a warning), which is only a fair approximation for tissue-like media.
+//
+//Programming notes:
+//  -Do not make items here "const", because they will not show up when loading.
+//  -Avoid using macro variables here because they will be obliterated during loading.
+//  -Wrap dynamically-loaded code with extern "C", otherwise C++ compilation will mangle function names, etc.
+//
+// From man page for dlsym/dlopen:  For running some 'initialization' code prior to finishing loading:
+// "Instead,  libraries  should  export  routines using the __attribute__((constructor)) and __attribute__((destructor)) function attributes.  See the gcc info pages for
+//       information on these.  Constructor routines are executed before dlopen() returns, and destructor routines are executed before dlclose() returns."
+//   ---for instance, we can use this to seed a random number generator with a random seed. However, in order to pass in a specific seed (and pass that seed to the library)
+//      we need to define an explicitly callable initialization function. In general, these libraries should have both so that we can quickly adjust behaviour if desired.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <memory>
+#include <cmath>
+#include <mutex>
+
+#include "./Misc.h"
+#include "./MyMath.h"
+
+#include "./Constants.h"
+#include "./Structs.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+std::string MODULE_NAME(__FILE__);
+std::string FILE_TYPE("INTERACTION");
+std::string INTERACTION_TYPE("CONDENSED_HISTORY");
+
+bool VERBOSE = false;
+
+double STEP_FRACTION      = 0.2;    //Each step is this fraction of the residual CSDA range.
+double MINIMUM_STEP       = 0.01;   //cm. Particles with less residual range than this are stopped in one final step.
+double BOUNDARY_STEP_OVER = 1E-9;   //cm. Steps ending at a boundary are carried this far past it. (The same as the core's.)
+double WATER_RADIATION_LENGTH = 36.08;  //g/cm^2. Other media take theirs from the material database.
+double WATER_Z_OVER_A         = 0.5551;
+bool   RANGE_REJECTION    = true;   //Deposit locally if the particle cannot leave its region or voxel. See above.
+
+double TABLE_T_MIN  = 1E-3;   //Range of the kinetic energy grid (MeV.)
+double TABLE_T_MAX  = 50.0;
+long int TABLE_BINS = 1024;   //Log-spaced. The inverse-range table uses the same number of (log-spaced) ranges.
+
+
+//CSDA range as a function of kinetic energy, and the reverse, for one medium.
+struct range_table {
+    double density = 0.0;             //g/cm^3.
+    double radiation_length = 0.0;    //g/cm^2.
+    double z_over_a = 0.0;
+    double log_T_min = 0.0, T_bins_per_log = 0.0;
+    double log_R_min = 0.0, R_bins_per_log = 0.0;
+    std::vector<double> range;        //cm, at each energy node.
+    std::vector<double> energy;       //MeV, at each range node.
+};
+
+range_table    Tables[256];      //Indexed by material. Water's is built when loaded, the rest when first needed.
+std::once_flag Table_Once[256];  //Several threads may find a new medium at once.
+
+
+//Total stopping power (MeV/cm) of liquid water for electrons of kinetic energy T.
+static double water_stopping_power(const double &T){
+    const double tau   = T/electron_mass;
+    const double gamma = tau + 1.0;
+    const double beta2 = 1.0 - 1.0/(gamma*gamma);
+    const double I     = 75.0E-6/electron_mass;  //Mean excitation energy, in units of the electron mass.
+
+    const double F = 1.0 - beta2 + (tau*tau/8.0 - (2.0*tau + 1.0)*M_LN2)/(gamma*gamma);
+
+    //Sternheimer's density-effect parameters for water: C, X0, X1, a, m.
+    const double X = log10(sqrt(tau*(tau + 2.0)));
+    double delta = 0.0;
+    if(X >= 2.8004){
+        delta = 4.6052*X - 3.5017;
+    }else if(X >= 0.2400){
+        delta = 4.6052*X - 3.5017 + 0.09116*pow(2.8004 - X, 3.4773);
+    }
+
+    //2 pi r_e^2 m c^2 N_A (Z/A) / beta^2.
+    const double collision = (0.153537*0.55509/beta2)*(log(tau*tau*(tau + 2.0)/(2.0*I*I)) + F - delta);
+
+    //Radiative losses are roughly (Z T / 800 MeV) of the collision losses. Z ~ 7.4 for water.
+    return collision*(1.0 + 7.4*T/800.0);
+}
+
+
+//Integrates the range over a log-spaced energy grid, then inverts it onto a log-spaced range grid.
+static void build_table(range_table &t, const double &density, const std::function<double(const double &)> &stopping_power){
+    const long int N = TABLE_BINS;
+    t.density        = density;
+    t.log_T_min      = log(TABLE_T_MIN);
+    t.T_bins_per_log = static_cast<double>(N)/(log(TABLE_T_MAX) - t.log_T_min);
+    const double dlogT = 1.0/t.T_bins_per_log;
+
+    //dR = dT/S = (T/S) dlog(T). Below the grid, take the stopping power to be constant.
+    std::vector<double> T(N+1), w(N+1);
+    for(long int i = 0; i <= N; ++i){
+        T[i] = exp(t.log_T_min + static_cast<double>(i)*dlogT);
+        w[i] = T[i]/stopping_power(T[i]);
+    }
+    t.range.resize(N+1);
+    t.range[0] = w[0];
+    for(long int i = 1; i <= N; ++i) t.range[i] = t.range[i-1] + 0.5*(w[i-1] + w[i])*dlogT;
+
+    t.log_R_min      = log(t.range[0]);
+    t.R_bins_per_log = static_cast<double>(N)/(log(t.range[N]) - t.log_R_min);
+    t.energy.resize(N+1);
+    long int i = 0;
+    for(long int j = 0; j <= N; ++j){
+        const double R = exp(t.log_R_min + static_cast<double>(j)/t.R_bins_per_log);
+        while((i < N-1) && (t.range[i+1] < R)) ++i;
+        const double f = (log(R) - log(t.range[i]))/(log(t.range[i+1]) - log(t.range[i]));
+        t.energy[j] = exp(log(T[i]) + f*(log(T[i+1]) - log(T[i])));
+    }
+    t.energy[0] = TABLE_T_MIN;
+    t.energy[N] = TABLE_T_MAX;
+    return;
+}
+
+struct water_table_loader {
+    water_table_loader(){
+        build_table(Tables[Material::Water], 1.0, water_stopping_power);
+        Tables[Material::Water].radiation_length = WATER_RADIATION_LENGTH;
+        Tables[Material::Water].z_over_a         = WATER_Z_OVER_A;
+    }
+} Water_Table_Loader;
+
+
+//Residual CSDA range (cm) of a particle with kinetic energy T.
+static inline double csda_range(const range_table &t, const double &T){
+    if(T <= TABLE_T_MIN) return t.range[0]*T/TABLE_T_MIN;
+    double u = (log(T) - t.log_T_min)*t.T_bins_per_log;
+    if(u > static_cast<double>(TABLE_BINS) - 1E-9) u = static_cast<double>(TABLE_BINS) - 1E-9;
+    const long int i = static_cast<long int>(u);
+    return t.range[i] + (u - static_cast<double>(i))*(t.range[i+1] - t.range[i]);
+}
+
+//Kinetic energy (MeV) of a particle with residual CSDA range R.
+static inline double csda_energy(const range_table &t, const double &R){
+    if(R <= t.range[0]) return TABLE_T_MIN*R/t.range[0];
+    double u = (log(R) - t.log_R_min)*t.R_bins_per_log;
+    if(u > static_cast<double>(TABLE_BINS) - 1E-9) u = static_cast<double>(TABLE_BINS) - 1E-9;
+    const long int i = static_cast<long int>(u);
+    return t.energy[i] + (u - static_cast<double>(i))*(t.energy[i+1] - t.energy[i]);
+}
+
+//The table for a material, or nullptr if there is no stopping power data for it.
+static const range_table * table_for(const unsigned char &material, const struct Functions &Loaded_Functions){
+    if(material == Material::Water) return &Tables[material];
+    if((Loaded_Functions.material_defined == NULL) || (Loaded_Functions.material_stopping_power == NULL)
+    || (Loaded_Functions.material_density == NULL) || !Loaded_Functions.material_defined(material)){
+        return nullptr;
+    }
+    std::call_once(Table_Once[material], [&](){
+        range_table &t = Tables[material];
+        build_table(t, Loaded_Functions.material_density(material),
+                    [&](const double &T){ return Loaded_Functions.material_stopping_power(material, T); });
+        if(Loaded_Functions.material_radiation_length != NULL) t.radiation_length = Loaded_Functions.material_radiation_length(material);
+        if(Loaded_Functions.material_z_over_a != NULL)         t.z_over_a         = Loaded_Functions.material_z_over_a(material);
+        if(!(t.radiation_length > 0.0) || !(t.z_over_a > 0.0)){
+            FUNCWARN("No radiation length or Z/A for material " << static_cast<int>(material) << ". Using water's, which will misjudge"
+                     " electron scattering unless the medium is tissue-like");
+            t.radiation_length = WATER_RADIATION_LENGTH;
+            t.z_over_a         = WATER_Z_OVER_A;
+        }
+        if(VERBOSE) FUNCINFO("Built range tables for material " << static_cast<int>(material));
+    });
+    return &Tables[material];
+}
+
+//Rotates a unit vector by polar angle theta, about an azimuth phi.
+static inline vec3<double> deflect(const vec3<double> &d, const double &theta, const double &phi){
+    const double ct = cos(theta), st = sin(theta);
+    const double cp = cos(phi),   sp = sin(phi);
+    const double r  = sqrt(d.x*d.x + d.y*d.y);
+    if(r < 1E-10) return vec3<double>(st*cp, st*sp, (d.z > 0.0) ? ct : -ct);
+    return vec3<double>( d.x*ct + st*(d.x*d.z*cp - d.y*sp)/r,
+                         d.y*ct + st*(d.y*d.z*cp + d.x*sp)/r,
+                         d.z*ct - st*cp*r );
+}
+
+
+#ifdef __GNUG__
+    __attribute__((constructor)) static void init_on_dynamic_load(void){
+        //Do something automatic here.
+        if(VERBOSE) FUNCINFO("Loaded lib_condensed_history.so");
+        return;
+    }
+
+    __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
+        //Cleanup memory (if needed) automatically here.
+        if(VERBOSE) FUNCINFO("Closed lib_condensed_history.so");
+        return;
+    }
+#else
+    #warning Being compiled with non-gcc compiler. Unable to use gcc-specific function declarations like 'attribute.' Proceed at your own risk!
+#endif
+
+void toggle_verbosity(bool in){
+    VERBOSE = in;
+    return;
+}
+
+
+//Called when a particle comes to rest at pos. A positron annihilates there.
+static void stopped(const base_particle &A, const vec3<double> &pos, const struct Functions &Loaded_Functions){
+    if((A.get_type() == Particletype::Positron) && (Loaded_Functions.annihilation_photons != NULL)){
+        Loaded_Functions.annihilation_photons(pos, A.get_weight(), Loaded_Functions);
+    }
+    return;
+}
+
+
+void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions){
+    //Transports a charged particle until it stops or leaves the media with data. Swallows the particle if it stops here.
+    //
+    //It is called 'scatter' to maintain logical consistency for function naming within the interaction files.
+
+    if((A->get_type() != Particletype::Electron) && (A->get_type() != Particletype::Positron)){
+        FUNCWARN("Attempted to perform condensed-history transport on an uncharged particle type. Ignoring particle!");
+        return;
+    }
+
+    const double mass = A->get_mass();
+    double T          = A->get_energy() - mass;
+    vec3<double> pos  = A->get_position3();
+    vec3<double> dir  = (A->get_relativistic_three_momentum3()).unit();
+
+    //A particle created right here has not had its kinetic energy scored (as kerma) yet. It is scored with the first step.
+    const size_t N = A->Interactions.size();
+    double T_transferred = ((N >= 2) && (A->Interactions[N-2].interaction == Interactiontype::Creation)) ? T : 0.0;
+
+    while(true){
+        const range_table *table = table_for(Loaded_Functions.which_material(pos), Loaded_Functions);
+
+        //Hand the particle back to the core if there is no data for this medium.
+        if(table == nullptr){
+            A->set_energy(T + mass);
+            A->set_position3(pos);
+            A->set_relativistic_three_momentum3(dir * sqrt(T*(T + 2.0*mass)));
+            Loaded_Functions.particle_sink( std::move( A ) );
+            return;
+        }
+
+        const double R = csda_range(*table, T);
+
+        //Range rejection. The (cheaper) voxel test is done first.
+        if(RANGE_REJECTION && (Loaded_Functions.voxel_safety != NULL) && (Loaded_Functions.safety_distance != NULL)
+        && (R < Loaded_Functions.voxel_safety(pos)) && (R < Loaded_Functions.safety_distance(pos))){
+            Loaded_Functions.voxel_deposit_track(T_transferred, T, pos, pos, A->get_weight(), Loaded_Functions);
+            stopped(*A, pos, Loaded_Functions);
+            return;
+        }
+
+        //Little enough is left that the rest of the track is one (straight) step.
+        if(R <= MINIMUM_STEP){
+            vec3<double> end = pos;
+            end += dir*R;
+            Loaded_Functions.voxel_deposit_track(T_transferred, T, pos, end, A->get_weight(), Loaded_Functions);
+            stopped(*A, end, Loaded_Functions);
+            return;
+        }
+
+        double s = STEP_FRACTION*R;
+        if(s < MINIMUM_STEP) s = MINIMUM_STEP;
+        if(Loaded_Functions.distance_to_boundary != NULL){
+            const double to_boundary = Loaded_Functions.distance_to_boundary(pos, dir);
+            if(s > to_boundary) s = to_boundary + BOUNDARY_STEP_OVER;
+        }
+
+        //Energy loss, with straggling.
+        const double mean_loss = T - csda_energy(*table, R - s);
+        const double gamma     = (T + mass)/mass;
+        const double beta2     = 1.0 - 1.0/(gamma*gamma);
+        const double sigma     = sqrt(0.153537*table->z_over_a*table->density*s*(0.5*T)/beta2);
+        const double normal    = sqrt(-2.0*log(1.0 - Loaded_Functions.PRNG_source()))*cos(2.0*M_PI*Loaded_Functions.PRNG_source());
+        double loss = mean_loss + sigma*normal;
+        if(loss < 0.0) loss = 0.0;
+        if(loss > 2.0*mean_loss) loss = 2.0*mean_loss;
+        if(loss > T) loss = T;
+
+        vec3<double> end = pos;
+        end += dir*s;
+        Loaded_Functions.voxel_deposit_track(T_transferred, loss, pos, end, A->get_weight(), Loaded_Functions);
+        T_transferred = 0.0;
+
+        T  -= loss;
+        pos = end;
+        if(T <= 0.0){
+            stopped(*A, pos, Loaded_Functions);
+            return;
+        }
+
+        //Multiple-scattering deflection, using the mid-step energy. The space angle of a 2D Gaussian is Rayleigh-distributed.
+        const double T_mid  = T + 0.5*loss;
+        const double pc     = sqrt(T_mid*(T_mid + 2.0*mass));
+        const double beta   = pc/(T_mid + mass);
+        const double x      = table->density*s/table->radiation_length;
+        double theta0 = (13.6/(beta*pc))*sqrt(x)*(1.0 + 0.038*log(x));
+        if(theta0 < 0.0) theta0 = 0.0;
+        const double theta  = theta0*sqrt(-2.0*log(1.0 - Loaded_Functions.PRNG_source()));
+        dir = deflect(dir, theta, 2.0*M_PI*Loaded_Functions.PRNG_source());
+    }
+}
+
+
+#ifdef __cplusplus
+    }
+#endif
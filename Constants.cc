@@ -23,12 +23,18 @@ namespace LoggingQuantities {
     const bool PDD_6MV                     = false;  
     const bool PDK_1MEV                    = false;
     const bool PDK_10MEV                   = false;
+    const bool BinaryEventLogs             = false; //Send the above per-event logs to fixed-layout binary channels (if the logging module provides them.) The Helpers/ binners read the text logs.
+    const bool HistogramEventLogs          =  true; //Instead, bin the above in-process and write the histograms once (if the tally module is loaded.) Takes precedence.
+    const bool DetectorHits                = false; //Per-hit text log of detected particles. The binned sinogram is written regardless (if the geometry supports it.)
     const bool ElectronStoppingPos         = false;
     const bool NumbOfInteractions          = false; //Phys 539, Q3 - Number of interactions a photon does before being absorbed versus initial energy.
     const bool DistanceTravelled           = false; //Distance the photon has travelled throughout the simulation. (As the crow flies!)
     const bool FractionTransferredCompton  = false; //Phys 539, Q2 - Fraction of energy transferred to recoil electrons in Compton interactions versus energy.
     const bool PhotonAngularSampled        = false; //Phys 539, Q4 - Angular sampling of the angles assigned for the recoil photon in Compton interactions.
     const bool VoxelAutoDump               =  true; //Dumps voxel data when the module is unloaded, regardless of what is contained in it.
+    const bool VoxelAutoDumpPPM            = false; //  ...as ASCII P3 PPM slices (one file per depth slice per quantity.) Slow, and values are truncated to integers!
+    const bool VoxelAutoDumpNRRD           =  true; //  ...as a single raw binary (float64) NRRD volume per quantity.
+    const bool VoxelAutoDumpUncertainty    =  true; //  ...along with history-by-history uncertainty volumes for dose and kerma (NRRD only.)
 }
 
 
@@ -116,6 +122,13 @@ namespace Material {
     const unsigned char Water    = 5;
     const unsigned char Detector = 6;
     const unsigned char Unknown  = 7; //Used for creating particles in a medium when I don't care about the material it is in. I will fix this when I need it/get a chance.
+
+    //Media which are only available through the material database (lib_materials.so) and its data files.
+    const unsigned char Bone     = 8;
+    const unsigned char Lung     = 9;
+    const unsigned char Tissue   = 10;
+    const unsigned char PMMA     = 11;
+    const unsigned char Tungsten = 12;
 }
 
 //----------------------------------------------------------------------------------//
@@ -148,4 +161,6 @@ namespace Interactiontype {
     const unsigned char Detect           = 9;
 
     const unsigned char SlowDown         = 10;
+
+    const unsigned char Annihilation     = 11;
 }
@@ -21,12 +21,18 @@ namespace LoggingQuantities {
     extern const bool PDD_6MV;
     extern const bool PDK_1MEV;
     extern const bool PDK_10MEV;
+    extern const bool BinaryEventLogs;
+    extern const bool HistogramEventLogs;
+    extern const bool DetectorHits;
     extern const bool ElectronStoppingPos;
     extern const bool NumbOfInteractions;
     extern const bool DistanceTravelled;
     extern const bool FractionTransferredCompton;
     extern const bool PhotonAngularSampled;
     extern const bool VoxelAutoDump;
+    extern const bool VoxelAutoDumpPPM;
+    extern const bool VoxelAutoDumpNRRD;
+    extern const bool VoxelAutoDumpUncertainty;
 }
 
 //----------------------------------------------------------------------------------//
@@ -81,6 +87,11 @@ namespace Material {
     extern const unsigned char Water;
     extern const unsigned char Detector;
     extern const unsigned char Unknown;  
+    extern const unsigned char Bone;
+    extern const unsigned char Lung;
+    extern const unsigned char Tissue;
+    extern const unsigned char PMMA;
+    extern const unsigned char Tungsten;
 }
 
 //----------------------------------------------------------------------------------//
@@ -114,6 +125,8 @@ namespace Interactiontype {
 
     extern const unsigned char SlowDown;
 
+    extern const unsigned char Annihilation;  //A positron annihilates at rest into two photons.
+
 }
 
 
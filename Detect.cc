@@ -1,5 +1,9 @@
 //Detect.cc - A routine for particles to enter when they are within the geometry of a detector.
 //
+//Also implements forced detection (a next-event estimator) for the Compton-scattered signal: at each Compton event, the expected
+// number of scattered photons reaching each detector cell is scored directly, attenuated along the ray to the cell. Every event
+// contributes to every cell, so scatter profiles converge far faster than from the photons which happen to reach the detector.
+//
 //Programming notes:
 //  -Do not make items here "const", because they will not show up when loading.
 //  -Avoid using macro variables here because they will be obliterated during loading.
@@ -18,8 +22,14 @@
 
 #include <memory>
 #include <cmath>
+#include <mutex>
+#include <algorithm>
+
+#include <fcntl.h>   //open.
+#include <unistd.h>  //write, close.
 
 #include "./Misc.h"
+#include "./MyMath.h"
 
 #include "./Constants.h"
 #include "./Structs.h"
@@ -33,6 +43,74 @@ std::string FILE_TYPE("INTERACTION");
 std::string INTERACTION_TYPE("DETECTION");
 
 bool VERBOSE = false;
+bool DO_NOT_CLOBBER = false;
+
+int Handle_Detector = -1; //Logging channel. Resolved by resolve_logging_handles().
+
+//Detector tally. Hits are binned by detector cell (as reported by the geometry), by energy, and (optionally) by the number of
+// times the particle's history was scattered before detection. Each gantry angle produces one row of the sinogram, which is
+// appended to "/tmp/Transport_Detector.sinogram" in binary when the row is finished.
+long int DETECTOR_ENERGY_BINS    = 64;
+double   DETECTOR_ENERGY_MAX     = 0.2;   //MeV. Hits above this are put in the last bin.
+long int DETECTOR_SCATTER_ORDERS = 3;     //Bins for 0, 1, ..., (N-1)-or-more scatters. Set to 1 to ignore scatter order.
+
+//Forced detection. Needs the geometry to describe its detector cells (and to provide distances to boundaries.) The expected counts
+// are binned exactly like the analog hits, but written to their own file. Only Compton events are forced (coherent scattering
+// does not deflect photons here), so the order-0 bins are always empty.
+bool   FORCED_DETECTION   = true;
+double BOUNDARY_STEP_OVER = 1E-9;  //When tracing rays to the detector, steps are taken this far past each boundary.
+
+struct detector_row {
+    double gantry_angle;
+    long int cells;
+    std::vector<double> counts;  //Layout: [order][energy][cell], with cell varying fastest.
+    std::vector<double> forced;  //Same layout. Empty unless forced detection is in use.
+};
+
+thread_local detector_row *This_Thread_Row = nullptr; //Each thread works on its own row (i.e., gantry angle.)
+
+std::mutex Sinogram_Mutex;
+int Sinogram_FD = -1;
+long int Sinogram_Rows = 0;
+std::string Sinogram_Filename("/tmp/Transport_Detector.sinogram");
+
+int Forced_FD = -1;
+long int Forced_Rows = 0;
+std::string Forced_Filename("/tmp/Transport_Detector_Forced.sinogram");
+
+
+static void write_fully(const int &fd, const std::string &filename, const char *bytes, size_t N){
+    while(N != 0){
+        const ssize_t n = write(fd, bytes, N);
+        if(n <= 0) FUNCERR("Unable to write detector sinogram \"" << filename << "\"");
+        bytes += n;
+        N     -= static_cast<size_t>(n);
+    }
+    return;
+}
+
+//Appends a row to a sinogram file, opening it (and writing the header) first if needed. Call with Sinogram_Mutex held.
+static void append_row(int &fd, long int &rows, const std::string &filename, const std::string &what, const detector_row &row, const std::vector<double> &counts){
+    if(fd == -1){
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        if(DO_NOT_CLOBBER) flags |= O_EXCL;
+        fd = open(filename.c_str(), flags, 0644);
+        if(fd == -1) FUNCERR("Detector sinogram \"" << filename << "\" cannot be opened for writing");
+
+        //A short, human-readable header. Rows follow the blank line.
+        const std::string header = "# Transport detector sinogram v1\n"
+                                   "# cells: "          + std::to_string(row.cells) + "\n"
+                                   "# energy_bins: "    + std::to_string(DETECTOR_ENERGY_BINS) + " over [0," + std::to_string(DETECTOR_ENERGY_MAX) + ") MeV\n"
+                                   "# scatter_orders: " + std::to_string(DETECTOR_SCATTER_ORDERS) + "\n"
+                                   "# row: gantry_angle (rad), then " + what + "[order][energy][cell] with cell fastest. All float64, host byte order.\n\n";
+        write_fully(fd, filename, header.data(), header.size());
+    }
+
+    write_fully(fd, filename, reinterpret_cast<const char *>(&(row.gantry_angle)), sizeof(double));
+    write_fully(fd, filename, reinterpret_cast<const char *>(counts.data()), counts.size()*sizeof(double));
+    ++rows;
+    return;
+}
 
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
@@ -44,6 +122,16 @@ bool VERBOSE = false;
     __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
         //Cleanup memory (if needed) automatically here.
         if(VERBOSE) FUNCINFO("Closed lib_detect.so");
+        if(Sinogram_FD != -1){
+            close(Sinogram_FD);
+            Sinogram_FD = -1;
+            if(VERBOSE) FUNCINFO("Wrote " << Sinogram_Rows << " sinogram rows to \"" << Sinogram_Filename << "\"");
+        }
+        if(Forced_FD != -1){
+            close(Forced_FD);
+            Forced_FD = -1;
+            if(VERBOSE) FUNCINFO("Wrote " << Forced_Rows << " forced detection sinogram rows to \"" << Forced_Filename << "\"");
+        }
         return;
     }
 #else
@@ -58,6 +146,49 @@ void toggle_verbosity(bool in){
 
 
 
+//Called once all modules have been loaded. The per-hit text log is only used if requested, or if the geometry cannot tell us
+// which detector cell a hit is in.
+void resolve_logging_handles(const struct Functions &Loaded_Functions){
+    if(LoggingQuantities::DetectorHits || (Loaded_Functions.detector_cell == NULL)){
+        Handle_Detector = Loaded_Functions.logging_channel("Detector");
+    }
+    return;
+}
+
+
+//Starts a new (empty) sinogram row for the calling thread. Hits detected by this thread are tallied into it until the row is ended.
+void detector_begin_row(const double &gantry_angle, const struct Functions &Loaded_Functions){
+    if((Loaded_Functions.detector_cell == NULL) || (Loaded_Functions.detector_cell_count == NULL)) return;
+    if(This_Thread_Row != nullptr) FUNCERR("Attempted to begin a sinogram row before ending the previous one");
+    if((DETECTOR_ENERGY_BINS <= 0) || (DETECTOR_SCATTER_ORDERS <= 0) || !(DETECTOR_ENERGY_MAX > 0.0)){
+        FUNCERR("Invalid detector tally binning");
+    }
+
+    This_Thread_Row = new detector_row;
+    This_Thread_Row->gantry_angle = gantry_angle;
+    This_Thread_Row->cells        = Loaded_Functions.detector_cell_count();
+    This_Thread_Row->counts.assign( static_cast<size_t>(This_Thread_Row->cells * DETECTOR_ENERGY_BINS * DETECTOR_SCATTER_ORDERS), 0.0 );
+    if(FORCED_DETECTION && (Loaded_Functions.detector_cell_face != NULL) && (Loaded_Functions.distance_to_boundary != NULL)){
+        This_Thread_Row->forced.assign( This_Thread_Row->counts.size(), 0.0 );
+    }
+    return;
+}
+
+
+//Appends the calling thread's row to the sinogram file. Rows may arrive in any order (e.g., when several threads each handle
+// a different gantry angle) so each row leads with its gantry angle.
+void detector_end_row(void){
+    if(This_Thread_Row == nullptr) return;
+    std::unique_ptr<detector_row> row(This_Thread_Row);
+    This_Thread_Row = nullptr;
+
+    std::lock_guard<std::mutex> lock(Sinogram_Mutex);
+    append_row(Sinogram_FD, Sinogram_Rows, Sinogram_Filename, "counts", *row, row->counts);
+    if(!row->forced.empty()) append_row(Forced_FD, Forced_Rows, Forced_Filename, "expected_counts", *row, row->forced);
+    return;
+}
+
+
 void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions){
     //Implements a simple energy dump event. Destroys particle afterward by expiring it.
     //
@@ -65,13 +196,118 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
     //Needed in this function: 
     // - Access to logging routines.
-    
+    // - Access to the geometry's detector cell lookup (for tallying.)
+
+    const vec3<double> pos = A->get_position3();
 
-    //For detector geometry.
-    //Loaded_Functions.generic_logging("Detector") << A->Interactions[0].energy << " " << A->get_position3() << " " << (A->Interactions.size() - 1) << std::endl;
-    Loaded_Functions.generic_logging("Detector") << A->Interactions[0].energy << " " << (A->get_position3()).x << " " << (A->get_position3()).y << " " << (A->get_position3()).z << " " <<   (A->Interactions.size() - 1) << std::endl; 
+    if(This_Thread_Row != nullptr){
+        const long int cell = Loaded_Functions.detector_cell(pos);
+        if(cell >= 0){
+            long int energy_bin = static_cast<long int>( A->get_energy()/DETECTOR_ENERGY_MAX * static_cast<double>(DETECTOR_ENERGY_BINS) );
+            if(energy_bin >= DETECTOR_ENERGY_BINS) energy_bin = DETECTOR_ENERGY_BINS - 1;
+            if(energy_bin < 0) energy_bin = 0;
 
+            long int order = 0;
+            if(DETECTOR_SCATTER_ORDERS > 1){
+                for(const auto &I : A->Interactions){
+                    if((I.interaction == Interactiontype::Compton) || (I.interaction == Interactiontype::Coherent)) ++order;
+                }
+                if(order >= DETECTOR_SCATTER_ORDERS) order = DETECTOR_SCATTER_ORDERS - 1;
+            }
+
+            This_Thread_Row->counts[ static_cast<size_t>(cell + This_Thread_Row->cells*(energy_bin + DETECTOR_ENERGY_BINS*order)) ] += A->get_weight();
+        }
+    }
 
+    //Per-hit text output.
+    if(Handle_Detector >= 0){
+        Loaded_Functions.logging_by_channel(Handle_Detector) << A->Interactions[0].energy << " " << pos.x << " " << pos.y << " " << pos.z << " " << (A->Interactions.size() - 1) << '\n';
+    }
+    return;
+}
+
+
+//Klein-Nishina angular distribution, normalized per steradian over the sphere, for a photon of energy E scattering by angle theta.
+static double klein_nishina_pdf(const double &E, const double &cos_theta){
+    const double a = E/electron_mass;
+    const double k = 1.0/(1.0 + a*(1.0 - cos_theta));  //E'/E.
+    const double l = log(1.0 + 2.0*a);
+    const double sigma = 2.0*M_PI*( (1.0 + a)/(a*a)*(2.0*(1.0 + a)/(1.0 + 2.0*a) - l/a) + 0.5*l/a - (1.0 + 3.0*a)/((1.0 + 2.0*a)*(1.0 + 2.0*a)) );
+    return 0.5*k*k*(k + 1.0/k - (1.0 - cos_theta*cos_theta))/sigma;
+}
+
+//Optical depth for a photon of energy E from 'from' to 'to', or 1E99 if the ray is absorbed (or enters the detector early.)
+static double optical_depth(const vec3<double> &from, const vec3<double> &to, const double &E, const struct Functions &Loaded_Functions){
+    vec3<double> dir = to;
+    dir -= from;
+    double remaining = dir.length();
+    dir = dir.unit();
+
+    vec3<double> pos = from;
+    double depth = 0.0;
+    while(remaining > 0.0){
+        const unsigned char material = Loaded_Functions.which_material(pos);
+        if(material == Material::Black) return 1E99;
+        if(material == Material::Detector) return (remaining < 1E-6) ? depth : 1E99;
+
+        const double step = std::min(Loaded_Functions.distance_to_boundary(pos, dir) + BOUNDARY_STEP_OVER, remaining);
+        if(material == Material::Water){
+            depth += step*Loaded_Functions.photon_mass_coefficient_total(E);
+        }else if(material != Material::Vacuum){
+            if((Loaded_Functions.material_defined == NULL) || !Loaded_Functions.material_defined(material)){
+                FUNCERR("Forced detection ray crossed material " << (int)(material) << ", for which no data is loaded");
+            }
+            depth += step*Loaded_Functions.material_mass_coefficient_total(material, E)*Loaded_Functions.material_density(material);
+        }
+        pos += dir*step;
+        remaining -= step;
+    }
+    return depth;
+}
+
+//Forced detection. Called with a photon just before it Compton scatters. For each detector cell, the photon would need to scatter
+// towards the cell (probability density from Klein-Nishina, times the solid angle of the cell) and then cross to the cell without
+// interacting. The product, times the photon's weight, is the expected count in that cell. The photon itself is left untouched.
+void detector_forced(base_particle &A, const struct Functions &Loaded_Functions){
+    if((This_Thread_Row == nullptr) || This_Thread_Row->forced.empty()) return;
+
+    const vec3<double> pos = A.get_position3();
+    const vec3<double> dir = A.get_relativistic_three_momentum3().unit();
+    const double E = A.get_energy();
+
+    long int order = 0;
+    if(DETECTOR_SCATTER_ORDERS > 1){
+        for(const auto &I : A.Interactions){  //Includes this event.
+            if((I.interaction == Interactiontype::Compton) || (I.interaction == Interactiontype::Coherent)) ++order;
+        }
+        if(order >= DETECTOR_SCATTER_ORDERS) order = DETECTOR_SCATTER_ORDERS - 1;
+    }
+
+    vec3<double> centre, normal;
+    double area;
+    for(long int cell = 0; cell < This_Thread_Row->cells; ++cell){
+        Loaded_Functions.detector_cell_face(cell, centre, normal, area);
+
+        vec3<double> ray = centre;
+        ray -= pos;
+        const double d2 = ray.x*ray.x + ray.y*ray.y + ray.z*ray.z;
+        if(!(d2 > 0.0)) continue;
+        ray = ray.unit();
+
+        const double cos_theta = std::max(-1.0, std::min(1.0, dir.x*ray.x + dir.y*ray.y + dir.z*ray.z));
+        const double E_out = E/(1.0 + (E/electron_mass)*(1.0 - cos_theta));
+        if(E_out <= PHOTON_SEPUKU_ENERGY_THRESHOLD) continue;
+
+        const double solid_angle = area*fabs(ray.x*normal.x + ray.y*normal.y + ray.z*normal.z)/d2;
+        const double tau = optical_depth(pos, centre, E_out, Loaded_Functions);
+        if(tau >= 1E99) continue;
+
+        long int energy_bin = static_cast<long int>( E_out/DETECTOR_ENERGY_MAX * static_cast<double>(DETECTOR_ENERGY_BINS) );
+        if(energy_bin >= DETECTOR_ENERGY_BINS) energy_bin = DETECTOR_ENERGY_BINS - 1;
+
+        This_Thread_Row->forced[ static_cast<size_t>(cell + This_Thread_Row->cells*(energy_bin + DETECTOR_ENERGY_BINS*order)) ]
+            += A.get_weight() * klein_nishina_pdf(E, cos_theta) * solid_angle * exp(-tau);
+    }
     return;
 }
 
@@ -86,4 +322,3 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 #ifdef __cplusplus
     }
 #endif
-
@@ -0,0 +1,666 @@
+//Geometry_CSG.cc - Builds a geometry out of simple primitives (boxes, spheres, cylinders, half-spaces) which are combined with
+// CSG operations (union, intersection, subtraction) and assigned materials. The scene is described in a text file, so new setups
+// do not need a new geometry module or a recompile.
+//
+//The scene file is "./Geometry_CSG.scene" unless the TRANSPORT_SCENE environment variable names another. See that file for the
+// format. Briefly: a 'world' box (outside of which everything is Black), named primitives and CSG combinations of them, and
+// 'region' lines which assign a material to a named shape. Where regions overlap, the one listed last wins, so it is natural to
+// list a container first and its contents after. Regions may also be given an importance, which drives photon splitting and
+// Russian roulette in the transport code, and an exponential transform (a stretching parameter and direction.)
+//
+//The regions are held in a bounding volume hierarchy (BVH) so that point and ray queries only consider the handful of regions near
+// the point or along the ray. Scenes with hundreds of components (e.g., collimator leaves) stay fast.
+//
+//Programming notes:
+//  -Do not make items here "const", because they will not show up when loading.
+//  -Avoid using macro variables here because they will be obliterated during loading.
+//  -Wrap dynamically-loaded code with extern "C", otherwise C++ compilation will mangle function names, etc.
+//  -The scene is loaded when the library is loaded, and is only read afterward, so queries are safe from any thread.
+//
+// From man page for dlsym/dlopen:  For running some 'initialization' code prior to finishing loading:
+// "Instead,  libraries  should  export  routines using the __attribute__((constructor)) and __attribute__((destructor)) function attributes.  See the gcc info pages for
+//       information on these.  Constructor routines are executed before dlopen() returns, and destructor routines are executed before dlclose() returns."
+//   ---for instance, we can use this to seed a random number generator with a random seed. However, in order to pass in a specific seed (and pass that seed to the library)
+//      we need to define an explicitly callable initialization function. In general, these libraries should have both so that we can quickly adjust behaviour if desired.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+#include <cmath>
+
+#include "./Misc.h"
+#include "./MyMath.h"
+
+#include "./Constants.h"
+#include "./Structs.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+std::string MODULE_NAME(__FILE__);
+std::string FILE_TYPE("GEOMETRY");
+
+bool VERBOSE = false;
+double SMALLEST_FEATURE = 1.0;     //The smallest feature in the geometry. Overwritten by the scene, if it provides one.
+
+std::string SCENE_FILE("./Geometry_CSG.scene");
+
+vec3<double> position(0.0, 0.0, 0.0);     //The geometric location of the center of the source's spout.
+vec3<double> direction(0.0, 0.0, -1.0);   //Beam direction.
+double beam_spread = 0.0;                 //Beam particles start uniformly within +-beam_spread (in x and y) of the position.
+
+
+struct aabb {
+    double lo[3];
+    double hi[3];
+};
+
+enum csg_kind : unsigned char { Box, Sphere, Cylinder, Plane, Union, Intersect, Subtract };
+
+struct csg_node {
+    csg_kind kind;
+    double p[8];                    //Primitive parameters, in the order they are given in the scene file.
+    std::vector<size_t> children;   //CSG operands. For Subtract, the first is the minuend.
+    aabb bounds;
+};
+
+struct region {
+    size_t node;
+    unsigned char material;
+    double importance;
+    double stretch;                 //Exponential transform parameter. Zero for none.
+    vec3<double> bias;              //Exponential transform direction (unit.)
+};
+
+//A flattened BVH. Internal nodes have their children at 'first' and 'first + 1'. Leaves hold 'count' regions, which are listed
+// (by region number) in BVH_Regions[first, first + count).
+struct bvh_node {
+    aabb bounds;
+    uint32_t first;
+    uint32_t count;
+};
+
+aabb World = { { -1E3, -1E3, -1E3 }, { 1E3, 1E3, 1E3 } };
+unsigned char Default_Material = Material::Vacuum;
+std::vector<csg_node> Nodes;
+std::vector<region>   Regions;
+std::vector<bvh_node> BVH;
+std::vector<uint32_t> BVH_Regions;
+
+
+//---------------------------------------------- Primitives -------------------------------------------------
+static bool aabb_contains(const aabb &B, const vec3<double> &in){
+    return (in.x >= B.lo[0]) && (in.x <= B.hi[0])
+        && (in.y >= B.lo[1]) && (in.y <= B.hi[1])
+        && (in.z >= B.lo[2]) && (in.z <= B.hi[2]);
+}
+
+//Ray (from p along d) vs. box. Gives the parametric interval [t0, t1] the ray is within the box. False if it misses.
+static bool aabb_ray(const aabb &B, const vec3<double> &p, const vec3<double> &d, double &t0, double &t1){
+    const double P[3] = { p.x, p.y, p.z }, D[3] = { d.x, d.y, d.z };
+    t0 = -1E99;
+    t1 =  1E99;
+    for(size_t i=0; i<3; ++i){
+        if(D[i] == 0.0){
+            if((P[i] < B.lo[i]) || (P[i] > B.hi[i])) return false;
+            continue;
+        }
+        double ta = (B.lo[i] - P[i])/D[i], tb = (B.hi[i] - P[i])/D[i];
+        if(ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+    return t0 <= t1;
+}
+
+static void nearer(const double &t, double &dist){
+    if((t > 0.0) && (t < dist)) dist = t;
+    return;
+}
+
+static bool inside(const csg_node &N, const vec3<double> &in){
+    switch(N.kind){
+        case Box:
+            return (in.x >= N.p[0]) && (in.y >= N.p[1]) && (in.z >= N.p[2])
+                && (in.x <= N.p[3]) && (in.y <= N.p[4]) && (in.z <= N.p[5]);
+
+        case Sphere:{
+            const double dx = in.x - N.p[0], dy = in.y - N.p[1], dz = in.z - N.p[2];
+            return (dx*dx + dy*dy + dz*dz) <= N.p[3]*N.p[3];
+        }
+
+        case Cylinder:{
+            const double vx = in.x - N.p[0], vy = in.y - N.p[1], vz = in.z - N.p[2];
+            const double s = vx*N.p[3] + vy*N.p[4] + vz*N.p[5];
+            return (fabs(s) <= N.p[7]) && ((vx*vx + vy*vy + vz*vz - s*s) <= N.p[6]*N.p[6]);
+        }
+
+        case Plane:
+            return (in.x*N.p[0] + in.y*N.p[1] + in.z*N.p[2]) <= N.p[3];
+
+        case Union:
+            for(const size_t &c : N.children) if(inside(Nodes[c], in)) return true;
+            return false;
+
+        case Intersect:
+            for(const size_t &c : N.children) if(!inside(Nodes[c], in)) return false;
+            return true;
+
+        case Subtract:
+            if(!inside(Nodes[N.children[0]], in)) return false;
+            for(size_t i=1; i<N.children.size(); ++i) if(inside(Nodes[N.children[i]], in)) return false;
+            return true;
+    }
+    return false;
+}
+
+//Lowers 'dist' to the nearest crossing (ahead of p, along unit vector d) of any primitive surface making up the node. CSG
+// operations only ever remove surfaces, so testing all of them may stop short but never overshoots.
+static void surfaces(const csg_node &N, const vec3<double> &p, const vec3<double> &d, double &dist){
+    switch(N.kind){
+        case Box:{
+            const aabb B = { { N.p[0], N.p[1], N.p[2] }, { N.p[3], N.p[4], N.p[5] } };
+            double t0, t1;
+            if(aabb_ray(B, p, d, t0, t1)){
+                nearer(t0, dist);
+                nearer(t1, dist);
+            }
+            return;
+        }
+
+        case Sphere:{
+            const double px = p.x - N.p[0], py = p.y - N.p[1], pz = p.z - N.p[2];
+            const double b    = px*d.x + py*d.y + pz*d.z;
+            const double disc = b*b - (px*px + py*py + pz*pz - N.p[3]*N.p[3]);
+            if(disc < 0.0) return;
+            const double root = sqrt(disc);
+            nearer(-b - root, dist);
+            nearer(-b + root, dist);
+            return;
+        }
+
+        case Cylinder:{
+            const double vx = p.x - N.p[0], vy = p.y - N.p[1], vz = p.z - N.p[2];
+            const double s0 = vx*N.p[3] + vy*N.p[4] + vz*N.p[5];      //Axial position and rate of change.
+            const double ds = d.x*N.p[3] + d.y*N.p[4] + d.z*N.p[5];
+
+            //Side. Solve for the radial (perpendicular to the axis) distance equal to the radius.
+            const double ux = vx - s0*N.p[3], uy = vy - s0*N.p[4], uz = vz - s0*N.p[5];
+            const double ex = d.x - ds*N.p[3], ey = d.y - ds*N.p[4], ez = d.z - ds*N.p[5];
+            const double a = ex*ex + ey*ey + ez*ez;
+            if(a > 0.0){
+                const double b    = (ux*ex + uy*ey + uz*ez)/a;
+                const double disc = b*b - (ux*ux + uy*uy + uz*uz - N.p[6]*N.p[6])/a;
+                if(disc >= 0.0){
+                    const double root = sqrt(disc);
+                    for(const double &t : { -b - root, -b + root }){
+                        if(fabs(s0 + t*ds) <= N.p[7]) nearer(t, dist);
+                    }
+                }
+            }
+
+            //End caps.
+            if(ds != 0.0){
+                for(const double &cap : { -N.p[7], N.p[7] }){
+                    const double t = (cap - s0)/ds;
+                    const double rx = ux + t*ex, ry = uy + t*ey, rz = uz + t*ez;
+                    if((rx*rx + ry*ry + rz*rz) <= N.p[6]*N.p[6]) nearer(t, dist);
+                }
+            }
+            return;
+        }
+
+        case Plane:{
+            const double dn = d.x*N.p[0] + d.y*N.p[1] + d.z*N.p[2];
+            if(dn != 0.0) nearer((N.p[3] - (p.x*N.p[0] + p.y*N.p[1] + p.z*N.p[2]))/dn, dist);
+            return;
+        }
+
+        case Union:
+        case Intersect:
+        case Subtract:
+            for(const size_t &c : N.children) surfaces(Nodes[c], p, d, dist);
+            return;
+    }
+    return;
+}
+
+
+//Distance from p to the box (zero if inside.)
+static double aabb_distance(const aabb &B, const vec3<double> &p){
+    const double P[3] = { p.x, p.y, p.z };
+    double sq = 0.0;
+    for(size_t i=0; i<3; ++i){
+        const double out = std::max(B.lo[i] - P[i], P[i] - B.hi[i]);
+        if(out > 0.0) sq += out*out;
+    }
+    return sqrt(sq);
+}
+
+//Lowers 'dist' to the distance (in any direction) from p to the nearest primitive surface making up the node. As in surfaces(),
+// testing every primitive may underestimate but never overestimates.
+static void safety(const csg_node &N, const vec3<double> &p, double &dist){
+    switch(N.kind){
+        case Box:{
+            const aabb B = { { N.p[0], N.p[1], N.p[2] }, { N.p[3], N.p[4], N.p[5] } };
+            double d = aabb_distance(B, p);
+            if(d == 0.0){
+                d = std::min({ p.x - N.p[0], p.y - N.p[1], p.z - N.p[2], N.p[3] - p.x, N.p[4] - p.y, N.p[5] - p.z });
+            }
+            dist = std::min(dist, d);
+            return;
+        }
+
+        case Sphere:{
+            const double dx = p.x - N.p[0], dy = p.y - N.p[1], dz = p.z - N.p[2];
+            dist = std::min(dist, fabs(sqrt(dx*dx + dy*dy + dz*dz) - N.p[3]));
+            return;
+        }
+
+        case Cylinder:{
+            const double vx = p.x - N.p[0], vy = p.y - N.p[1], vz = p.z - N.p[2];
+            const double s  = vx*N.p[3] + vy*N.p[4] + vz*N.p[5];
+            const double radial = sqrt(std::max(0.0, vx*vx + vy*vy + vz*vz - s*s)) - N.p[6];
+            const double axial  = fabs(s) - N.p[7];
+            if((radial <= 0.0) && (axial <= 0.0)){
+                dist = std::min(dist, std::min(-radial, -axial));
+            }else{
+                const double r = std::max(radial, 0.0), a = std::max(axial, 0.0);
+                dist = std::min(dist, sqrt(r*r + a*a));
+            }
+            return;
+        }
+
+        case Plane:
+            dist = std::min(dist, fabs(p.x*N.p[0] + p.y*N.p[1] + p.z*N.p[2] - N.p[3]));
+            return;
+
+        case Union:
+        case Intersect:
+        case Subtract:
+            for(const size_t &c : N.children) safety(Nodes[c], p, dist);
+            return;
+    }
+    return;
+}
+
+
+//---------------------------------------------- Scene loading ----------------------------------------------
+static aabb merge(const aabb &A, const aabb &B){
+    aabb out;
+    for(size_t i=0; i<3; ++i){
+        out.lo[i] = std::min(A.lo[i], B.lo[i]);
+        out.hi[i] = std::max(A.hi[i], B.hi[i]);
+    }
+    return out;
+}
+
+static aabb overlap(const aabb &A, const aabb &B){
+    aabb out;
+    for(size_t i=0; i<3; ++i){
+        out.lo[i] = std::max(A.lo[i], B.lo[i]);
+        out.hi[i] = std::min(A.hi[i], B.hi[i]);
+    }
+    return out;
+}
+
+//Conservative bounds. Half-spaces (and anything else unbounded) are clipped to the world.
+static aabb node_bounds(const csg_node &N){
+    aabb B = World;
+    switch(N.kind){
+        case Box:
+            B = { { N.p[0], N.p[1], N.p[2] }, { N.p[3], N.p[4], N.p[5] } };
+            break;
+
+        case Sphere:
+            for(size_t i=0; i<3; ++i){
+                B.lo[i] = N.p[i] - N.p[3];
+                B.hi[i] = N.p[i] + N.p[3];
+            }
+            break;
+
+        case Cylinder:
+            for(size_t i=0; i<3; ++i){
+                const double a = N.p[3+i];
+                const double extent = fabs(a)*N.p[7] + N.p[6]*sqrt(std::max(0.0, 1.0 - a*a));
+                B.lo[i] = N.p[i] - extent;
+                B.hi[i] = N.p[i] + extent;
+            }
+            break;
+
+        case Plane:
+            break;
+
+        case Union:
+            B = Nodes[N.children[0]].bounds;
+            for(size_t i=1; i<N.children.size(); ++i) B = merge(B, Nodes[N.children[i]].bounds);
+            break;
+
+        case Intersect:
+            for(const size_t &c : N.children) B = overlap(B, Nodes[c].bounds);
+            break;
+
+        case Subtract:
+            B = Nodes[N.children[0]].bounds;
+            break;
+    }
+    return overlap(B, World);
+}
+
+static unsigned char material_from_name(const std::string &name){
+    if(name == "Black")    return Material::Black;
+    if(name == "Vacuum")   return Material::Vacuum;
+    if(name == "Air")      return Material::Air;
+    if(name == "Water")    return Material::Water;
+    if(name == "Detector") return Material::Detector;
+    if(name == "Bone")     return Material::Bone;
+    if(name == "Lung")     return Material::Lung;
+    if(name == "Tissue")   return Material::Tissue;
+    if(name == "PMMA")     return Material::PMMA;
+    if(name == "Tungsten") return Material::Tungsten;
+    FUNCERR("Unknown material '" << name << "' in scene file. Known materials: Black, Vacuum, Air, Water, Detector, Bone, Lung, Tissue, PMMA, Tungsten");
+    return Material::Unknown;
+}
+
+//Fills in BVH node 'index' to cover regions [begin, end) of BVH_Regions, appending child nodes as needed.
+static void build_bvh(uint32_t index, uint32_t begin, uint32_t end){
+    aabb B = Nodes[Regions[BVH_Regions[begin]].node].bounds;
+    for(uint32_t i = begin + 1; i < end; ++i) B = merge(B, Nodes[Regions[BVH_Regions[i]].node].bounds);
+    BVH[index].bounds = B;
+
+    if((end - begin) <= 4){
+        BVH[index].first = begin;
+        BVH[index].count = end - begin;
+        return;
+    }
+
+    //Split at the median centroid along the longest axis.
+    size_t axis = 0;
+    for(size_t i=1; i<3; ++i) if((B.hi[i] - B.lo[i]) > (B.hi[axis] - B.lo[axis])) axis = i;
+    const uint32_t mid = begin + (end - begin)/2;
+    std::nth_element(BVH_Regions.begin() + begin, BVH_Regions.begin() + mid, BVH_Regions.begin() + end,
+                     [axis](const uint32_t &L, const uint32_t &R) -> bool {
+                         const aabb &A = Nodes[Regions[L].node].bounds, &C = Nodes[Regions[R].node].bounds;
+                         return (A.lo[axis] + A.hi[axis]) < (C.lo[axis] + C.hi[axis]);
+                     });
+
+    //Children are kept adjacent.
+    const uint32_t left = static_cast<uint32_t>(BVH.size());
+    BVH.resize(BVH.size() + 2);
+    BVH[index].first = left;
+    BVH[index].count = 0;
+    build_bvh(left,     begin, mid);
+    build_bvh(left + 1, mid,   end);
+    return;
+}
+
+static void load_scene(const std::string &filename){
+    std::ifstream FI(filename.c_str(), std::ios::in);
+    if(!FI.good()) FUNCERR("Unable to open scene file '" << filename << "'");
+
+    std::map<std::string, size_t> named;
+    auto lookup = [&](const std::string &name) -> size_t {
+        auto it = named.find(name);
+        if(it == named.end()) FUNCERR("Scene file refers to undefined shape '" << name << "'");
+        return it->second;
+    };
+
+    std::string line;
+    long int line_number = 0;
+    while(getline(FI, line)){
+        ++line_number;
+        const std::string::size_type hash = line.find('#');
+        if(hash != std::string::npos) line.erase(hash);
+        std::stringstream ss(line);
+        std::string keyword;
+        if(!(ss >> keyword)) continue;
+
+        if(keyword == "world"){
+            ss >> World.lo[0] >> World.lo[1] >> World.lo[2] >> World.hi[0] >> World.hi[1] >> World.hi[2];
+        }else if(keyword == "default"){
+            std::string name;
+            ss >> name;
+            Default_Material = material_from_name(name);
+        }else if(keyword == "smallest_feature"){
+            ss >> SMALLEST_FEATURE;
+        }else if(keyword == "beam"){
+            ss >> position.x >> position.y >> position.z >> direction.x >> direction.y >> direction.z;
+            if(!(ss >> beam_spread)){
+                beam_spread = 0.0;
+                ss.clear();
+            }
+            direction = direction.unit();
+
+        }else if((keyword == "box") || (keyword == "sphere") || (keyword == "cylinder") || (keyword == "plane")){
+            csg_node N;
+            std::string name;
+            ss >> name;
+            size_t numb = 0;
+            if(keyword == "box"){      N.kind = Box;      numb = 6; }
+            if(keyword == "sphere"){   N.kind = Sphere;   numb = 4; }
+            if(keyword == "cylinder"){ N.kind = Cylinder; numb = 8; }
+            if(keyword == "plane"){    N.kind = Plane;    numb = 4; }
+            for(size_t i=0; i<numb; ++i) ss >> N.p[i];
+
+            //Axes and normals are normalized so the queries can assume unit vectors.
+            if((N.kind == Cylinder) || (N.kind == Plane)){
+                const size_t o = (N.kind == Cylinder) ? 3 : 0;
+                const double len = sqrt(N.p[o]*N.p[o] + N.p[o+1]*N.p[o+1] + N.p[o+2]*N.p[o+2]);
+                if(!(len > 0.0)) FUNCERR("Scene file line " << line_number << ": zero-length axis or normal");
+                for(size_t i=0; i<3; ++i) N.p[o+i] /= len;
+                if(N.kind == Plane) N.p[3] /= len;
+            }
+            if(ss.fail()) FUNCERR("Scene file line " << line_number << ": unable to parse '" << keyword << "'");
+            N.bounds = node_bounds(N);
+            named[name] = Nodes.size();
+            Nodes.push_back(N);
+
+        }else if((keyword == "union") || (keyword == "intersect") || (keyword == "subtract")){
+            csg_node N;
+            std::string name, operand;
+            ss >> name;
+            N.kind = (keyword == "union") ? Union : ((keyword == "intersect") ? Intersect : Subtract);
+            while(ss >> operand) N.children.push_back(lookup(operand));
+            if(N.children.empty()) FUNCERR("Scene file line " << line_number << ": '" << keyword << "' needs operands");
+            N.bounds = node_bounds(N);
+            named[name] = Nodes.size();
+            Nodes.push_back(N);
+
+        }else if(keyword == "region"){
+            std::string name, material;
+            double importance = 1.0, stretch = 0.0;
+            vec3<double> bias(0.0, 0.0, -1.0);
+            ss >> name >> material;
+            if(ss.fail()) FUNCERR("Scene file line " << line_number << ": unable to parse 'region'");
+            if(!(ss >> importance)) importance = 1.0;
+            if(!(importance > 0.0)) FUNCERR("Scene file line " << line_number << ": region importance must be positive");
+            if(ss >> stretch){
+                if(!(ss >> bias.x >> bias.y >> bias.z)) FUNCERR("Scene file line " << line_number << ": region stretch needs a direction");
+                if(!(fabs(stretch) < 1.0)) FUNCERR("Scene file line " << line_number << ": region stretch must be within (-1,1)");
+                if(bias.length() <= 0.0) FUNCERR("Scene file line " << line_number << ": region stretch direction must be nonzero");
+                bias = bias.unit();
+            }
+            Regions.push_back({ lookup(name), material_from_name(material), importance, stretch, bias });
+
+        }else{
+            FUNCERR("Scene file line " << line_number << ": unknown keyword '" << keyword << "'");
+        }
+    }
+
+    if(!Regions.empty()){
+        BVH_Regions.resize(Regions.size());
+        for(uint32_t i=0; i<BVH_Regions.size(); ++i) BVH_Regions[i] = i;
+        BVH.resize(1);
+        build_bvh(0, 0, static_cast<uint32_t>(Regions.size()));
+    }
+    if(VERBOSE) FUNCINFO("Loaded " << Nodes.size() << " shapes and " << Regions.size() << " regions (" << BVH.size() << " BVH nodes) from '" << filename << "'");
+    return;
+}
+
+//Loads the scene once the globals above have been constructed.
+struct scene_loader {
+    scene_loader(){
+        const char *env = getenv("TRANSPORT_SCENE");
+        if(env != nullptr) SCENE_FILE = env;
+        load_scene(SCENE_FILE);
+    }
+} Scene_Loader;
+
+
+#ifdef __GNUG__
+    __attribute__((constructor)) static void init_on_dynamic_load(void){
+        //Do something automatic here.
+        if(VERBOSE) FUNCINFO("Loaded lib_geometry_csg.so");
+        return;
+    }
+
+    __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
+        //Cleanup memory (if needed) automatically here.
+        if(VERBOSE) FUNCINFO("Closed lib_geometry_csg.so");
+        return;
+    }
+#else
+    #warning Being compiled with non-gcc compiler. Unable to use gcc-specific function declarations like 'attribute.' Proceed at your own risk!
+#endif
+
+void toggle_verbosity(bool in){
+    VERBOSE = in;
+    return;
+}
+
+
+void set_position(const vec3<double> &in){
+    position = in;
+    return;
+}
+
+vec3<double> get_position(const struct Functions &Loaded_Funcs){
+    if(beam_spread == 0.0) return position;
+    return vec3<double>(position.x + beam_spread*(2.0*Loaded_Funcs.PRNG_source()-1.0), position.y + beam_spread*(2.0*Loaded_Funcs.PRNG_source()-1.0), position.z);
+}
+
+
+//Given three clamped [0,1], random, uniformly-distributed numbers, we return a (three-vector) unit vector pointing in the direction
+// which a new beam particle will have. Here it is simply the direction given in the scene file.
+vec3<double> get_orientation(const double &, const double &, const double &){
+    return direction;
+}
+
+
+//The last-listed region containing the point, or -1 if there is none. Only regions listed after the best so far need to be checked.
+static long int region_at(const vec3<double> &in){
+    long int best = -1;
+    if(BVH.empty()) return best;
+
+    uint32_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        const bvh_node &B = BVH[stack[--top]];
+        if(!aabb_contains(B.bounds, in)) continue;
+        if(B.count == 0){
+            stack[top++] = B.first;
+            stack[top++] = B.first + 1;
+            continue;
+        }
+        for(uint32_t i = B.first; i < B.first + B.count; ++i){
+            const uint32_t r = BVH_Regions[i];
+            if((static_cast<long int>(r) > best) && inside(Nodes[Regions[r].node], in)) best = static_cast<long int>(r);
+        }
+    }
+    return best;
+}
+
+unsigned char geometry_type(const vec3<double> &in){
+    if(!aabb_contains(World, in)) return Material::Black;
+    const long int best = region_at(in);
+    return (best == -1) ? Default_Material : Regions[best].material;
+}
+
+//Importance of the region containing the point (1 outside of any region, or where none was given.)
+double importance(const vec3<double> &in){
+    if(!aabb_contains(World, in)) return 1.0;
+    const long int best = region_at(in);
+    return (best == -1) ? 1.0 : Regions[best].importance;
+}
+
+//Exponential transform parameter and direction of the region containing the point (0 outside of any region.)
+double exponential_transform(const vec3<double> &in, vec3<double> &bias){
+    if(!aabb_contains(World, in)) return 0.0;
+    const long int best = region_at(in);
+    if(best == -1) return 0.0;
+    bias = Regions[best].bias;
+    return Regions[best].stretch;
+}
+
+
+//Distance along dir (a unit vector) to the next surface which may separate materials: the surfaces of the regions along the ray,
+// or the edge of the world.
+double distance_to_boundary(const vec3<double> &pos, const vec3<double> &dir){
+    double dist = 1E99, t0, t1;
+    if(aabb_ray(World, pos, dir, t0, t1)){
+        nearer(t0, dist);
+        nearer(t1, dist);
+    }
+    if(BVH.empty()) return dist;
+
+    uint32_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        const bvh_node &B = BVH[stack[--top]];
+        if(!aabb_ray(B.bounds, pos, dir, t0, t1) || (t1 < 0.0) || (t0 > dist)) continue;
+        if(B.count == 0){
+            stack[top++] = B.first;
+            stack[top++] = B.first + 1;
+            continue;
+        }
+        for(uint32_t i = B.first; i < B.first + B.count; ++i){
+            const csg_node &N = Nodes[Regions[BVH_Regions[i]].node];
+            if(aabb_ray(N.bounds, pos, dir, t0, t1) && (t1 >= 0.0) && (t0 <= dist)) surfaces(N, pos, dir, dist);
+        }
+    }
+    return dist;
+}
+
+
+//Distance from pos, in any direction, to the nearest surface which may separate materials. Regions whose bounding box is
+// further away than the best so far are skipped.
+double safety_distance(const vec3<double> &pos){
+    if(!aabb_contains(World, pos)) return 0.0;
+    double dist = std::min({ pos.x - World.lo[0], pos.y - World.lo[1], pos.z - World.lo[2],
+                             World.hi[0] - pos.x, World.hi[1] - pos.y, World.hi[2] - pos.z });
+    if(BVH.empty()) return dist;
+
+    uint32_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+    while(top > 0){
+        const bvh_node &B = BVH[stack[--top]];
+        if(aabb_distance(B.bounds, pos) >= dist) continue;
+        if(B.count == 0){
+            stack[top++] = B.first;
+            stack[top++] = B.first + 1;
+            continue;
+        }
+        for(uint32_t i = B.first; i < B.first + B.count; ++i){
+            const csg_node &N = Nodes[Regions[BVH_Regions[i]].node];
+            if(aabb_distance(N.bounds, pos) < dist) safety(N, pos, dist);
+        }
+    }
+    return dist;
+}
+
+
+#ifdef __cplusplus
+    }
+#endif
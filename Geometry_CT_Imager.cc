@@ -40,6 +40,8 @@ bool VERBOSE = false;
 
 const int NUMB_OF_CELLS = 3;      //There is a bug in this code that somehow doubles this number!
 
+long int DETECTOR_BINS = 128;     //The number of bins the detector arc is split into when tallying hits. Independent of the combs.
+
 const double r_out         = 15.0;
 const double r_source      = r_out - 1.0;
 const double r_coll        = r_out - 2.0;
@@ -62,6 +64,17 @@ const double theta_det_max = (3.0/4.0)*2.0*M_PI + 0.5*dtheta_det;
 
 vec3<double> position(0.0, 0.0, -14.0); //The geometric location of the beam point 'spout.'
 
+//Gantry rotation. Rather than moving the source and detector, the object is rotated (about the y-axis, in the opposite sense)
+// so that the imager geometry never changes. Each thread has its own angle so several angles can be simulated concurrently.
+thread_local double gantry_angle     = 0.0;
+thread_local double gantry_cos_angle = 1.0;
+thread_local double gantry_sin_angle = 0.0;
+
+bool PHANTOM = false;   //If true, a simple (deliberately asymmetric) water phantom is placed in the object region.
+
+double IMPORTANCE_DETECTOR_SIDE = 1.0; //Importance of the object on the detector side (z > 0) of the isocenter. Raising it (e.g., to 4)
+                                       // splits photons which scatter there, where they are most likely to reach the detector.
+
 
 
 #ifdef __GNUG__
@@ -94,6 +107,30 @@ vec3<double> get_position(const struct Functions &Loaded_Funcs){ //External sour
     return position;
 }
 
+//Sets the gantry angle (in radians) for the calling thread.
+void set_gantry_angle(const double &in){
+    gantry_angle     = in;
+    gantry_cos_angle = cos(in);
+    gantry_sin_angle = sin(in);
+    return;
+}
+
+
+//The object, in its own frame. Only consulted within the clearance radius.
+static unsigned char object_material(const vec3<double> &in){
+    if(!PHANTOM) return Material::Vacuum;
+
+    //A water cylinder (along y) with an off-centre hole and a thin water rod beside it. Nothing special, but it is not
+    // rotationally symmetric, so each gantry angle gives a different projection. It fits within the fan at every angle.
+    const double rr  = in.x*in.x + in.z*in.z;
+    const double dx1 = in.x - 0.5, dz1 = in.z - 0.2;
+    const double dx2 = in.x + 1.5, dz2 = in.z;
+    if((dx2*dx2 + dz2*dz2) < 0.2*0.2)   return Material::Water;
+    if((dx1*dx1 + dz1*dz1) < 0.35*0.35) return Material::Vacuum;
+    if(rr < 1.2*1.2) return Material::Water;
+    return Material::Vacuum;
+}
+
 
 
 //Given three clamped [0,1], random, uniformly-distributed numbers, we return a (three-vector) unit vector pointing in the direction 
@@ -203,9 +240,9 @@ unsigned char geometry_type(const vec3<double> &in){
         //FIXME - put some interesting geometry here, load in some data, or do something other than 'stinking water.'
 //        if(r < 0.07*r_clearance) return Material::Water;
 
-
-
-        return Material::Vacuum;
+        //Rotate the point into the object's frame.
+        const vec3<double> obj( gantry_cos_angle*x + gantry_sin_angle*z, y, -gantry_sin_angle*x + gantry_cos_angle*z );
+        return object_material(obj);
 
 
     }
@@ -219,6 +256,145 @@ unsigned char geometry_type(const vec3<double> &in){
 }
 
 
+//Photons which scatter in the object on the detector side are split, and those which scatter again elsewhere in the object are
+// rouletted back to their original weight.
+double importance(const vec3<double> &in){
+    if((in.z <= 0.0) || ((in.x*in.x + in.y*in.y + in.z*in.z) > r_clearance*r_clearance)) return 1.0;
+    return IMPORTANCE_DETECTOR_SIDE;
+}
+
+
+//Batched geometry_type(): x[i], y[i], z[i] to material[i]. Points outside the scanner are culled in a (vectorizable) first pass,
+// so only the remainder go through the full test.
+void geometry_type_batch(const double *x, const double *y, const double *z, unsigned char *material, const size_t &N){
+    const size_t count = N;
+    const unsigned char black = Material::Black, pending = Material::Unknown;  //Local copies (like count), so stores to material[] cannot alias them.
+    const double half_thickness = 0.5*thickness;
+    for(size_t i=0; i<count; ++i){
+        const bool outside = (fabs(y[i]) > half_thickness) || ((x[i]*x[i] + y[i]*y[i] + z[i]*z[i]) > r_out*r_out);
+        material[i] = outside ? black : pending;
+    }
+    for(size_t i=0; i<count; ++i){
+        if(material[i] == pending) material[i] = geometry_type(vec3<double>(x[i], y[i], z[i]));
+    }
+    return;
+}
+
+
+//Returns the detector bin (in [0,DETECTOR_BINS)) a point in the detector falls within, or -1 if the point is not in the detector.
+// Bins are laid out along the detector arc in order of increasing angle.
+long int detector_cell(const vec3<double> &in){
+    const double r = sqrt(in.x*in.x + in.y*in.y + in.z*in.z);
+    if((r < r_det) || (r > r_out) || (fabs(in.y) > 0.5*thickness)) return -1;
+
+    const double theta = atan2(in.z,in.x) + M_PI;
+    if((theta < theta_det_min) || (theta >= theta_det_max)) return -1;
+
+    const long int cell = static_cast<long int>( (theta - theta_det_min)/(theta_det_max - theta_det_min) * static_cast<double>(DETECTOR_BINS) );
+    return (cell < DETECTOR_BINS) ? cell : (DETECTOR_BINS - 1);
+}
+
+long int detector_cell_count(void){
+    return DETECTOR_BINS;
+}
+
+//The inner face of a detector bin: a (nearly flat) patch of the r = r_det sphere. The normal is the inward one, pointing from
+// the face toward the isocenter.
+void detector_cell_face(const long int &cell, vec3<double> &centre, vec3<double> &normal, double &area){
+    const double dtheta = (theta_det_max - theta_det_min)/static_cast<double>(DETECTOR_BINS);
+    const double theta  = theta_det_min + (static_cast<double>(cell) + 0.5)*dtheta;
+    vec3<double> radial(-cos(theta), 0.0, -sin(theta));  //Outward unit vector (inverting theta = atan2(z,x) + pi.)
+    centre = radial * r_det;
+    normal = radial * (-1.0);
+    area   = r_det * dtheta * thickness;
+    return;
+}
+
+
+//Ray-surface helpers for distance_to_boundary(). Each lowers 'dist' if the ray (from p along unit vector d) crosses the surface
+// ahead of it, closer than 'dist'.
+static void nearer_sphere(const vec3<double> &p, const vec3<double> &d, const double &R, double &dist){
+    const double b    = p.x*d.x + p.y*d.y + p.z*d.z;
+    const double disc = b*b - (p.x*p.x + p.y*p.y + p.z*p.z - R*R);
+    if(disc < 0.0) return;
+    const double root = sqrt(disc);
+    const double t1 = -b - root, t2 = -b + root;
+    if((t1 > 0.0) && (t1 < dist)){
+        dist = t1;
+    }else if((t2 > 0.0) && (t2 < dist)){
+        dist = t2;
+    }
+    return;
+}
+
+//Cylinder parallel to the y-axis, through (cx, ?, cz).
+static void nearer_cylinder_y(const vec3<double> &p, const vec3<double> &d, const double &cx, const double &cz, const double &R, double &dist){
+    const double a = d.x*d.x + d.z*d.z;
+    if(a == 0.0) return;
+    const double px = p.x - cx, pz = p.z - cz;
+    const double b    = (px*d.x + pz*d.z)/a;
+    const double disc = b*b - (px*px + pz*pz - R*R)/a;
+    if(disc < 0.0) return;
+    const double root = sqrt(disc);
+    const double t1 = -b - root, t2 = -b + root;
+    if((t1 > 0.0) && (t1 < dist)){
+        dist = t1;
+    }else if((t2 > 0.0) && (t2 < dist)){
+        dist = t2;
+    }
+    return;
+}
+
+//Plane through the y-axis, at angle theta (as used in geometry_type(), i.e., atan2(z,x) + pi.) The whole plane is used, not just
+// the half on the theta side, which only adds a harmless extra stop.
+static void nearer_radial_plane(const vec3<double> &p, const vec3<double> &d, const double &theta, double &dist){
+    const double nx = -sin(theta - M_PI), nz = cos(theta - M_PI);
+    const double dn = d.x*nx + d.z*nz;
+    if(dn == 0.0) return;
+    const double t = -(p.x*nx + p.z*nz)/dn;
+    if((t > 0.0) && (t < dist)) dist = t;
+    return;
+}
+
+//Distance along dir (a unit vector) to the next surface which may separate materials. All surfaces of the imager are checked
+// (the slab faces, the shells, the detector/collimator edges and comb teeth) along with the phantom surfaces, which are
+// tested in the object's (rotated) frame.
+double distance_to_boundary(const vec3<double> &pos, const vec3<double> &dir){
+    double dist = 1E99;
+
+    if(dir.y != 0.0){
+        const double t1 = ( 0.5*thickness - pos.y)/dir.y;
+        const double t2 = (-0.5*thickness - pos.y)/dir.y;
+        if((t1 > 0.0) && (t1 < dist)) dist = t1;
+        if((t2 > 0.0) && (t2 < dist)) dist = t2;
+    }
+
+    nearer_sphere(pos, dir, r_out, dist);
+    nearer_sphere(pos, dir, r_det, dist);
+    nearer_sphere(pos, dir, r_coll, dist);
+    nearer_sphere(pos, dir, r_clearance, dist);
+
+    nearer_radial_plane(pos, dir, theta_det_min, dist);
+    nearer_radial_plane(pos, dir, theta_det_max, dist);
+    if(dtheta_coll > 0.0){
+        const double dtheta_tooth = dtheta_cell/NUMB_OF_CELLS;
+        for(double theta = theta_det_min; theta < theta_det_max; theta += dtheta_tooth){
+            nearer_radial_plane(pos, dir, theta, dist);
+            nearer_radial_plane(pos, dir, theta + dtheta_coll, dist);
+        }
+    }
+
+    if(PHANTOM){
+        const vec3<double> obj_pos( gantry_cos_angle*pos.x + gantry_sin_angle*pos.z, pos.y, -gantry_sin_angle*pos.x + gantry_cos_angle*pos.z );
+        const vec3<double> obj_dir( gantry_cos_angle*dir.x + gantry_sin_angle*dir.z, dir.y, -gantry_sin_angle*dir.x + gantry_cos_angle*dir.z );
+        nearer_cylinder_y(obj_pos, obj_dir,  0.0, 0.0, 1.2,  dist);
+        nearer_cylinder_y(obj_pos, obj_dir,  0.5, 0.2, 0.35, dist);
+        nearer_cylinder_y(obj_pos, obj_dir, -1.5, 0.0, 0.2,  dist);
+    }
+    return dist;
+}
+
+
 #ifdef __cplusplus
     }
 #endif
@@ -35,6 +35,7 @@ std::string FILE_TYPE("GEOMETRY");
 
 double SMALLEST_FEATURE = 1.0;     //The smallest feature in the geometry - useful for transporting particles through a vacuum in a sensible way.
 bool VERBOSE = false;
+bool HISTORIES_RECYCLABLE = true;  //Infinite and homogeneous, so a history can be replayed from any point, in any direction.
 
 vec3<double> position(0.0, 0.0, 0.0); //The geometric location of the beam point 'spout.'
 
@@ -98,7 +99,27 @@ unsigned char geometry_type(const vec3<double> &in){
 }
 
 
+//Batched geometry_type(): x[i], y[i], z[i] to material[i].
+void geometry_type_batch(const double *, const double *, const double *, unsigned char *material, const size_t &N){
+    const size_t count = N;
+    const unsigned char water = Material::Water;  //Local copies, so stores to material[] cannot alias them.
+    for(size_t i=0; i<count; ++i) material[i] = water;
+    return;
+}
+
+
+//There are no boundaries.
+double distance_to_boundary(const vec3<double> &, const vec3<double> &){
+    return 1E99;
+}
+
+
+//There are no boundaries.
+double safety_distance(const vec3<double> &){
+    return 1E99;
+}
+
+
 #ifdef __cplusplus
     }
 #endif
-
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include <cmath>
 
@@ -119,7 +120,48 @@ unsigned char geometry_type(const vec3<double> &in){
 }
 
 
+//Batched geometry_type(): x[i], y[i], z[i] to material[i]. Branch-free, so the loop vectorizes.
+void geometry_type_batch(const double *x, const double *y, const double *z, unsigned char *material, const size_t &N){
+    const size_t count = N;
+    const unsigned char vacuum = Material::Vacuum, water = Material::Water, black = Material::Black;  //Local copies (like count), so stores to material[] cannot alias them.
+    for(size_t i=0; i<count; ++i){
+        const bool outside = (x[i]*x[i] + y[i]*y[i] + z[i]*z[i]) > 1E6;
+        const unsigned char m = (z[i] > 0.0) ? vacuum : ((z[i] >= -50.0) ? water : black);
+        material[i] = outside ? black : m;
+    }
+    return;
+}
+
+
+//Distance along dir (a unit vector) to the next material boundary: the z = 0 or z = -50 planes, or the bounding sphere.
+double distance_to_boundary(const vec3<double> &pos, const vec3<double> &dir){
+    double dist = 1E99;
+
+    if(dir.z != 0.0){
+        const double planes[2] = { 0.0, -50.0 };
+        for(const double &plane : planes){
+            const double t = (plane - pos.z)/dir.z;
+            if((t > 0.0) && (t < dist)) dist = t;
+        }
+    }
+
+    const double b    = pos.x*dir.x + pos.y*dir.y + pos.z*dir.z;
+    const double disc = b*b - (pos.x*pos.x + pos.y*pos.y + pos.z*pos.z - 1E6);
+    if(disc >= 0.0){
+        const double t = -b + sqrt(disc);
+        if((t > 0.0) && (t < dist)) dist = t;
+    }
+    return dist;
+}
+
+
+//Distance from pos, in any direction, to the nearest boundary: the z = 0 or z = -50 planes, or the bounding sphere.
+double safety_distance(const vec3<double> &pos){
+    const double to_sphere = 1E3 - sqrt(pos.x*pos.x + pos.y*pos.y + pos.z*pos.z);
+    return std::max(0.0, std::min({ fabs(pos.z), fabs(pos.z + 50.0), to_sphere }));
+}
+
+
 #ifdef __cplusplus
     }
 #endif
-
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include <cmath>
 
@@ -35,6 +36,13 @@ std::string FILE_TYPE("GEOMETRY");
 
 bool VERBOSE = false;
 double SMALLEST_FEATURE = 1.0;     //The smallest feature in the geometry - useful for transporting particles through a vacuum in a sensible way.
+bool HISTORIES_RECYCLABLE = true;  //Histories may be replayed from other (surface) entry points...
+bool HISTORIES_RECYCLING_APPROXIMATE = true; //...but replays near the side walls score as if the tank were laterally infinite.
+
+//Exponential transform, for deep-penetration runs. Below STRETCH_DEPTH (cm) photon flights are stretched downward with this
+// parameter (within [0,1); zero disables.) Around 0.3-0.4 helps PDD tails; larger values spread the weights too much.
+double STRETCH_PARAMETER = 0.0;
+double STRETCH_DEPTH     = 0.0;
 
 vec3<double> position(0.0, 0.0, 0.0); //The geometric location of the center of the source's spout.
 
@@ -108,9 +116,60 @@ unsigned char geometry_type(const vec3<double> &in){
 }
 
 
+//Batched geometry_type(): x[i], y[i], z[i] to material[i]. Branch-free, so the loop vectorizes. (The bounding sphere test is
+// implied by the tank walls, so it is dropped here.)
+void geometry_type_batch(const double *x, const double *y, const double *z, unsigned char *material, const size_t &N){
+    const size_t count = N;
+    const unsigned char water = Material::Water, black = Material::Black;  //Local copies (like count), so stores to material[] cannot alias them.
+    for(size_t i=0; i<count; ++i){
+        const bool in_tank = (z[i] <= 0.0) && (z[i] >= -50.0) && (fabs(x[i]) <= 15.0) && (fabs(y[i]) <= 15.0);
+        material[i] = in_tank ? water : black;
+    }
+    return;
+}
+
+
+//Distance along dir (a unit vector) to the next material boundary, i.e., the walls of the tank. Outside the tank everything
+// is Black, so only the way in matters there.
+double distance_to_boundary(const vec3<double> &pos, const vec3<double> &dir){
+    const double lo[3] = { -15.0, -15.0, -50.0 };
+    const double hi[3] = {  15.0,  15.0,   0.0 };
+    const double p[3]  = { pos.x, pos.y, pos.z };
+    const double d[3]  = { dir.x, dir.y, dir.z };
+
+    //Slab method. The ray (for t > 0) is within the box over [tmin, tmax].
+    double tmin = -1E99, tmax = 1E99;
+    for(size_t i=0; i<3; ++i){
+        if(d[i] == 0.0){
+            if((p[i] < lo[i]) || (p[i] > hi[i])) return 1E99;
+            continue;
+        }
+        double t1 = (lo[i] - p[i])/d[i], t2 = (hi[i] - p[i])/d[i];
+        if(t1 > t2) std::swap(t1, t2);
+        if(t1 > tmin) tmin = t1;
+        if(t2 < tmax) tmax = t2;
+    }
+    if((tmax < tmin) || (tmax <= 0.0)) return 1E99;
+    return (tmin > 0.0) ? tmin : tmax;
+}
+
+
+
+
+//Distance from pos, in any direction, to the nearest wall of the tank. Nothing outside the tank matters.
+double safety_distance(const vec3<double> &pos){
+    if((pos.z > 0.0) || (pos.z < -50.0) || (fabs(pos.x) > 15.0) || (fabs(pos.y) > 15.0)) return 0.0;
+    return std::min({ 15.0 - fabs(pos.x), 15.0 - fabs(pos.y), -pos.z, pos.z + 50.0 });
+}
+
+
+//Exponential transform parameter and bias direction (straight down, along the beam.)
+double exponential_transform(const vec3<double> &pos, vec3<double> &bias){
+    bias = vec3<double>(0.0, 0.0, -1.0);
+    return (pos.z <= -STRETCH_DEPTH) ? STRETCH_PARAMETER : 0.0;
+}
 
 
 #ifdef __cplusplus
     }
 #endif
-
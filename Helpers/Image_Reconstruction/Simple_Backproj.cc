@@ -1,6 +1,11 @@
-//Simple_Backproj.cc - Simple, unfiltered parallel beam-source geometry reconstruction.
+//Simple_Backproj.cc - Simple, filtered backprojection reconstruction.
 //
-//This program takes a single detector reading (at a single orientation) and performs a basic backprojection.
+//This program takes a single detector reading (at a single orientation) and performs a basic filtered 
+// backprojection. The ramp filtering is done for all orientations with a single (batched) FFT, and the
+// backprojection is pixel-driven and split over threads. Parallel beams are assumed by default, but fan-beam
+// (and FDK cone-beam) data from a point source can also be reconstructed directly. Alternatively, parallel-beam
+// images can be reconstructed iteratively (SART or OSEM) with a precomputed sparse system matrix, which is
+// preferable for noisy data.
 
 #include <iostream>
 #include <fstream>
@@ -9,16 +14,25 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <complex>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include <getopt.h>      //Needed for 'getopts' argument parsing.
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <Magick++.h>
 
 #include <fftw3.h>
 using namespace Magick;
 
-fftw_complex *fft_in_forward, *fft_out_forward;
-fftw_complex *fft_in_backward, *fft_out_backward;
-fftw_plan fft_plan_forward, fft_plan_backward;
-
 
 
 struct Complete_Data { //This represents a complete data set for a CT scan at a fixed angle. Add metadata here as needed.
@@ -104,6 +118,94 @@ std::vector<double> Load_Detector_File(std::string strFilename){
 }
 
 
+//Binary sinograms, as written by the detector module (lib_detect.so). There is a short text header, terminated by a blank
+// line, which gives the shape. Then come rows of float64: the gantry angle followed by counts[order][energy][cell], with
+// the cell varying fastest. The file is mapped rather than read, and each row is reduced (summed over energy, and over
+// scatter order unless only primaries are wanted) into a single orientation.
+//
+//The data need not be aligned in the file (the header is of arbitrary length), so values are copied out with memcpy.
+bool Primaries_Only = false;   //Only count hits which were never scattered (order 0).
+
+bool Is_Sinogram_File(const std::string &strFilename){
+    std::ifstream file(strFilename.c_str(), std::ios::in | std::ios::binary);
+    std::string first_line;
+    getline(file, first_line);
+    return file.good() && (first_line.find("# Transport detector sinogram") == 0);
+}
+
+std::vector<Complete_Data> Load_Sinogram_File(const std::string &strFilename){
+    std::vector<Complete_Data> rows;
+
+    const int fd = open(strFilename.c_str(), O_RDONLY);
+    if(fd == -1){
+        std::cout << "Failed to open file '" << strFilename << "'" << std::endl;
+        return rows;
+    }
+    struct stat file_stat;
+    if((fstat(fd, &file_stat) != 0) || (file_stat.st_size <= 0)){
+        std::cout << "Unable to determine the size of file '" << strFilename << "'" << std::endl;
+        close(fd);
+        return rows;
+    }
+    const size_t file_size = static_cast<size_t>(file_stat.st_size);
+    void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  //The mapping stays valid.
+    if(mapping == MAP_FAILED){
+        std::cout << "Unable to map file '" << strFilename << "' into memory" << std::endl;
+        return rows;
+    }
+    const char *bytes = static_cast<const char *>(mapping);
+
+    //Parse the header. It ends at the first blank line.
+    const std::string head(bytes, std::min(file_size, static_cast<size_t>(4096)));
+    const std::string::size_type header_end = head.find("\n\n");
+    long int cells = -1, energy_bins = -1, scatter_orders = -1;
+    if(header_end != std::string::npos){
+        std::stringstream ss(head.substr(0, header_end));
+        std::string line;
+        while(getline(ss, line)){
+            std::stringstream ls(line);
+            std::string hash, key;
+            long int value;
+            ls >> hash >> key >> value;
+            if(ls.fail()) continue;
+            if(key == "cells:")          cells          = value;
+            if(key == "energy_bins:")    energy_bins    = value;
+            if(key == "scatter_orders:") scatter_orders = value;
+        }
+    }
+    if((cells <= 0) || (energy_bins <= 0) || (scatter_orders <= 0)){
+        std::cout << "Unable to parse the sinogram header of file '" << strFilename << "'" << std::endl;
+        munmap(mapping, file_size);
+        return rows;
+    }
+
+    const size_t data_start = header_end + 2;
+    const size_t row_values = 1 + static_cast<size_t>(scatter_orders*energy_bins*cells);
+    const size_t row_bytes  = row_values*sizeof(double);
+    const size_t numb_rows  = (file_size - data_start)/row_bytes;
+    if((file_size - data_start) % row_bytes != 0){
+        std::cout << "File '" << strFilename << "' ends with a partial row. Ignoring it." << std::endl;
+    }
+
+    const long int orders = Primaries_Only ? 1 : scatter_orders;
+    std::vector<double> buffer(row_values);
+    rows.resize(numb_rows);
+    for(size_t r=0; r<numb_rows; ++r){
+        memcpy(buffer.data(), bytes + data_start + r*row_bytes, row_bytes);
+        rows[r].theta = buffer[0];
+        rows[r].events.assign(cells, 0.0);
+        const double *counts = buffer.data() + 1;
+        for(long int n=0; n<orders*energy_bins; ++n){
+            for(long int c=0; c<cells; ++c) rows[r].events[c] += counts[n*cells + c];
+        }
+    }
+    munmap(mapping, file_size);
+
+    std::sort(rows.begin(), rows.end(), [](const Complete_Data &L, const Complete_Data &R) -> bool { return L.theta < R.theta; });
+    return rows;
+}
+
 
 void Write_Image(int W, int H, std::vector<std::vector<double> > thedata, std::string Filename){
 
@@ -122,35 +224,792 @@ void Write_Image(int W, int H, std::vector<std::vector<double> > thedata, std::s
     }
 
     //This call does all the writing.
-    std::string path = "/tmp/Transport_Image.jpg";
-    magicimg.write( path.c_str() );
+    magicimg.write( Filename.c_str() );
 
     return ;
 }
 
 
-int to_pixel_coordinates_x(double x, double detector_width){
-    double tempx = x + 0.5*detector_width;
-    return (int)rint(tempx/1.0);
+//Split [0:count) into chunks and hand them out to one worker thread per core. The calling thread also works.
+template <class Function> void Run_In_Parallel(size_t count, size_t chunk, Function f){
+    std::atomic<size_t> next(0);
+    auto worker = [&](void) -> void {
+        for(size_t begin = next.fetch_add(chunk); begin < count; begin = next.fetch_add(chunk)){
+            f(begin, std::min(count, begin + chunk));
+        }
+        return;
+    };
+
+    const size_t numb_of_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for(size_t t=1; t<numb_of_threads; ++t) threads.push_back(std::thread(worker));
+    worker();
+    for(auto &t : threads) t.join();
+    return;
+}
+
+//---------------------------------------------------------------------------------------------------
+//------------------------------------ Filtered Backprojection --------------------------------------
+//---------------------------------------------------------------------------------------------------
+//The ramp filter is applied to every orientation at once using a single batched FFTW plan. The plan is
+// cached and only rebuilt when the detector width or the number of orientations changes. Rows are zero-
+// padded to (at least) twice the detector width so the convolution does not wrap around.
+//
+//The filter is built from the band-limited (Ram-Lak) spatial kernel rather than a bare |f| so that the DC
+// term is handled properly. It can optionally be rolled off at high frequency with a window. Equiangular fan-beam
+// data use the modified kernel 0.5*(g/sin(g))^2 h(g) from Kak & Slaney (ch. 3.4.1) instead.
+enum FBP_Window { Ram_Lak, Shepp_Logan, Hann };
+FBP_Window Filter_Window = Hann;
+
+struct Ramp_Filter_Plan {
+    size_t cells  = 0;              //Number of detector cells in a row.
+    size_t rows   = 0;              //Number of rows (orientations) in the batch.
+    size_t padded = 0;              //Zero-padded (real-space) row length.
+    size_t bins   = 0;              //Number of complex frequency bins per row (= padded/2 + 1).
+    double fan_spacing = 0.0;       //Angular cell width (radians) for equiangular fan-beam data. 0 for parallel beams.
+    double       *real     = nullptr;
+    fftw_complex *spectrum = nullptr;
+    fftw_plan forward, backward;
+    std::vector<double> filter;     //Frequency-space filter, including the 1/padded FFTW normalization.
+
+    //A copy of the first row's spectrum before and after filtering. Used only for diagnostics.
+    std::vector<std::complex<double>> sample, sample_filtered;
+};
+Ramp_Filter_Plan Ramp_Plan;
+
+void Destroy_Ramp_Filter_Plan(void){
+    if(Ramp_Plan.padded == 0) return;
+    fftw_destroy_plan(Ramp_Plan.forward);
+    fftw_destroy_plan(Ramp_Plan.backward);
+    fftw_free(Ramp_Plan.real);
+    fftw_free(Ramp_Plan.spectrum);
+    Ramp_Plan.real     = nullptr;
+    Ramp_Plan.spectrum = nullptr;
+    Ramp_Plan.padded   = 0;
+    return;
+}
+
+void Prepare_Ramp_Filter_Plan(size_t cells, size_t rows, double fan_spacing){
+    if((Ramp_Plan.padded != 0) && (Ramp_Plan.cells == cells) && (Ramp_Plan.rows == rows)
+                               && (Ramp_Plan.fan_spacing == fan_spacing)) return;
+    Destroy_Ramp_Filter_Plan();
+
+    size_t padded = 64;
+    while(padded < 2*cells) padded *= 2;
+
+    Ramp_Plan.cells    = cells;
+    Ramp_Plan.rows     = rows;
+    Ramp_Plan.padded   = padded;
+    Ramp_Plan.bins     = padded/2 + 1;
+    Ramp_Plan.fan_spacing = fan_spacing;
+    Ramp_Plan.real     = (double*) fftw_malloc(sizeof(double) * padded * rows);
+    Ramp_Plan.spectrum = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * Ramp_Plan.bins * rows);
+
+    int n[1] = { static_cast<int>(padded) };
+    const int howmany = static_cast<int>(rows);
+    const int bins    = static_cast<int>(Ramp_Plan.bins);
+    Ramp_Plan.forward  = fftw_plan_many_dft_r2c(1, n, howmany, Ramp_Plan.real, nullptr, 1, n[0],
+                                                Ramp_Plan.spectrum, nullptr, 1, bins, FFTW_ESTIMATE);
+    Ramp_Plan.backward = fftw_plan_many_dft_c2r(1, n, howmany, Ramp_Plan.spectrum, nullptr, 1, bins,
+                                                Ramp_Plan.real, nullptr, 1, n[0], FFTW_ESTIMATE);
+
+    //Spatial Ram-Lak kernel (unit cell width): h(0) = 1/4, h(odd n) = -1/(pi n)^2, h(even n) = 0. The fan-beam
+    // kernel (cell width a) is a*g(n a): 1/(8a) at n = 0, -a/(2 (pi sin(n a))^2) for odd n, and 0 otherwise. Both
+    // are real and even, so their transforms are cosine sums.
+    Ramp_Plan.filter.assign(Ramp_Plan.bins, 0.0);
+    const double a = fan_spacing;
+    for(size_t k = 0; k < Ramp_Plan.bins; ++k){
+        double H = (a > 0.0) ? 1.0/(8.0*a) : 0.25;
+        for(size_t m = 1; m < padded/2; m += 2){
+            const double h = (a > 0.0) ? -a/(2.0*pow(M_PI*sin(static_cast<double>(m)*a), 2.0))
+                                       : -1.0/(M_PI*M_PI*static_cast<double>(m*m));
+            H += 2.0*h*cos(2.0*M_PI*static_cast<double>(k*m)/static_cast<double>(padded));
+        }
+
+        //Roll off the high frequencies (f = k/padded is in [0:0.5] cycles per cell).
+        const double f = static_cast<double>(k)/static_cast<double>(padded);
+        if(Filter_Window == Shepp_Logan){
+            if(k != 0) H *= sin(M_PI*f)/(M_PI*f);
+        }else if(Filter_Window == Hann){
+            H *= 0.5*(1.0 + cos(2.0*M_PI*f));
+        }
+
+        Ramp_Plan.filter[k] = H/static_cast<double>(padded);
+    }
+    return;
+}
+
+//Ramp filter every orientation in-place. Orientations from a multi-row detector ([row][cell] layout, with cells
+// per row) have each row filtered separately.
+void Ramp_Filter(std::vector<Complete_Data> &data, size_t cells, double fan_spacing = 0.0){
+    const size_t det_rows = data.empty() ? 1 : (data[0].events.size()/cells);
+    Prepare_Ramp_Filter_Plan(cells, data.size()*det_rows, fan_spacing);
+    const size_t padded = Ramp_Plan.padded;
+    const size_t bins   = Ramp_Plan.bins;
+
+    for(size_t i=0; i<data.size(); ++i){
+        for(size_t r=0; r<det_rows; ++r){
+            double *row = Ramp_Plan.real + (i*det_rows + r)*padded;
+            std::copy(data[i].events.begin() + r*cells, data[i].events.begin() + (r+1)*cells, row);
+            std::fill(row + cells, row + padded, 0.0);
+        }
+    }
+
+    fftw_execute(Ramp_Plan.forward);
+
+    Ramp_Plan.sample.resize(bins);
+    Ramp_Plan.sample_filtered.resize(bins);
+    for(size_t k=0; k<bins; ++k){
+        Ramp_Plan.sample[k] = std::complex<double>(Ramp_Plan.spectrum[k][0], Ramp_Plan.spectrum[k][1]);
+    }
+
+    for(size_t i=0; i<Ramp_Plan.rows; ++i){
+        fftw_complex *row = Ramp_Plan.spectrum + i*bins;
+        for(size_t k=0; k<bins; ++k){
+            row[k][0] *= Ramp_Plan.filter[k];
+            row[k][1] *= Ramp_Plan.filter[k];
+        }
+    }
+
+    for(size_t k=0; k<bins; ++k){
+        Ramp_Plan.sample_filtered[k] = std::complex<double>(Ramp_Plan.spectrum[k][0], Ramp_Plan.spectrum[k][1]);
+    }
+
+    fftw_execute(Ramp_Plan.backward);   //NOTE: the c2r transform destroys the spectrum.
+
+    for(size_t i=0; i<data.size(); ++i){
+        for(size_t r=0; r<det_rows; ++r){
+            const double *row = Ramp_Plan.real + (i*det_rows + r)*padded;
+            std::copy(row, row + cells, data[i].events.begin() + r*cells);
+        }
+    }
+    return;
 }
 
-int to_pixel_coordinates_y(double y, double detector_width){
-    double tempy = y + 0.5*detector_width;
-    return (int)rint(tempy/1.0);
+//Pixel-driven backprojection. Each output pixel gathers the (linearly interpolated) filtered projection at
+// every orientation, so there are no holes or duplicate hits to mask out like there are when ray-casting
+// from the detector cells.
+//
+//The detector is centered on the rotation axis. Cell c (of unit width) sits at s = c + 0.5 - cells/2 along the
+// direction (-sin(theta), cos(theta)). The image is image_size x image_size pixels of width pixel_size (in
+// units of detector cells), centered on the rotation axis, and is stored row-major: image[j*image_size + i]
+// for x-index i and y-index j.
+void Backproject(const std::vector<Complete_Data> &data, size_t cells, size_t image_size, double pixel_size,
+                 std::vector<double> &image){
+
+    //Pack the rows with a guard cell of zeros on the left and two on the right so the interpolation below can
+    // clamp instead of branch.
+    const size_t stride = cells + 3;
+    std::vector<double> rows(stride*data.size(), 0.0);
+    std::vector<double> cosines(data.size()), sines(data.size());
+    for(size_t k=0; k<data.size(); ++k){
+        std::copy(data[k].events.begin(), data[k].events.end(), rows.begin() + k*stride + 1);
+        cosines[k] = cos(data[k].theta);
+        sines[k]   = sin(data[k].theta);
+    }
+
+    //Both full (2*pi) and half (pi) scans of N uniformly-spaced orientations are weighted by pi/N.
+    const double weight = M_PI/static_cast<double>(data.size());
+    const double half   = 0.5*static_cast<double>(image_size);
+    const double umax   = static_cast<double>(cells) + 1.0;
+
+    image.assign(image_size*image_size, 0.0);
+
+    //Tiles of image rows are handed out to the worker threads.
+    Run_In_Parallel(image_size, 8, [&](size_t j_begin, size_t j_end) -> void {
+        for(size_t j = j_begin; j < j_end; ++j){
+            double *out = &image[j*image_size];
+            const double y = (static_cast<double>(j) + 0.5 - half)*pixel_size;
+
+            for(size_t k=0; k<data.size(); ++k){
+                const double *q = &rows[k*stride];
+
+                //Fractional (guard-shifted) detector index along this image row: u(i) = u0 + i*du.
+                const double du = -sines[k]*pixel_size;
+                const double u0 = (0.5 - half)*du + y*cosines[k] + 0.5*static_cast<double>(cells) + 0.5;
+
+                for(size_t i=0; i<image_size; ++i){
+                    const double u = std::min(std::max(u0 + static_cast<double>(i)*du, 0.0), umax);
+                    const size_t i0 = static_cast<size_t>(u);
+                    const double w  = u - static_cast<double>(i0);
+                    out[i] += q[i0] + w*(q[i0+1] - q[i0]);
+                }
+            }
+
+            for(size_t i=0; i<image_size; ++i) out[i] *= weight;
+        }
+        return;
+    });
+    return;
+}
+
+//---------------------------------------------------------------------------------------------------
+//-------------------------------------- Fan- and Cone-beam FBP -------------------------------------
+//---------------------------------------------------------------------------------------------------
+//A point source and a detector opposite it, which is what Geometry_CT_Imager.cc simulates. The object (rather than
+// the imager) is rotated by the gantry angle b, so in the object's frame the source sits at -D*(sin(b), cos(b)) and
+// a ray at fan angle g travels along (sin(b+g), cos(b+g)). Image x and y are the object's x and z, and the rotation
+// axis (the object's y) is the cone-beam slice axis.
+//
+//The detector cells are modelled as in Geometry_CT_Imager.cc: equal widths along an arc of the given radius centred on
+// the rotation axis. These are not equiangular as seen from the source, so each row is first resampled onto an
+// equiangular grid. Then the direct (equiangular) fan-beam weighting is applied: the data is pre-weighted by D*cos(g),
+// filtered with the fan-beam kernel, and backprojected with a 1/L^2 weight (L = in-plane distance from the source).
+// This needs a full (2*pi) scan.
+//
+//The cone-beam (Feldkamp, FDK) path additionally pre-weights each detector row by the cosine of its cone angle and
+// backprojects along the tilted rays into a stack of slices. The detector rows are treated as lying on a cylinder
+// centred on the source at the central-ray detector distance (D + detector radius). With a single detector row this
+// reduces exactly to the fan-beam reconstruction of the central slice.
+//
+//Lengths are in cm. The defaults match Geometry_CT_Imager.cc.
+enum Beam_Geometry { Parallel, Fan, Cone };
+Beam_Geometry Geometry_Type = Parallel;
+
+double Source_Distance     = 14.0;  //Source to rotation axis.
+double Detector_Radius     = 14.0;  //Radius of the detector arc, about the rotation axis.
+double Detector_Arc        = 7.5;   //Arc length spanned by the detector cells.
+size_t Detector_Rows       = 1;     //Rows along the rotation axis. Each orientation's events are laid out [row][cell].
+double Detector_Row_Height = 0.5;   //Height of each row, at the detector.
+
+//Fan angle of the centre of a detector cell, as seen from the source. Increasing cell numbers have decreasing fan angles.
+double Cell_Fan_Angle(size_t cell, size_t cells){
+    const double psi = (Detector_Arc/Detector_Radius)*((static_cast<double>(cell) + 0.5)/static_cast<double>(cells) - 0.5);
+    return atan2(-Detector_Radius*sin(psi), Detector_Radius*cos(psi) + Source_Distance);
+}
+
+//Resamples every detector row onto an equiangular grid of the same number of cells, ascending in fan angle, and applies
+// the D*cos(g)*cos(k) pre-weighting. Returns the first fan angle and the spacing.
+void Prepare_Fan_Data(std::vector<Complete_Data> &data, size_t cells, double &gamma0, double &dgamma){
+    std::vector<double> gammas(cells), values(cells);
+    for(size_t c=0; c<cells; ++c) gammas[c] = Cell_Fan_Angle(cells - 1 - c, cells);  //Ascending.
+    gamma0 = gammas.front();
+    dgamma = (gammas.back() - gammas.front())/static_cast<double>(std::max(static_cast<size_t>(1), cells - 1));
+
+    const size_t det_rows = data.empty() ? 1 : (data[0].events.size()/cells);
+    const double D_sd = Source_Distance + Detector_Radius;
+
+    Run_In_Parallel(data.size(), 8, [&](size_t k_begin, size_t k_end) -> void {
+        std::vector<double> row(cells);
+        for(size_t k = k_begin; k < k_end; ++k){
+            for(size_t r=0; r<det_rows; ++r){
+                const double zeta  = (static_cast<double>(r) + 0.5 - 0.5*static_cast<double>(det_rows))*Detector_Row_Height;
+                const double cos_k = D_sd/sqrt(D_sd*D_sd + zeta*zeta);
+                double *events = &data[k].events[r*cells];
+                for(size_t c=0; c<cells; ++c) row[c] = events[cells - 1 - c];
+
+                size_t n = 0;
+                for(size_t u=0; u<cells; ++u){
+                    const double g = gamma0 + static_cast<double>(u)*dgamma;
+                    while((n + 2 < cells) && (gammas[n+1] < g)) ++n;
+                    const double w = std::min(1.0, std::max(0.0, (g - gammas[n])/(gammas[n+1] - gammas[n])));
+                    events[u] = (row[n] + w*(row[n+1] - row[n])) * Source_Distance*cos(g)*cos_k;
+                }
+            }
+        }
+        return;
+    });
+    return;
+}
+
+//Backprojects filtered, equiangular data into a stack of slices (each image_size x image_size, pixels of width pixel_size,
+// with the slices pixel_size apart and centred on the central plane). The volume is stored [slice][y][x] with x fastest.
+void Backproject_Cone(const std::vector<Complete_Data> &data, size_t cells, double gamma0, double dgamma,
+                      size_t image_size, double pixel_size, size_t slices, std::vector<double> &volume){
+    const size_t det_rows = data.empty() ? 1 : (data[0].events.size()/cells);
+    const double D_sd = Source_Distance + Detector_Radius;
+
+    //Pack each orientation with a guard row/column of zeros before and two after so the interpolation can clamp instead
+    // of branch.
+    const size_t stride = cells + 3;
+    const size_t plane  = stride*(det_rows + 3);
+    std::vector<double> packed(plane*data.size(), 0.0);
+    std::vector<double> cosines(data.size()), sines(data.size());
+    for(size_t k=0; k<data.size(); ++k){
+        for(size_t r=0; r<det_rows; ++r){
+            std::copy(data[k].events.begin() + r*cells, data[k].events.begin() + (r+1)*cells,
+                      packed.begin() + k*plane + (r+1)*stride + 1);
+        }
+        cosines[k] = cos(data[k].theta);
+        sines[k]   = sin(data[k].theta);
+    }
+
+    const double weight = 2.0*M_PI/static_cast<double>(data.size());
+    const double half   = 0.5*static_cast<double>(image_size);
+    const double umax   = static_cast<double>(cells) + 1.0;
+    const double vmax   = static_cast<double>(det_rows) + 1.0;
+
+    volume.assign(slices*image_size*image_size, 0.0);
+
+    //Work is handed out as (slice, image row) pairs.
+    Run_In_Parallel(slices*image_size, 4, [&](size_t n_begin, size_t n_end) -> void {
+        for(size_t n = n_begin; n < n_end; ++n){
+            const size_t slice = n/image_size;
+            const size_t j     = n % image_size;
+            double *out = &volume[n*image_size];
+            const double y = (static_cast<double>(j) + 0.5 - half)*pixel_size;
+            const double z = (static_cast<double>(slice) + 0.5 - 0.5*static_cast<double>(slices))*pixel_size;
+
+            for(size_t k=0; k<data.size(); ++k){
+                const double *q = &packed[k*plane];
+                const double sb = sines[k], cb = cosines[k];
+
+                for(size_t i=0; i<image_size; ++i){
+                    const double x = (static_cast<double>(i) + 0.5 - half)*pixel_size;
+                    const double U = x*sb + y*cb + Source_Distance;  //Along the central ray.
+                    const double T = x*cb - y*sb;                    //Across it.
+                    const double L2 = U*U + T*T;
+
+                    const double u = std::min(std::max((atan2(T, U) - gamma0)/dgamma + 1.0, 0.0), umax);
+                    const double v = std::min(std::max(z*D_sd/(sqrt(L2)*Detector_Row_Height)
+                                                       + 0.5*static_cast<double>(det_rows) + 0.5, 0.0), vmax);
+                    const size_t u0 = static_cast<size_t>(u), v0 = static_cast<size_t>(v);
+                    const double wu = u - static_cast<double>(u0), wv = v - static_cast<double>(v0);
+                    const double *q0 = q + v0*stride + u0;
+                    const double *q1 = q0 + stride;
+                    const double lower = q0[0] + wu*(q0[1] - q0[0]);
+                    const double upper = q1[0] + wu*(q1[1] - q1[0]);
+                    out[i] += (lower + wv*(upper - lower))/L2;
+                }
+            }
+
+            for(size_t i=0; i<image_size; ++i) out[i] *= weight;
+        }
+        return;
+    });
+    return;
+}
+
+//Writes a reconstructed volume as a raw NRRD file. The x index varies fastest.
+bool Write_Volume(const std::string &filename, size_t image_size, size_t slices, double pixel_size,
+                  const std::vector<double> &volume){
+    const unsigned short int endian_probe = 1;
+    const bool little_endian = (*reinterpret_cast<const unsigned char *>(&endian_probe) == 1);
+
+    std::ofstream FO(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!FO.good()){
+        std::cout << "Unable to open volume output file '" << filename << "'" << std::endl;
+        return false;
+    }
+    FO << "NRRD0004\n";
+    FO << "# Written by " << __FILE__ << ". Values are linear attenuation coefficients (per cm.)\n";
+    FO << "content: reconstructed volume\n";
+    FO << "type: double\n";
+    FO << "dimension: 3\n";
+    FO << "sizes: " << image_size << " " << image_size << " " << slices << "\n";
+    FO << "spacings: " << pixel_size << " " << pixel_size << " " << pixel_size << "\n";
+    FO << "centers: cell cell cell\n";
+    FO << "labels: \"x\" \"z\" \"y\"\n";
+    FO << "units: \"cm\" \"cm\" \"cm\"\n";
+    FO << "endian: " << (little_endian ? "little" : "big") << "\n";
+    FO << "encoding: raw\n";
+    FO << "\n";
+    FO.write(reinterpret_cast<const char *>(volume.data()), volume.size()*sizeof(double));
+    return FO.good();
+}
+
+
+//---------------------------------------------------------------------------------------------------
+//------------------------------------ Iterative Reconstruction -------------------------------------
+//---------------------------------------------------------------------------------------------------
+//Iterative reconstruction copes with low photon counts much better than FBP. It needs no ramp filter.
+// Instead, the system matrix (the intersection length of each detector cell's ray with each image pixel)
+// is computed once and stored in compressed sparse row (CSR) form. The forward projection runs in parallel
+// over rays. The backprojection uses a transposed copy for each ordered subset, so it runs in parallel
+// over pixels without any locking.
+//
+// - SART updates additively and is fine with noisy or slightly negative line integrals.
+// - OSEM (ordered-subsets expectation maximization) updates multiplicatively. It keeps the image
+//   non-negative, but negative line integrals are clamped to zero.
+enum Reconstruction_Method { FBP, SART, OSEM };
+Reconstruction_Method Method = FBP;
+size_t Iterations = 10;     //Passes over all subsets.
+size_t Subsets    = 12;     //Orientations are interleaved into this many ordered subsets.
+double Relaxation = 0.7;    //SART update damping. In (0:2).
+
+struct Sparse_Matrix {      //Compressed sparse row (CSR) storage.
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t>   row_start;    //rows+1 offsets into column/value.
+    std::vector<uint32_t> column;
+    std::vector<float>    value;
+};
+
+//Exact (Siddon-style) intersection lengths of the ray p + t*d (|d| = 1) with the pixels of a centered
+// image_size x image_size grid. The crossings buffer is scratch space so that it can be reused.
+void Trace_Ray(double px, double py, double dx, double dy, size_t image_size, double pixel_size,
+               std::vector<double> &crossings, std::vector<std::pair<uint32_t,float>> &out){
+    out.clear();
+    const double lo = -0.5*static_cast<double>(image_size)*pixel_size;
+    const double hi = -lo;
+
+    //Clip the ray to the grid bounding box.
+    double tmin = -1E99, tmax = 1E99;
+    const double p[2] = { px, py }, d[2] = { dx, dy };
+    for(size_t n=0; n<2; ++n){
+        if(fabs(d[n]) < 1E-12){
+            if((p[n] <= lo) || (p[n] >= hi)) return;
+        }else{
+            double t1 = (lo - p[n])/d[n], t2 = (hi - p[n])/d[n];
+            if(t1 > t2) std::swap(t1, t2);
+            tmin = std::max(tmin, t1);
+            tmax = std::min(tmax, t2);
+        }
+    }
+    if(tmax <= tmin) return;
+
+    //Collect every pixel boundary crossing between entry and exit. Each interval between consecutive crossings
+    // lies within a single pixel.
+    crossings.clear();
+    crossings.push_back(tmin);
+    crossings.push_back(tmax);
+    for(size_t n=1; n<image_size; ++n){
+        const double plane = lo + static_cast<double>(n)*pixel_size;
+        for(size_t m=0; m<2; ++m){
+            if(fabs(d[m]) < 1E-12) continue;
+            const double t = (plane - p[m])/d[m];
+            if((t > tmin) && (t < tmax)) crossings.push_back(t);
+        }
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    for(size_t n=1; n<crossings.size(); ++n){
+        const double length = crossings[n] - crossings[n-1];
+        if(length <= 1E-9*pixel_size) continue;
+        const double mid = 0.5*(crossings[n] + crossings[n-1]);
+        const size_t i = std::min(image_size - 1, static_cast<size_t>(std::max(0.0, (px + mid*dx - lo)/pixel_size)));
+        const size_t j = std::min(image_size - 1, static_cast<size_t>(std::max(0.0, (py + mid*dy - lo)/pixel_size)));
+        out.push_back(std::make_pair(static_cast<uint32_t>(j*image_size + i), static_cast<float>(length)));
+    }
+    return;
+}
+
+//One row per (orientation, detector cell) pair, ordered as k*cells + c. The detector geometry matches Backproject().
+void Build_System_Matrix(const std::vector<Complete_Data> &data, size_t cells, size_t image_size, double pixel_size,
+                         Sparse_Matrix &A){
+    //Each orientation is traced independently, and the pieces are stitched together afterward.
+    std::vector<Sparse_Matrix> views(data.size());
+    Run_In_Parallel(data.size(), 1, [&](size_t k_begin, size_t k_end) -> void {
+        std::vector<double> crossings;
+        std::vector<std::pair<uint32_t,float>> hits;
+        for(size_t k = k_begin; k < k_end; ++k){
+            Sparse_Matrix &V = views[k];
+            const double c = cos(data[k].theta), s = sin(data[k].theta);
+            V.row_start.push_back(0);
+            for(size_t cell=0; cell<cells; ++cell){
+                const double u = static_cast<double>(cell) + 0.5 - 0.5*static_cast<double>(cells);
+                Trace_Ray(-u*s, u*c, c, s, image_size, pixel_size, crossings, hits);
+                for(auto &h : hits){
+                    V.column.push_back(h.first);
+                    V.value.push_back(h.second);
+                }
+                V.row_start.push_back(V.column.size());
+            }
+        }
+        return;
+    });
+
+    A.rows = data.size()*cells;
+    A.cols = image_size*image_size;
+    A.row_start.assign(1, 0);
+    A.column.clear();
+    A.value.clear();
+    for(auto &V : views){
+        const size_t offset = A.column.size();
+        for(size_t r=1; r<V.row_start.size(); ++r) A.row_start.push_back(offset + V.row_start[r]);
+        A.column.insert(A.column.end(), V.column.begin(), V.column.end());
+        A.value.insert(A.value.end(), V.value.begin(), V.value.end());
+    }
+    return;
+}
+
+//Transpose the given subset of rows of A. The rows of T are pixels. The columns of T are the original row numbers.
+void Transpose_Rows(const Sparse_Matrix &A, const std::vector<size_t> &rows, Sparse_Matrix &T){
+    T.rows = A.cols;
+    T.cols = A.rows;
+    T.row_start.assign(T.rows + 1, 0);
+    for(size_t r : rows){
+        for(size_t n = A.row_start[r]; n < A.row_start[r+1]; ++n) ++T.row_start[A.column[n] + 1];
+    }
+    for(size_t j=0; j<T.rows; ++j) T.row_start[j+1] += T.row_start[j];
+
+    T.column.resize(T.row_start.back());
+    T.value.resize(T.row_start.back());
+    std::vector<size_t> fill(T.row_start.begin(), T.row_start.end() - 1);
+    for(size_t r : rows){
+        for(size_t n = A.row_start[r]; n < A.row_start[r+1]; ++n){
+            const size_t at = fill[A.column[n]]++;
+            T.column[at] = static_cast<uint32_t>(r);
+            T.value[at]  = A.value[n];
+        }
+    }
+    return;
+}
+
+//Reconstruct from the (log-normalized, unfiltered) line integrals.
+void Iterative_Reconstruction(const std::vector<Complete_Data> &data, size_t cells, size_t image_size,
+                              double pixel_size, std::vector<double> &image){
+    Sparse_Matrix A;
+    Build_System_Matrix(data, cells, image_size, pixel_size, A);
+
+    std::vector<double> measured(A.rows);
+    for(size_t k=0; k<data.size(); ++k){
+        for(size_t c=0; c<cells; ++c){
+            const double p = data[k].events[c];
+            measured[k*cells + c] = ((Method == OSEM) && (p < 0.0)) ? 0.0 : p;
+        }
+    }
+
+    //Row sums are the ray lengths through the image, used for SART normalization.
+    std::vector<double> ray_length(A.rows, 0.0);
+    for(size_t r=0; r<A.rows; ++r){
+        for(size_t n = A.row_start[r]; n < A.row_start[r+1]; ++n) ray_length[r] += A.value[n];
+    }
+
+    //Subset s holds orientations s, s + Subsets, s + 2*Subsets, ... . Each subset has its own transposed
+    // matrix and per-pixel sensitivity (column sums).
+    const size_t numb_of_subsets = std::max(static_cast<size_t>(1), std::min(Subsets, data.size()));
+    std::vector<std::vector<size_t>> subset_rows(numb_of_subsets);
+    for(size_t k=0; k<data.size(); ++k){
+        for(size_t c=0; c<cells; ++c) subset_rows[k % numb_of_subsets].push_back(k*cells + c);
+    }
+    std::vector<Sparse_Matrix> subset_transpose(numb_of_subsets);
+    std::vector<std::vector<double>> sensitivity(numb_of_subsets);
+    Run_In_Parallel(numb_of_subsets, 1, [&](size_t s_begin, size_t s_end) -> void {
+        for(size_t s = s_begin; s < s_end; ++s){
+            Transpose_Rows(A, subset_rows[s], subset_transpose[s]);
+            const Sparse_Matrix &T = subset_transpose[s];
+            sensitivity[s].assign(T.rows, 0.0);
+            for(size_t j=0; j<T.rows; ++j){
+                for(size_t n = T.row_start[j]; n < T.row_start[j+1]; ++n) sensitivity[s][j] += T.value[n];
+            }
+        }
+        return;
+    });
+
+    //OSEM needs a strictly positive starting image.
+    image.assign(A.cols, (Method == OSEM) ? 1.0 : 0.0);
+    std::vector<double> ratio(A.rows, 0.0);
+
+    std::cout << "Running iteration ";
+    for(size_t iteration = 0; iteration < Iterations; ++iteration){
+        std::cout << iteration << " ";
+        std::cout.flush();
+
+        for(size_t s=0; s<numb_of_subsets; ++s){
+            const std::vector<size_t> &rows = subset_rows[s];
+
+            //Forward project the current image along the subset's rays and compare with the measurement.
+            Run_In_Parallel(rows.size(), 256, [&](size_t n_begin, size_t n_end) -> void {
+                for(size_t m = n_begin; m < n_end; ++m){
+                    const size_t r = rows[m];
+                    double projection = 0.0;
+                    for(size_t n = A.row_start[r]; n < A.row_start[r+1]; ++n) projection += A.value[n]*image[A.column[n]];
+
+                    if(Method == OSEM){
+                        ratio[r] = (projection > 0.0) ? measured[r]/projection : 0.0;
+                    }else{
+                        ratio[r] = (ray_length[r] > 0.0) ? (measured[r] - projection)/ray_length[r] : 0.0;
+                    }
+                }
+                return;
+            });
+
+            //Backproject the corrections.
+            const Sparse_Matrix &T = subset_transpose[s];
+            Run_In_Parallel(T.rows, 256, [&](size_t j_begin, size_t j_end) -> void {
+                for(size_t j = j_begin; j < j_end; ++j){
+                    if(sensitivity[s][j] <= 0.0) continue;
+                    double correction = 0.0;
+                    for(size_t n = T.row_start[j]; n < T.row_start[j+1]; ++n) correction += T.value[n]*ratio[T.column[n]];
+                    correction /= sensitivity[s][j];
+
+                    if(Method == OSEM){
+                        image[j] *= correction;
+                    }else{
+                        image[j] = std::max(0.0, image[j] + Relaxation*correction);
+                    }
+                }
+                return;
+            });
+        }
+    }
+    std::cout << std::endl;
+    return;
 }
 
 
 int main(int argc, char **argv){
 
-    //Set up FFTW stuff.
-    fft_in_forward = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * 512);
-    fft_out_forward = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * 512);
-    fft_plan_forward = fftw_plan_dft_1d(512, fft_in_forward, fft_out_forward, FFTW_FORWARD, FFTW_ESTIMATE);
+    std::string data_filename("/tmp/Transport_Detector.sinogram");
+    std::string baseline_filename;
+    std::string image_filename("/tmp/Transport_Image.jpg");
+    std::string volume_filename("/tmp/Transport_Volume.nrrd");
+    size_t image_size = 0;  //Pixels along each side of the image. 0 means 'match the detector.'
+    size_t numb_of_slices = 0; //Cone beam only. 0 means 'match the image size.'
 
-    fft_in_backward = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * 512);
-    fft_out_backward = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * 512);
-    fft_plan_backward = fftw_plan_dft_1d(512, fft_in_backward, fft_out_backward, FFTW_BACKWARD, FFTW_ESTIMATE);
+    //---------------------------------------------------------------------------------------------------
+    //------------------------------------------ Option parsing -----------------------------------------
+    //---------------------------------------------------------------------------------------------------
+    int next_options;
+    const char* const short_options    = "hd:b:o:n:m:i:s:Pg:D:R:A:r:H:z:O:";  //This is the list of short, single-letter options.
+                                                            //The : denotes a value passed in with the option.
+    //This is the list of long options. Columns:  Name, BOOL: takes_value?, NULL, Map to short options.
+    const struct option long_options[] = { { "help",          0, NULL, 'h' },
+                                           { "data",          1, NULL, 'd' },
+                                           { "baseline",      1, NULL, 'b' },
+                                           { "output",        1, NULL, 'o' },
+                                           { "image-size",    1, NULL, 'n' },
+                                           { "method",        1, NULL, 'm' },
+                                           { "iterations",    1, NULL, 'i' },
+                                           { "subsets",       1, NULL, 's' },
+                                           { "primaries",     0, NULL, 'P' },
+                                           { "geometry",      1, NULL, 'g' },
+                                           { "source-distance", 1, NULL, 'D' },
+                                           { "detector-radius", 1, NULL, 'R' },
+                                           { "detector-arc",  1, NULL, 'A' },
+                                           { "detector-rows", 1, NULL, 'r' },
+                                           { "row-height",    1, NULL, 'H' },
+                                           { "slices",        1, NULL, 'z' },
+                                           { "volume",        1, NULL, 'O' },
+                                           { NULL,            0, NULL, 0   }  };
+
+    do{
+        next_options = getopt_long(argc, argv, short_options, long_options, NULL);
+        switch(next_options){
+            case 'h':
+                std::cout << std::endl;
+                std::cout << "-- " << argv[0] << " Command line switches: " << std::endl;
+                std::cout << "----------------------------------------------------------------------------------------------------------" << std::endl;
+                std::cout << "   Short              Long                 Default          Description" << std::endl;
+                std::cout << "----------------------------------------------------------------------------------------------------------" << std::endl;
+                std::cout << "   -h                 --help                                Display this message and exit." << std::endl;
+                std::cout << "   -d < file >        --data               <see below>      Detector data. A binary sinogram or a (single-orientation)" << std::endl;
+                std::cout << "                                                            text detector log. Default: /tmp/Transport_Detector.sinogram" << std::endl;
+                std::cout << "   -b < file >        --baseline           <none>           Calibration (no phantom) detector data. Same formats. (Required.)" << std::endl;
+                std::cout << "   -o < file >        --output             <see below>      Reconstructed image. Default: /tmp/Transport_Image.jpg" << std::endl;
+                std::cout << "   -n < # >           --image-size         <detector>       Pixels along each side of the reconstructed image." << std::endl;
+                std::cout << "   -m < name >        --method             <fbp>            Reconstruction method: fbp, sart, or osem." << std::endl;
+                std::cout << "   -i < # >           --iterations         <10>             Iterations (sart and osem only)." << std::endl;
+                std::cout << "   -s < # >           --subsets            <12>             Ordered subsets (sart and osem only)." << std::endl;
+                std::cout << "   -P                 --primaries          <false>          Only use unscattered hits from binary sinograms." << std::endl;
+                std::cout << "   -g < name >        --geometry           <parallel>       Beam geometry: parallel, fan, or cone. Fan and cone need a" << std::endl;
+                std::cout << "                                                            full (360 degree) scan and are only reconstructed with fbp." << std::endl;
+                std::cout << "   -D < cm >          --source-distance    <14>             Source to rotation axis distance (fan and cone.)" << std::endl;
+                std::cout << "   -R < cm >          --detector-radius    <14>             Radius of the detector arc about the rotation axis." << std::endl;
+                std::cout << "   -A < cm >          --detector-arc       <7.5>            Arc length spanned by the detector cells." << std::endl;
+                std::cout << "   -r < # >           --detector-rows      <1>              Detector rows along the rotation axis (cone.)" << std::endl;
+                std::cout << "   -H < cm >          --row-height         <0.5>            Height of each detector row (cone.)" << std::endl;
+                std::cout << "   -z < # >           --slices             <image size>     Number of reconstructed slices (cone.)" << std::endl;
+                std::cout << "   -O < file >        --volume             <see below>      Reconstructed volume (cone.) Default: /tmp/Transport_Volume.nrrd" << std::endl;
+                std::cout << std::endl;
+                return 0;
+                break;
+
+            case 'd':
+                data_filename = optarg;
+                break;
+
+            case 'b':
+                baseline_filename = optarg;
+                break;
+
+            case 'o':
+                image_filename = optarg;
+                break;
+
+            case 'n':
+                image_size = stringtoX<size_t>( optarg );
+                break;
+
+            case 'm':
+                {
+                const std::string temp = optarg;
+                if(temp == "fbp"){        Method = FBP;
+                }else if(temp == "sart"){ Method = SART;
+                }else if(temp == "osem"){ Method = OSEM;
+                }else{
+                    std::cout << "Unrecognized reconstruction method '" << temp << "'. Run with -h to see options." << std::endl;
+                    return -1;
+                }
+                }
+                break;
+
+            case 'i':
+                Iterations = stringtoX<size_t>( optarg );
+                break;
+
+            case 's':
+                Subsets = stringtoX<size_t>( optarg );
+                break;
+
+            case 'P':
+                Primaries_Only = true;
+                break;
+
+            case 'g':
+                {
+                const std::string temp = optarg;
+                if(temp == "parallel"){   Geometry_Type = Parallel;
+                }else if(temp == "fan"){  Geometry_Type = Fan;
+                }else if(temp == "cone"){ Geometry_Type = Cone;
+                }else{
+                    std::cout << "Unrecognized beam geometry '" << temp << "'. Run with -h to see options." << std::endl;
+                    return -1;
+                }
+                }
+                break;
+
+            case 'D':
+                Source_Distance = stringtoX<double>( optarg );
+                break;
+
+            case 'R':
+                Detector_Radius = stringtoX<double>( optarg );
+                break;
+
+            case 'A':
+                Detector_Arc = stringtoX<double>( optarg );
+                break;
+
+            case 'r':
+                Detector_Rows = stringtoX<size_t>( optarg );
+                break;
+
+            case 'H':
+                Detector_Row_Height = stringtoX<double>( optarg );
+                break;
+
+            case 'z':
+                numb_of_slices = stringtoX<size_t>( optarg );
+                break;
 
+            case 'O':
+                volume_filename = optarg;
+                break;
+
+            case '?':
+                return -1;
+                break;
+        }
+    }while(next_options != -1);
+
+    if(optind < argc){
+        std::cout << "Received an option without an argument: \"" << argv[optind] << "\". Run with -h to see help." << std::endl;
+        return -1;
+    }
+    if((Geometry_Type != Parallel) && (Method != FBP)){
+        std::cout << "Iterative reconstruction is only implemented for parallel beams. Use -m fbp with fan or cone beams." << std::endl;
+        return -1;
+    }
+    if((Detector_Rows == 0) || ((Detector_Rows != 1) && (Geometry_Type != Cone))){
+        std::cout << "Multiple detector rows are only supported for cone beam geometry." << std::endl;
+        return -1;
+    }
+    if(baseline_filename.empty()){
+        std::cout << "No baseline (calibration) detector data was provided. Run with -h to see help." << std::endl;
+        return -1;
+    }
 
     //The 'experimental data' is collected into a vector of measurements at a fixed orientation. Each fixed orientation is 
     // called a 'Complete_Data' set. 
@@ -159,28 +1018,44 @@ int main(int argc, char **argv){
     //---------------------------------------------------------------------------------------------------
     //---------------------------------------- Data Gathering -------------------------------------------
     //---------------------------------------------------------------------------------------------------
-    //First, read in the baseline (calibration) signal. We use this to subtract off the signal we see.
+    //First, read in the baseline (calibration) signal. We use this to subtract off the signal we see. A baseline
+    // sinogram (i.e., a simulation without the phantom) may have several rows. They are averaged.
     struct Complete_Data baseline;
-//    baseline.events = Load_Detector_File("/home/hal/Dropbox/Project - Transport/Calibrations/Detector_Xray_CT_N7599x10_baseline_500000_photons.plot");
-    baseline.events = Load_Detector_File("/home/hal/Dropbox/Project - Transport/Calibrations/Detector_Xray_CT_N7599x2.5_baseline_5000000_photons.plot");
-    baseline.theta  = 0.0;
+    baseline.theta = 0.0;
+    if(Is_Sinogram_File(baseline_filename)){
+        std::vector<Complete_Data> rows = Load_Sinogram_File(baseline_filename);
+        if(!rows.empty()){
+            baseline.events.assign(rows[0].events.size(), 0.0);
+            for(auto &row : rows){
+                if(row.events.size() != baseline.events.size()) continue;
+                for(size_t j=0; j<row.events.size(); ++j) baseline.events[j] += row.events[j]/static_cast<double>(rows.size());
+            }
+        }
+    }else{
+        baseline.events = Load_Detector_File(baseline_filename);
+    }
 
     //Now read in the data. Pack it into a struct with the corresponding angle.
-    {
+    if(Is_Sinogram_File(data_filename)){
+        data = Load_Sinogram_File(data_filename);
+    }else{
       struct Complete_Data temp;
-      temp.events = Load_Detector_File("/tmp/Transport_Detector.plot");
+      temp.events = Load_Detector_File(data_filename);
       temp.theta  = 0.0;
 
       data.push_back(temp);      
     }
 
-    //A simple hack, to get better performance, for spherically-symmetric objects.
-    for(double t = 2.0; t <= 360.0; t += 2.0){
-      struct Complete_Data temp;
-      temp.events = data[0].events;
-      temp.theta  = t*2.0*M_PI/360.0;
+    //A simple hack, to get better performance, for spherically-symmetric objects. Only used when a single orientation
+    // (e.g., an old-style text detector log) was provided.
+    if(data.size() == 1){
+      for(double t = 2.0; t <= 360.0; t += 2.0){
+        struct Complete_Data temp;
+        temp.events = data[0].events;
+        temp.theta  = t*2.0*M_PI/360.0;
 
-      data.push_back(temp);
+        data.push_back(temp);
+      }
     }
 
 /*
@@ -216,6 +1091,10 @@ int main(int argc, char **argv){
     }
     size_t detector_cell_count = 0;  //The number of individual detector cells in a complete detector.
     detector_cell_count = baseline.events.size();
+    if((detector_cell_count == 0) || (detector_cell_count % Detector_Rows != 0)){
+        std::cout << "The detector has " << detector_cell_count << " cells, which cannot be split into " << Detector_Rows << " rows." << std::endl;
+        return -1;
+    }
     for(size_t i=0; i<data.size(); ++i){
         if(data[i].events.size() != detector_cell_count){
             std::cout << "Attempting to mix data from detectors of varying size. Are you sure this is from the same simulation?" << std::endl;
@@ -304,224 +1183,65 @@ int main(int argc, char **argv){
 
 
 
-    //Go to Fourier-space, apply a ramp filter, transform back, swap the data.
-    for(size_t i=0; i<data.size(); ++i){
-        //Fill the forward FFTW input array.
-        for(size_t j=0; j<detector_cell_count; ++j){
-            fft_in_forward[j][0] = data[i].events[j];
-            fft_in_forward[j][1] = 0.0;
-        }
-
-        //Perform the FFT.
-        fftw_execute(fft_plan_forward);
-
-        //Grab the data. Filter it/transform as necessary and dump it into the reverse FFT input array.
-        for(size_t j=0; j<detector_cell_count; ++j){
-
-//------- This has been tested with the injected data and shown to work! -----------
-            //Ramp filter.
-            double f = (static_cast<double>(j)/static_cast<double>(detector_cell_count));  //Clamped frequency: [0:1]    ie.  |/|
-            f = (f <= 0.5) ? f : 1.0 - f ;   // make into |/\|
-            f *= 2.0;
-
-
-            //f = 1.0 - f; // make into |\|  or |\/|        <----- not needed!
-
-            double ramp_val;
-            //Basic.
-            ramp_val = f ;
-
-//-------------------------------------------------------------
-
-            //Sharp.
-//            ramp_val = f + 2.0*(f*f*f/6.0) + (f*f*f*f*f/120.0); 
-
-
-            //Smooth.
-//            ramp_val = f - 2.0*(f*f*f/6.0) + (f*f*f*f*f/120.0);
-
-            //Super-enhance. 
-//            ramp_val = powf(4.0*f, 2.0);
-
-            ramp_val = sqrt(2.0*f);
-
-            ramp_val = pow(f,0.3);
-
-
-            //This basically does not change anything in the final image.
-            //double ramp_val = fabs((static_cast<double>(j)-0.5*static_cast<double>(detector_cell_count))/static_cast<double>(detector_cell_count));
-
-            fft_in_backward[j][0] = ramp_val * fft_out_forward[j][0];
-            fft_in_backward[j][1] = ramp_val * fft_out_forward[j][1];
-        }
-        
-        //Perform the inverse FFT.
-        fftw_execute(fft_plan_backward);
-
-
-        //Take the output and stick it in the detector array.
-        for(size_t j=0; j<detector_cell_count; ++j){
-            data[i].events[j] = fft_out_backward[j][0];
-            //data[i].events[j] = fft_out_backward[j][1];   // <----- these complex values should be ~zero. Check? (Should they be??)
-        }
-
-    }
-
-
-
-    //Smooth out the data.
-   {
-    int NN = 2;  //Number of nearest neighbours to average over.
-    for(int i=0; i<data.size(); ++i){
-        std::vector<double> temp(detector_cell_count);
-        for(int j=0; j<detector_cell_count; ++j){
-            temp[j] = 0.0;
-            double count = 0.0;
-            for(int k = -NN; k <= NN; ++k){
-                if(((j+k) >= 0) && ((j+k)<detector_cell_count)){  
-                    count += 1.0;
-                    temp[j] += data[i].events[j+k];
-                }
-            }
-
-            //temp[j] /= count;
-            temp[j] /= static_cast<double>(NN);
-        }
-
-        //Now swap the vectors.
-        data[i].events = temp;
-    }
-   }
-
-
-
-    //---------------------------------------------------------------------------------------------------
-    //-------------------------------- Prepare the output containers ------------------------------------
-    //---------------------------------------------------------------------------------------------------
-    //Now make a 2d grid which is the same size as the detector.
-    std::vector<std::vector<double> > image;   //The actual image.
-    std::vector<std::vector<bool> >   mask;    //Used for avoiding duplicate accumulation in cells when raycasting.
-    for(size_t i=0; i<detector_cell_count; ++i){
-        std::vector<double> temp;
-        std::vector<bool>   temp2;
-        for(size_t j=0; j<detector_cell_count; ++j){
-            temp.push_back(0.0);
-            temp2.push_back(false);
-        }
-        image.push_back( temp );
-        mask.push_back( temp2 );
-    }
-
-
     //---------------------------------------------------------------------------------------------------
-    //---------------------------------------- Backprojection -------------------------------------------
+    //------------------------------------------ Reconstruction -----------------------------------------
     //---------------------------------------------------------------------------------------------------
-    //We treat the detector array as cells of unit width. Likewise, the image pixels are 1x1 units.
+    //In the parallel-beam case, we treat the detector array as cells of unit width. The image spans the width of the
+    // detector, so the pixels are (detector_cell_count/image_size) units wide.
     //
     //Assumptions made here:
     // - Detector points at center of image. The center of the detector array always intersects the
     //   image array at the center point, which is the point of rotation.
-    // - The detector is assumed to be a parallel beam setup. NO fan beam. NO cone beam.
-    // - The center of the detector is in contact with a circle enscribing the image data.
+    // - The detector is assumed to be a parallel beam setup, unless fan or cone beam geometry was requested.
     //
     // Under these assumptions, slices through the image data are defined by an angle and a distance 
     //  from the origin.
-
-    double detector_width = static_cast<double>(detector_cell_count);
-    double rmax = detector_width/sqrt(2);  // = sqrt( detector_width*detector_width + detector_height*detector_height);
-
-    std::cout << "Running for set ";
-    for(size_t k = 0; k < data.size(); ++k){
-   
-        std::cout <<  k <<  " ";
-        std::cout.flush();
- 
-        //These define the unit vector aligned with the detector array.
-        double unit_rot_x = cos( data[k].theta + M_PI/2.0 );
-        double unit_rot_y = sin( data[k].theta + M_PI/2.0 );
-    
-        //These define the unit vector along the rays from the detector cells.
-        double unit_trans_x = cos( data[k].theta );
-        double unit_trans_y = sin( data[k].theta );
-   
-        //Zero the 'did we ray cast into this voxel yet?' mask. 
-        for(size_t d1=0; d1<detector_cell_count; ++d1){
-            for(size_t d2=0; d2<detector_cell_count; ++d2){
-                mask[d1][d2] = false;
-            }
-        }
-
-        for(size_t which_cell = 0; which_cell < detector_cell_count; ++which_cell){
-        
-            //Set the coordinates at the detector cell.
-            double x = rmax*unit_trans_x; //Central cell.
-            double y = rmax*unit_trans_y; //Central cell.
-
-            //Mind the sign convention here! (Work it out in the first quadrant and you'll see where the negatives come from.
-            x += ( (detector_width/2.0) - static_cast<double>( which_cell ) - 0.5)*(-unit_rot_x); //The 0.5 is to be in the center of the cell.
-            y += (-(detector_width/2.0) + static_cast<double>( which_cell ) + 0.5)*unit_rot_y;    //The 0.5 is to be in the center of the cell.
-        
-            //Now, cast through the material by incrementing and dumping the image data.
-            for(double inc = 0.0; inc < 2.0*rmax; inc += 0.3*1.0){
-                //The proper dimension to cast toward is toward the origin from the cell point.    
-                double this_x = x;
-                double this_y = y;
-
-                this_x -= inc*unit_trans_x;
-                this_y -= inc*unit_trans_y;
-        
-                //This_x and this_y now need to be translated to image coordinates. Note that while x and y are in a full (four-quadrant) 
-                // 2d space, the pixel coordinates occupy a single quadrant and must be integer. We will therefore lose corners for most angles.
-                int i = to_pixel_coordinates_x(this_x, detector_width);
-                int j = to_pixel_coordinates_y(this_y, detector_width);
-            
-//                std::cout << "Got pixel coordinates " << i << " " << j << std::endl;
-            
-                if((i >= 0) && (j >= 0) && (i < detector_cell_count) && (j < detector_cell_count) && (mask[i][j] == false)){ //We will *definately* get nonsensical values for i and j!
-                    image[i][j] += data[k].events[ which_cell ];
-                    mask[i][j]  = true;
-                }
-        
-            }
-        }
-
-        //NOTE: checking the mask for missed cells would be largely useless. We are guaranteed to miss a loarge number of perhipheral pixels
- 
-    } //Loop over all orientations.
-
-    std::cout << std::endl;
-
-/*
-    //0 degree backprojection.
-    for(size_t i=0; i<detector_cell_count; ++i){ 
-        for(size_t j=0; j<detector_cell_count; ++j){
-            image[i][j] += data[0].events[j];
-        }
+    //
+    //In the fan- and cone-beam cases, lengths are in cm and the image spans the field of view (the circle every ray
+    // passes through.) See the notes above Cell_Fan_Angle().
+    const size_t cells_per_row = detector_cell_count/Detector_Rows;
+    if(image_size == 0) image_size = cells_per_row;
+    double pixel_size = static_cast<double>(detector_cell_count)/static_cast<double>(image_size);
+    if(Geometry_Type != Parallel){
+        const double fov_radius = Source_Distance*sin(fabs(Cell_Fan_Angle(0, cells_per_row)));
+        pixel_size = 2.0*fov_radius/static_cast<double>(image_size);
     }
 
-
-    //180 degree backprojection.
-    for(size_t i=0; i<detector_cell_count; ++i){
-        for(size_t j=0; j<detector_cell_count; ++j){
-            image[i][j] += data[0].events[detector_cell_count - (j+1)];
-        }
-    }
-  
-    //270 degree backprojection.
-    for(size_t i=0; i<detector_cell_count; ++i){
-        for(size_t j=0; j<detector_cell_count; ++j){
-            image[i][j] += data[0].events[detector_cell_count - (i+1)];
-        }
+    std::vector<double> flat_image;
+    const auto recon_start = std::chrono::steady_clock::now();
+    if(Geometry_Type != Parallel){
+        //Resample to equiangular, weight, filter with the fan-beam kernel, and backproject along the diverging rays.
+        double gamma0, dgamma;
+        Prepare_Fan_Data(data, cells_per_row, gamma0, dgamma);
+        Ramp_Filter(data, cells_per_row, dgamma);
+
+        const size_t slices = (Geometry_Type == Cone) ? std::max(static_cast<size_t>(1), numb_of_slices) : 1;
+        std::vector<double> volume;
+        Backproject_Cone(data, cells_per_row, gamma0, dgamma, image_size, pixel_size, slices, volume);
+        if(Geometry_Type == Cone) Write_Volume(volume_filename, image_size, slices, pixel_size, volume);
+
+        //The central slice goes through the usual 2D post-processing.
+        const size_t central = slices/2;
+        flat_image.assign(volume.begin() + central*image_size*image_size, volume.begin() + (central + 1)*image_size*image_size);
+    }else if(Method == FBP){
+        //Go to Fourier-space, apply a (windowed) ramp filter to every orientation, transform back, and backproject.
+        Ramp_Filter(data, detector_cell_count);
+        Backproject(data, detector_cell_count, image_size, pixel_size, flat_image);
+    }else{
+        Iterative_Reconstruction(data, detector_cell_count, image_size, pixel_size, flat_image);
     }
+    const auto recon_stop = std::chrono::steady_clock::now();
 
-    //90 degree backprojection.
-    for(size_t i=0; i<detector_cell_count; ++i){
-        for(size_t j=0; j<detector_cell_count; ++j){
-            image[i][j] += data[0].events[i];
+    std::cout << "Reconstructed " << data.size() << " orientations in "
+              << std::chrono::duration<double>(recon_stop - recon_start).count() << "s." << std::endl;
+
+    //Unpack into image[x][y] for the post-processing and output routines.
+    std::vector<std::vector<double> > image(image_size, std::vector<double>(image_size, 0.0));
+    for(size_t i=0; i<image_size; ++i){
+        for(size_t j=0; j<image_size; ++j){
+            image[i][j] = flat_image[j*image_size + i];
         }
     }
-*/
-
 
     //---------------------------------------------------------------------------------------------------
     //---------------------------------------- Post-processing ------------------------------------------
@@ -529,15 +1249,15 @@ int main(int argc, char **argv){
  
     //Find the highest pixel value. Scale the others to this value (clamp the values.)
     double highest = 0.0;
-    for(size_t i=0; i<detector_cell_count; ++i){
-        for(size_t j=0; j<detector_cell_count; ++j){
+    for(size_t i=0; i<image_size; ++i){
+        for(size_t j=0; j<image_size; ++j){
             if(image[i][j] > highest) highest = image[i][j];
         }
     }
 
     if(highest > 0.0){
-        for(size_t i=0; i<detector_cell_count; ++i){
-            for(size_t j=0; j<detector_cell_count; ++j){
+        for(size_t i=0; i<image_size; ++i){
+            for(size_t j=0; j<image_size; ++j){
                 image[i][j] /= highest;
             }
         }
@@ -546,8 +1266,8 @@ int main(int argc, char **argv){
 /*
     //Invert the intensity, as these things are normally done...
     if(highest > 0.0){
-        for(size_t i=0; i<detector_cell_count; ++i){
-            for(size_t j=0; j<detector_cell_count; ++j){
+        for(size_t i=0; i<image_size; ++i){
+            for(size_t j=0; j<image_size; ++j){
                 image[i][j] = 1.0 - image[i][j];
             }
         }
@@ -556,8 +1276,8 @@ int main(int argc, char **argv){
 
 /*
     //Print the data to screen.
-    for(size_t i=0; i<detector_cell_count; ++i){    
-        for(size_t j=0; j<detector_cell_count; ++j){
+    for(size_t i=0; i<image_size; ++i){    
+        for(size_t j=0; j<image_size; ++j){
             printf(" %lf", image[i][j]);
         }
         std::cout << std::endl;
@@ -567,8 +1287,8 @@ int main(int argc, char **argv){
 
 
     //Eliminate negatives in the image data by setting them to zero. Better method?
-    for(size_t i=0; i<detector_cell_count; ++i){
-        for(size_t j=0; j<detector_cell_count; ++j){
+    for(size_t i=0; i<image_size; ++i){
+        for(size_t j=0; j<image_size; ++j){
             if(image[i][j] < 0.0) image[i][j] = 0.0;
         }
     }
@@ -577,7 +1297,7 @@ int main(int argc, char **argv){
     //-------------------------------- Output image / Image processing ----------------------------------
     //---------------------------------------------------------------------------------------------------
     //Write an image to file.
-    Write_Image((int)(detector_cell_count), (int)(detector_cell_count), image, "notused right now");
+    Write_Image((int)(image_size), (int)(image_size), image, image_filename);
 
 
 
@@ -596,8 +1316,8 @@ int main(int argc, char **argv){
 
     Filep << "# Profiles along central axes. " << std::endl;
     Filep << "# pixel location   (vertical image axis)   (horizontal image axis) " << std::endl;
-    for(size_t i=0; i<detector_cell_count; ++i){
-        Filep << i << " " << image[i][detector_cell_count/2] << " " << image[detector_cell_count/2][i] << std::endl;
+    for(size_t i=0; i<image_size; ++i){
+        Filep << i << " " << image[i][image_size/2] << " " << image[image_size/2][i] << std::endl;
     }
     Filep.close();
 
@@ -627,8 +1347,8 @@ int main(int argc, char **argv){
 
     Filep << "# Fourier transform of normalized detector array signal. Possibly blurred, normalized, or anything. Examine the source for details. " << std::endl;
     Filep << "# cell number     intensity(real)  intensity(imag) " << std::endl;
-    for(size_t i=0; i<detector_cell_count; ++i){
-        Filep << i << " " << fft_out_forward[i][0] << " " << fft_out_forward[i][1] << std::endl;
+    for(size_t i=0; i<Ramp_Plan.sample.size(); ++i){
+        Filep << i << " " << Ramp_Plan.sample[i].real() << " " << Ramp_Plan.sample[i].imag() << std::endl;
     }
     Filep.close();
 
@@ -642,21 +1362,14 @@ int main(int argc, char **argv){
 
     Filep << "# Filtered Fourier transform of normalized detector array signal. Possibly blurred, normalized, or anything. Examine the source for details. " << std::endl;
     Filep << "# cell number     intensity(real)  intensity(imag) " << std::endl;
-    for(size_t i=0; i<detector_cell_count; ++i){
-        Filep << i << " " << fft_in_backward[i][0] << " " << fft_in_backward[i][1] << std::endl;
+    for(size_t i=0; i<Ramp_Plan.sample_filtered.size(); ++i){
+        Filep << i << " " << Ramp_Plan.sample_filtered[i].real() << " " << Ramp_Plan.sample_filtered[i].imag() << std::endl;
     }
     Filep.close();
 
    
     //Cleanup FFTW stuff.
-    fftw_destroy_plan(fft_plan_forward);
-    fftw_destroy_plan(fft_plan_backward);
-
-    fftw_free(fft_in_forward);
-    fftw_free(fft_out_forward);
-
-    fftw_free(fft_in_backward); 
-    fftw_free(fft_out_backward);
+    Destroy_Ramp_Filter_Plan();
 
     return 0;
 }
@@ -1,6 +1,7 @@
 #!/usr/bin/lua
 
---Bins and numerically integrates dose data over multiple energies to give a (binned) percent depth dose.
+--Bins and numerically integrates dose data over multiple energies to give a (binned) percent depth dose. Each line holds a
+-- distance, an energy, the integration term, and the photon's weight.
 
 --dofile("./Lua_Stack.lua")
 ----------------------------- A Stack data type. Condensed for portability... -------------------------
@@ -33,17 +34,19 @@ gnuplot       = true --Prints extra points to illustrate bin size, etc. Useful f
 
 ---------------------------------------------------------------------------------------------------------------------
 min_x = 1E99 ; max_x = -1E99 ;       min_y = 1E99 ; max_y = -1E99
-xs = Stack:Create() ; ys = Stack:Create() ; zs = Stack:Create()
+xs = Stack:Create() ; ys = Stack:Create() ; zs = Stack:Create() ; ws = Stack:Create()
 numb_of_points = 0
 
 io.input(file_input)
-local pattern = "%s*([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s+"
+local pattern = "%s*([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s+"
 
-for n1, n2, n3 in string.gfind(io.read("*all"), pattern) do
-    if n1 ~= nil and n2 ~= nil and n3 ~= nil and tonumber(n1) ~= nil and tonumber(n2) ~= nil and tonumber(n3) ~= nil then
+for n1, n2, n3, n4 in string.gfind(io.read("*all"), pattern) do
+    if n1 ~= nil and n2 ~= nil and n3 ~= nil and n4 ~= nil and tonumber(n1) ~= nil and tonumber(n2) ~= nil and tonumber(n3) ~= nil
+                                                            and tonumber(n4) ~= nil then
         n1 = tonumber(n1)
         n2 = tonumber(n2)   
         n3 = tonumber(n3)
+        n4 = tonumber(n4)
         if n1 > max_x then max_x = n1 end
         if n1 < min_x then min_x = n1 end
         if n2 > max_y then max_y = n2 end
@@ -52,6 +55,7 @@ for n1, n2, n3 in string.gfind(io.read("*all"), pattern) do
         xs:push(n1)
         ys:push(n2)
         zs:push(n3)
+        ws:push(n4)
         numb_of_points = numb_of_points + 1
     end
 end
@@ -97,13 +101,16 @@ while true do
     local z = zs:pop(1)   --Get the integration term. 
     if not z then break end
 
+    local w = ws:pop(1)   --Get the weight.
+    if not w then break end
+
     for i=0,(numb_of_x_bins-1) do
         if( (x >= (min_x + i*x_bin_spacing)) and (x < (min_x + (i+1)*x_bin_spacing))) then
 
             for j=0,(numb_of_y_bins-1) do
                 if( (y >= (min_y + j*y_bin_spacing)) and (y < (min_y + (j+1)*y_bin_spacing))) then
 
-                    output[i][j] = output[i][j] + z*y   --Sort the samples into their proper distance and energy bins.
+                    output[i][j] = output[i][j] + z*y*w --Sort the samples into their proper distance and energy bins.
                     count[i][j]  = count[i][j]  + 1     --Keeping the exact distance and energy is not worthwhile - that is 
                                                         -- what the bins are for. This is also our integration quantization!
                                                         --
@@ -1,6 +1,7 @@
 #!/usr/bin/lua
 
---Bins and normalizes the no-interaction distance (which gives Kerma) for 1MeV photons.
+--Bins and normalizes the no-interaction distance (which gives Kerma) for 1MeV photons. Each line holds a distance and the
+-- photon's weight, which is what gets tallied.
 
 --dofile("./Lua_Stack.lua")
 ----------------------------- A Stack data type. Condensed for portability... -------------------------
@@ -32,19 +33,21 @@ gnuplot       = true --Prints extra points to illustrate bin size, etc. Useful f
 
 ---------------------------------------------------------------------------------------------------------------------
 min_x = 1E99 ; max_x = -1E99 
-xs = Stack:Create()
+xs = Stack:Create() ; ws = Stack:Create()
 numb_of_points = 0
 
 io.input(file_input)
-local pattern = "%s*([%E%.%+%-%e%d]+)%s*"
+local pattern = "%s*([%E%.%+%-%e%d]+)%s+([%E%.%+%-%e%d]+)%s*"
 
-for n1 in string.gfind(io.read("*all"), pattern) do
-    if n1 ~= nil and tonumber(n1) ~= nil then
+for n1, n2 in string.gfind(io.read("*all"), pattern) do
+    if n1 ~= nil and n2 ~= nil and tonumber(n1) ~= nil and tonumber(n2) ~= nil then
         n1 = tonumber(n1)
+        n2 = tonumber(n2)
         if n1 > max_x then max_x = n1 end
         if n1 < min_x then min_x = n1 end
 
         xs:push(n1)
+        ws:push(n2)
         numb_of_points = numb_of_points + 1
     end
 end
@@ -74,9 +77,12 @@ while true do
     local x = xs:pop(1)
     if not x then break end
 
+    local w = ws:pop(1)
+    if not w then break end
+
     for i=0,(numb_of_bins-1) do
         if( (x >= (min_x + i*x_bin_spacing)) and (x < (min_x + (i+1)*x_bin_spacing))) then
-            output[i] = output[i] + 1
+            output[i] = output[i] + w
             break 
         end
     end 
@@ -34,6 +34,8 @@ std::string INTERACTION_TYPE("LOCALDUMP");
 
 bool VERBOSE = false;
 
+int Handle_Electron_Stopped = -1; //Logging channel. Resolved by resolve_logging_handles().
+
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
         //Do something automatic here.
@@ -58,6 +60,13 @@ void toggle_verbosity(bool in){
 
 
 
+//Called once all modules have been loaded. The channel is only opened if it will be used.
+void resolve_logging_handles(const struct Functions &Loaded_Functions){
+    if(LoggingQuantities::ElectronStoppingPos) Handle_Electron_Stopped = Loaded_Functions.logging_channel("Electron_Stopped");
+    return;
+}
+
+
 void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions){
     //Implements a simple energy dump event. Destroys particle afterward by expiring it.
     //
@@ -78,12 +87,12 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
         if(LoggingQuantities::ElectronStoppingPos){
             vec3<double> pos = A->get_position3();
-            Loaded_Functions.generic_logging("Electron_Stopped")  << pos.x << " " << pos.y << " " << pos.z << " " << sqrt(pos.x*pos.x+pos.y*pos.y+pos.z*pos.z) << " " << A->get_energy() << std::endl;
+            Loaded_Functions.logging_by_channel(Handle_Electron_Stopped) << pos.x << " " << pos.y << " " << pos.z << " " << sqrt(pos.x*pos.x+pos.y*pos.y+pos.z*pos.z) << " " << A->get_energy() << '\n';
         }
 
 
         if(USE_CSDA){ 
-            Loaded_Functions.voxel_localdump( (A->get_energy() - A->get_mass()), A->get_position3() , Loaded_Functions);
+            Loaded_Functions.voxel_localdump( (A->get_energy() - A->get_mass()), A->get_position3(), A->get_weight(), Loaded_Functions);
         }
 
     }
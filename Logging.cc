@@ -21,6 +21,16 @@
 #include <utility>  //std::pair
 #include <memory>   //std::unique_ptr
 #include <cmath>
+#include <cstring>  //std::memcpy
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <fcntl.h>   //open.
+#include <unistd.h>  //write, close.
 
 #include "./Misc.h"
 
@@ -41,6 +51,156 @@ bool DO_NOT_CLOBBER = false;
 std::map<std::string, std::pair<std::string, std::unique_ptr<std::fstream> > >   Log_File;  //Log file (1) key values, (2) filenames, (3) file descriptors.
 std::map<std::string, std::pair<std::string, std::unique_ptr<std::fstream> > >::iterator Log_File_Iter; //A convenience iterator.
 
+std::map<std::string, int>  Log_Channel_Handles; //Text channel key -> handle. Only consulted when resolving handles.
+std::vector<std::string>    Log_Channel_Keys;    //Handle -> key.
+std::vector<std::fstream *> Log_Channels;        //Handle -> stream (owned by Log_File.) Null until the first record is written.
+
+std::mutex                  Text_Thread_Mutex;   //Text records are streamed piecemeal by the caller, so they cannot be serialised
+std::thread::id             Text_Thread;         // here. Instead, only the first thread to write one is allowed to write any.
+thread_local bool           Text_Thread_Checked = false;
+
+int Handle_Interaction_Count = -1;               //Channels used within this module. Resolved by resolve_logging_handles().
+int Handle_Other             = -1;
+
+
+//----------------------------------------------------------------------------------------------------
+//---------------------------------------- Binary logging --------------------------------------------
+//----------------------------------------------------------------------------------------------------
+//Binary channels are registered up front (outside of the hot path) and are referred to by an integer handle afterward. Each
+// channel has a fixed record size. Records are copied into a per-thread, single-producer/single-consumer ring buffer and a
+// background thread drains the rings into large per-channel buffers which are written to file with a handful of large writes.
+//
+//Each channel produces a file "/tmp/Transport_<key>.bin" with a short ASCII header (terminated by a blank line) followed by
+// tightly-packed records in host byte order.
+
+struct binary_channel {
+    std::string key;
+    std::string filename;
+    size_t record_size;
+    int fd;
+    std::vector<char> buffer; //Pending output. Only touched by the writer thread (or at shutdown.)
+    long int records_written;
+};
+
+struct binary_ring {
+    std::vector<char> bytes;      //Size is a power of two.
+    size_t mask;
+    std::atomic<size_t> head;     //Total bytes ever written by the producer.
+    std::atomic<size_t> tail;     //Total bytes ever consumed by the writer.
+    binary_ring(size_t size) : bytes(size), mask(size - 1), head(0), tail(0) { }
+};
+
+const size_t BINARY_MAX_CHANNELS    = 256;
+const size_t BINARY_RING_SIZE       = (static_cast<size_t>(1) << 22); // 4 MiB per producing thread.
+const size_t BINARY_FLUSH_THRESHOLD = (static_cast<size_t>(1) << 23); // 8 MiB per channel before writing to file.
+
+std::vector<binary_channel>  Binary_Channels(BINARY_MAX_CHANNELS); //Pre-sized so the writer can read entries without locking.
+std::atomic<size_t>          Binary_Channel_Count(0);
+std::mutex                   Binary_Registry_Mutex;   //Guards channel registration and the list of rings.
+std::vector< std::unique_ptr<binary_ring> > Binary_Rings; //Owned here so they outlive the threads which write to them.
+
+std::thread                  Binary_Writer;
+std::atomic<bool>            Binary_Writer_Running(false);
+std::atomic<bool>            Binary_Writer_Stop(false);
+std::mutex                   Binary_Writer_Mutex;
+std::condition_variable      Binary_Writer_Wake;
+
+thread_local binary_ring    *This_Thread_Ring = nullptr;
+
+
+static void binary_flush_channel(binary_channel &chan){
+    size_t done = 0;
+    while(done < chan.buffer.size()){
+        const ssize_t n = write(chan.fd, chan.buffer.data() + done, chan.buffer.size() - done);
+        if(n <= 0) FUNCERR("Unable to write binary log file \"" << chan.filename << "\"");
+        done += static_cast<size_t>(n);
+    }
+    chan.buffer.clear();
+    return;
+}
+
+//Moves everything currently in a ring into the per-channel buffers. Returns the number of bytes consumed.
+static size_t binary_drain_ring(binary_ring &ring){
+    const size_t head = ring.head.load(std::memory_order_acquire);
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    const size_t consumed = head - tail;
+
+    while(tail != head){
+        //Each entry is a 4-byte channel handle followed by the channel's fixed-size record.
+        unsigned int handle;
+        for(size_t i = 0; i < sizeof(handle); ++i) reinterpret_cast<char *>(&handle)[i] = ring.bytes[(tail + i) & ring.mask];
+        tail += sizeof(handle);
+
+        binary_channel &chan = Binary_Channels[handle];
+        const size_t offset = chan.buffer.size();
+        chan.buffer.resize(offset + chan.record_size);
+        for(size_t i = 0; i < chan.record_size; ++i) chan.buffer[offset + i] = ring.bytes[(tail + i) & ring.mask];
+        tail += chan.record_size;
+        ++chan.records_written;
+
+        if(chan.buffer.size() >= BINARY_FLUSH_THRESHOLD) binary_flush_channel(chan);
+    }
+
+    ring.tail.store(tail, std::memory_order_release);
+    return consumed;
+}
+
+static void binary_drain_all(void){
+    std::vector<binary_ring *> rings;
+    {
+        std::lock_guard<std::mutex> lock(Binary_Registry_Mutex);
+        for(auto &r : Binary_Rings) rings.push_back(r.get());
+    }
+    size_t consumed;
+    do{
+        consumed = 0;
+        for(binary_ring *r : rings) consumed += binary_drain_ring(*r);
+    }while(consumed != 0);
+    return;
+}
+
+static void binary_writer_loop(void){
+    while(!Binary_Writer_Stop.load(std::memory_order_acquire)){
+        binary_drain_all();
+
+        //Nap until there is (probably) more work to do. Producers will poke us when their ring is filling up.
+        std::unique_lock<std::mutex> lock(Binary_Writer_Mutex);
+        Binary_Writer_Wake.wait_for(lock, std::chrono::milliseconds(20));
+    }
+    return;
+}
+
+//Stops the writer, drains whatever remains, and closes the binary channels. Safe to call more than once.
+static void binary_shutdown(void){
+    if(Binary_Writer_Running.load()){
+        Binary_Writer_Stop.store(true);
+        Binary_Writer_Wake.notify_all();
+        Binary_Writer.join();
+        Binary_Writer_Running.store(false);
+    }
+    binary_drain_all();
+    const size_t N = Binary_Channel_Count.exchange(0);
+    for(size_t i = 0; i < N; ++i){
+        binary_flush_channel(Binary_Channels[i]);
+        close(Binary_Channels[i].fd);
+        if(VERBOSE) FUNCINFO("Wrote " << Binary_Channels[i].records_written << " records to \"" << Binary_Channels[i].filename << "\"");
+    }
+    return;
+}
+
+//Global objects are destroyed *before* the __attribute__((destructor)) cleanup runs when the program exits normally, so the
+// writer thread, the binary buffers, and the text log files must be shut down from the destructor of an object defined after them.
+struct shutdown_guard {
+    ~shutdown_guard(){
+        binary_shutdown();
+
+        for(Log_File_Iter = Log_File.begin(); Log_File_Iter != Log_File.end(); Log_File_Iter++){
+            ((Log_File_Iter->second).second)->flush();
+            ((Log_File_Iter->second).second)->close();
+        }
+    }
+} Shutdown_Guard;
+
 /*
                     FO.open(FilenameOut.c_str(), std::ifstream::out);
                     if( FO.fail() ){
@@ -136,15 +296,15 @@ std::map<std::string, std::pair<std::string, std::unique_ptr<std::fstream> > >::
 
         *(Log_File["PD_Kerma_1MeV"].second) << "# This is a measure of the distance which a photon of 1 MeV energy (at time of creation) has travelled into a medium until an interaction occurs." << std::endl;
         *(Log_File["PD_Kerma_1MeV"].second) << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances." << std::endl;
-        *(Log_File["PD_Kerma_1MeV"].second) << "#   distance from point of creation (cm) " << std::endl;
+        *(Log_File["PD_Kerma_1MeV"].second) << "#   distance from point of creation (cm)   photon weight " << std::endl;
 
         *(Log_File["PD_Kerma_10MeV"].second) << "# This is a measure of the distance which a photon of 10 MeV energy (at time of creation) has travelled into a medium until an interaction occurs." << std::endl;
         *(Log_File["PD_Kerma_10MeV"].second) << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances." << std::endl;
-        *(Log_File["PD_Kerma_10MeV"].second) << "#   distance from point of creation (cm) " << std::endl;
+        *(Log_File["PD_Kerma_10MeV"].second) << "#   distance from point of creation (cm)   photon weight " << std::endl;
 
         *(Log_File["PD_Dose_6MV"].second) << "# This file can be parsed to give the (arbitrarily normalized) photon fluence at depth. Integrated properly, it will give the (one-dimensional) depth-dose profile" << std::endl;
         *(Log_File["PD_Dose_6MV"].second) << "# for a 6MV spectrum. " << std::endl;
-        *(Log_File["PD_Dose_6MV"].second) << "#   distance from point of creation (cm)   photon energy     (total_mass_attenuation_coefficient*average_energy_absorbed)(photon energy)" << std::endl;
+        *(Log_File["PD_Dose_6MV"].second) << "#   distance from point of creation (cm)   photon energy     (total_mass_attenuation_coefficient*average_energy_absorbed)(photon energy)   photon weight" << std::endl;
 
 //Detector geometry
         *(Log_File["Detector"].second) << "# energy  x  y  z  #_of_interactions " << std::endl;
@@ -158,18 +318,7 @@ std::map<std::string, std::pair<std::string, std::unique_ptr<std::fstream> > >::
         //Cleanup memory (if needed) automatically here.
         if(VERBOSE) FUNCINFO("Closed lib_logging.so");
 
-        //Close all file descriptors. None should be closed already (nor will it matter if they are at this point...)
-        for( Log_File_Iter = Log_File.begin(); Log_File_Iter != Log_File.end(); Log_File_Iter++){
-            //std::string the_key = Log_File_Iter->first;
-            //std::pair<std::string, std::fstream> the_pair = Log_File_Iter->second;
-
-            //FO.flush();
-            ((Log_File_Iter->second).second)->flush();
-
-            //FO.close();
-            ((Log_File_Iter->second).second)->close();
-        }      
-
+        //Files are flushed and closed by Shutdown_Guard (see above.)
         return;
     }
 #else
@@ -182,10 +331,11 @@ void toggle_verbosity(bool in){
 }
 
 
-std::ostream & logging_generic( const std::string &key ){
+//Opens the file backing a text channel and writes its header, if it has one.
+static void open_log_channel( const int &handle ){
+    const std::string key = Log_Channel_Keys[handle];
 
-    //Check if the key corresponds to a valid file descriptor.
-    if( Log_File.find( key ) == Log_File.end() ){
+    {
         //We have several options for handling failure:
         //   1. Write it to stdout and issue a warning (maybe)
         //   2. Store it until the end in a list which corresponds to the key used. Ask the human what to do with it.
@@ -238,53 +388,195 @@ std::ostream & logging_generic( const std::string &key ){
 
 
         //--------------------------------------------------
+        std::ostream &FO = *((Log_File[key]).second);
+
         //We now fill some files with headers. This is not necessary, but avoids awkwardly writing headers to files which never are used otherwise.
         if(key == "Mass_Attenuation_Coefficients"){
-            logging_generic("Mass_Attenuation_Coefficients") << "# Mass attenuation coefficients. " << std::endl;
-            logging_generic("Mass_Attenuation_Coefficients") << "#   Energy   Coherent   Compton   Photoelectric   Pair   Total " << std::endl;
+            FO << "# Mass attenuation coefficients. \n";
+            FO << "#   Energy   Coherent   Compton   Photoelectric   Pair   Total \n";
 
         }else if(key == "Fraction_Transferred_Compton"){
-            logging_generic("Fraction_Transferred_Compton") << "# Fraction of energy transferred to recoil electrons (in Compton interactions) as a function of the incident photon energy. " << std::endl;
-            logging_generic("Fraction_Transferred_Compton") << "#   Incident_Energy   Fraction:(Electron_energy/Incident_Energy)" << std::endl;
+            FO << "# Fraction of energy transferred to recoil electrons (in Compton interactions) as a function of the incident photon energy. \n";
+            FO << "#   Incident_Energy   Fraction:(Electron_energy/Incident_Energy)\n";
 
         }else if(key == "Interaction_Count"){
-            logging_generic("Interaction_Count") << "# Number of interactions a photon underwent until it was fully absorbed versus initial (beam) energy." << std::endl;
-            logging_generic("Interaction_Count") << "#   Energy   Total " << std::endl;
+            FO << "# Number of interactions a photon underwent until it was fully absorbed versus initial (beam) energy.\n";
+            FO << "#   Energy   Total \n";
 
         }else if(key == "Photon_Angular_Distribution"){
-            logging_generic("Photon_Angular_Distribution") << "# Angular distribution of the Kelin-Nishina distribution as a function of the incident photon energy." << std::endl;
-            logging_generic("Photon_Angular_Distribution") << "#   Energy   theta (photon scatering angle)  phi (angle about the line of the incoming photon) " << std::endl;
+            FO << "# Angular distribution of the Kelin-Nishina distribution as a function of the incident photon energy.\n";
+            FO << "#   Energy   theta (photon scatering angle)  phi (angle about the line of the incoming photon) \n";
 
         }else if(key == "Electron_Stopped"){
-            logging_generic("Electron_Stopped") << "# The position (in real-space) where electrons are fully stopped (as far as the program is concerned) in a medium." << std::endl;
-            logging_generic("Electron_Stopped") << "# This data is used for debugging. In more realistic situations, one would be more interested in dose delivered to a medium as it travelled." << std::endl;
-            logging_generic("Electron_Stopped") << "#    x     y     z     r (from 0,0,0)     E (at time of absorption - may not be accurate if electron-particle interactions are turned on..) " << std::endl;
+            FO << "# The position (in real-space) where electrons are fully stopped (as far as the program is concerned) in a medium.\n";
+            FO << "# This data is used for debugging. In more realistic situations, one would be more interested in dose delivered to a medium as it travelled.\n";
+            FO << "#    x     y     z     r (from 0,0,0)     E (at time of absorption - may not be accurate if electron-particle interactions are turned on..) \n";
 
         }else if(key == "PD_Kerma_1MeV"){
-            logging_generic("PD_Kerma_1MeV") << "# This is a measure of the distance which a photon of 1 MeV energy (at time of creation) has travelled into a medium until an interaction occurs." << std::endl;
-            logging_generic("PD_Kerma_1MeV") << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances." << std::endl;
-            logging_generic("PD_Kerma_1MeV") << "#   distance from point of creation (cm) " << std::endl;
+            FO << "# This is a measure of the distance which a photon of 1 MeV energy (at time of creation) has travelled into a medium until an interaction occurs.\n";
+            FO << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances.\n";
+            FO << "#   distance from point of creation (cm)   photon weight \n";
     
         }else if(key == "PD_Kerma_10MeV"){
-            logging_generic("PD_Kerma_10MeV") << "# This is a measure of the distance which a photon of 10 MeV energy (at time of creation) has travelled into a medium until an interaction occurs." << std::endl;
-            logging_generic("PD_Kerma_10MeV") << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances." << std::endl;
-            logging_generic("PD_Kerma_10MeV") << "#   distance from point of creation (cm) " << std::endl;
+            FO << "# This is a measure of the distance which a photon of 10 MeV energy (at time of creation) has travelled into a medium until an interaction occurs.\n";
+            FO << "# Since we specifically examine a monoenergetic portion of the spectrum, we can compute the Percent-Depth Kerma simply by binning and normalizing these distances.\n";
+            FO << "#   distance from point of creation (cm)   photon weight \n";
     
         }else if(key == "PD_Dose_6MV"){
-            logging_generic("PD_Dose_6MV") << "# This file can be parsed to give the (arbitrarily normalized) photon fluence at depth. Integrated properly, it will give the (one-dimensional) depth-dose profile" << std::endl;
-            logging_generic("PD_Dose_6MV") << "# for a 6MV spectrum. " << std::endl;
-            logging_generic("PD_Dose_6MV") << "#   distance from point of creation (cm)   photon energy     (total_mass_attenuation_coefficient*average_energy_absorbed)(photon energy)" << std::endl;
+            FO << "# This file can be parsed to give the (arbitrarily normalized) photon fluence at depth. Integrated properly, it will give the (one-dimensional) depth-dose profile\n";
+            FO << "# for a 6MV spectrum. \n";
+            FO << "#   distance from point of creation (cm)   photon energy     (total_mass_attenuation_coefficient*average_energy_absorbed)(photon energy)   photon weight\n";
     
         }else if(key == "Detector"){
-            logging_generic("Detector") << "# energy  x  y  z  #_of_interactions " << std::endl;
+            FO << "# energy  x  y  z  #_of_interactions \n";
         }    
 
     }
 
-    return *((Log_File[key]).second);
-} 
+    Log_Channels[handle] = (Log_File[key]).second.get();
+    return;
+}
+
+
+//Resolves a text channel key to a handle. Call this once (at load time) and hold on to the handle; logging_by_channel() can
+// then be used on the hot path without any string handling. The file itself is not opened until something is written to it.
+int logging_channel( const std::string &key ){
+    const auto it = Log_Channel_Handles.find( key );
+    if(it != Log_Channel_Handles.end()) return it->second;
+
+    Log_Channel_Keys.push_back( key );
+    Log_Channels.push_back( nullptr );
+    Log_Channel_Handles[key] = static_cast<int>(Log_Channels.size() - 1);
+    return static_cast<int>(Log_Channels.size() - 1);
+}
+
+
+//Refuses text logging from a second thread. The records would be interleaved mid-line (and the maps above raced on.)
+static void check_text_thread(void){
+    std::lock_guard<std::mutex> lock(Text_Thread_Mutex);
+    if(Text_Thread == std::thread::id()){
+        Text_Thread = std::this_thread::get_id();
+    }else if(Text_Thread != std::this_thread::get_id()){
+        FUNCERR("Text logging is not thread-safe. Use histogram or binary logging, or a single thread (-t 1), for the per-event logs");
+    }
+    Text_Thread_Checked = true;
+    return;
+}
+
+
+//Hot-path text logging. Records should be terminated with '\n' rather than std::endl; files are flushed when closed. Only one
+// thread may write text records.
+std::ostream & logging_by_channel( const int &handle ){
+    if(!Text_Thread_Checked) check_text_thread();
+    if(Log_Channels[handle] == nullptr) open_log_channel( handle );
+    return *(Log_Channels[handle]);
+}
+
+
+//Compatibility shim for the string-keyed interface. Fine for one-off output, but prefer resolving a handle.
+std::ostream & logging_generic( const std::string &key ){
+    return logging_by_channel( logging_channel( key ) );
+}
+
+
+
+//Registers (or looks up) a binary channel with a fixed record size. Returns the handle to use with logging_binary_record().
+//
+//This is *not* meant to be called in the hot path. Resolve handles once (at load time) and hold on to them.
+int logging_binary_channel( const std::string &key, const size_t &record_size ){
+    std::lock_guard<std::mutex> lock(Binary_Registry_Mutex);
+
+    const size_t N = Binary_Channel_Count.load();
+    for(size_t i = 0; i < N; ++i){
+        if(Binary_Channels[i].key == key){
+            if(Binary_Channels[i].record_size != record_size){
+                FUNCERR("Binary logging channel \"" << key << "\" was already registered with a different record size");
+            }
+            return static_cast<int>(i);
+        }
+    }
+    if(N == BINARY_MAX_CHANNELS) FUNCERR("Too many binary logging channels. Increase BINARY_MAX_CHANNELS");
+    if(record_size == 0) FUNCERR("Binary logging channel \"" << key << "\" requested with empty records");
+    if(sizeof(unsigned int) + record_size > BINARY_RING_SIZE){
+        //A record which cannot fit in an empty ring would wait for room forever in logging_binary_record().
+        FUNCERR("Binary logging channel \"" << key << "\" requested with records larger than the per-thread ring. Increase BINARY_RING_SIZE");
+    }
+
+    binary_channel &chan = Binary_Channels[N];
+    chan.key             = key;
+    chan.filename        = "/tmp/Transport_" + key + ".bin";
+    chan.record_size     = record_size;
+    chan.records_written = 0;
+    chan.buffer.reserve(BINARY_FLUSH_THRESHOLD + record_size);
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if(DO_NOT_CLOBBER) flags |= O_EXCL;
+    chan.fd = open(chan.filename.c_str(), flags, 0644);
+    if(chan.fd == -1) FUNCERR("Binary logging file \"" << chan.filename << "\" cannot be opened for writing. Unable to proceed");
+
+    //A short, human-readable header. Records follow the blank line.
+    const std::string header = "# Transport binary log v1\n# key: " + key + "\n# record_size: " + std::to_string(record_size) + "\n\n";
+    chan.buffer.insert(chan.buffer.end(), header.begin(), header.end());
+
+    Binary_Channel_Count.store(N + 1, std::memory_order_release);
+
+    //Start the writer the first time any channel is registered.
+    if(!Binary_Writer_Running.load()){
+        Binary_Writer_Stop.store(false);
+        Binary_Writer = std::thread(binary_writer_loop);
+        Binary_Writer_Running.store(true);
+    }
+    return static_cast<int>(N);
+}
+
+
+//Copies a single fixed-size record into this thread's ring. No locking, no formatting, no string handling.
+void logging_binary_record( const int &handle, const void *record ){
+    binary_ring *ring = This_Thread_Ring;
+    if(ring == nullptr){
+        //First record from this thread. Allocate a ring and hand ownership to the registry.
+        std::lock_guard<std::mutex> lock(Binary_Registry_Mutex);
+        Binary_Rings.push_back( std::unique_ptr<binary_ring>( new binary_ring(BINARY_RING_SIZE) ) );
+        ring = This_Thread_Ring = Binary_Rings.back().get();
+    }
+
+    const unsigned int h = static_cast<unsigned int>(handle);
+    const size_t size    = Binary_Channels[h].record_size;
+    const size_t needed  = sizeof(h) + size;
+    const size_t head    = ring->head.load(std::memory_order_relaxed);
+
+    //If the writer is falling behind, wake it and wait for room. Records are never dropped. (Records always fit in an empty
+    // ring; this is checked when the channel is registered.)
+    while((head + needed) - ring->tail.load(std::memory_order_acquire) > ring->bytes.size()){
+        Binary_Writer_Wake.notify_one();
+        std::this_thread::yield();
+    }
 
+    const char *h_bytes = reinterpret_cast<const char *>(&h);
+    const char *r_bytes = reinterpret_cast<const char *>(record);
+    const size_t start  = head & ring->mask;
+    if(start + needed <= ring->bytes.size()){
+        std::memcpy(&(ring->bytes[start]), h_bytes, sizeof(h));
+        std::memcpy(&(ring->bytes[start + sizeof(h)]), r_bytes, size);
+    }else{
+        for(size_t i = 0; i < sizeof(h); ++i) ring->bytes[(head + i) & ring->mask] = h_bytes[i];
+        for(size_t i = 0; i < size; ++i)      ring->bytes[(head + sizeof(h) + i) & ring->mask] = r_bytes[i];
+    }
+    ring->head.store(head + needed, std::memory_order_release);
 
+    //Give the writer a nudge once a quarter of the ring is occupied.
+    if((head + needed) - ring->tail.load(std::memory_order_relaxed) > (ring->bytes.size() >> 2)) Binary_Writer_Wake.notify_one();
+    return;
+}
+
+
+
+//Called once all modules have been loaded. Channels are only opened if they will be used, so empty files are not left behind.
+void resolve_logging_handles(const struct Functions &){
+    if(LoggingQuantities::NumbOfInteractions) Handle_Interaction_Count = logging_channel("Interaction_Count");
+    if(LoggingQuantities::DistanceTravelled)  Handle_Other             = logging_channel("Other");
+    return;
+}
 
 
 //Instead of "expiring" references to inactive particles, they should be sent here so they can be recorded.
@@ -300,14 +592,14 @@ void particle_graveyard(std::unique_ptr<base_particle> in){
 
         //Log question 3 - data about number of interactions a photon does before being absorbed versus initial energy.
         if(LoggingQuantities::NumbOfInteractions){
-            logging_generic("Interaction_Count") << in->Interactions[0].energy << " " << (in->Interactions.size() - 1) << std::endl;  //The photon creation is of no interest to us.
+            logging_by_channel(Handle_Interaction_Count) << in->Interactions[0].energy << " " << (in->Interactions.size() - 1) << '\n';  //The photon creation is of no interest to us.
         }
 
         //Distance, as the crow flies, from point of creation to current position.
         if(LoggingQuantities::DistanceTravelled){
             vec3<double> dist = in->Interactions[0].position;
             dist -= in->Interactions[ (in->Interactions.size() - 1) ].position;
-            logging_generic("Other") << in->Interactions[0].energy << " " << sqrt(dist.x*dist.x + dist.y*dist.y + dist.z*dist.z ) << std::endl;
+            logging_by_channel(Handle_Other) << in->Interactions[0].energy << " " << sqrt(dist.x*dist.x + dist.y*dist.y + dist.z*dist.z ) << '\n';
         }
 
     }else if( (in->get_type() == Particletype::Electron) || (in->get_type() == Particletype::Positron) ){
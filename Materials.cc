@@ -0,0 +1,598 @@
+//Materials.cc - A database of media, loaded from NIST-format data files. Handles any material (other than water, which has its
+// own modules) for which a data file is present.
+//
+//Every file ending in ".material" in the "./Materials/" directory (or the directory named by the TRANSPORT_MATERIALS environment
+// variable) is loaded. See Materials/Water.material for the format. Briefly: a few 'key value' lines (name, density, binding
+// energy, and optionally the radiation length and Z/A used by electron transport) followed by sections laid out like the NIST
+// databases' output, so their tables can be pasted in directly:
+//
+//    [photon]             XCOM output:   E | coherent | incoherent | photoelectric | nuclear pair | electron pair | ...   (cm^2/g)
+//    [energy_absorption]  X-ray tables:  E | mu/rho | mu_en/rho | (optional) mu_tr/rho                                   (cm^2/g)
+//    [electron]           ESTAR output:  kinetic E | collision | radiative | total | ...                                 (MeV cm^2/g)
+//
+//Only Water.material holds NIST values verbatim. The other files shipped in ./Materials/ (Air, Bone, Lung, Tissue, PMMA, and
+// Tungsten) are approximations derived from each material's composition by Physics_Data_Extras/Materials/derive_material_tables.py,
+// which describes the method and its accuracy (a few percent.) Replace them with NIST output where that matters.
+//
+//Absorption edges are marked in the NIST tables by a label (e.g., 'K') in front of the energy; it is skipped. If mu_tr/rho is not
+// given it is taken to be mu_en/rho (i.e., radiative losses are neglected), and if the electron section is missing the same
+// constant stopping power as the water modules is used.
+//
+//All tables are resampled, when loaded, onto a single log-spaced energy grid. The entries for all materials and all energies live
+// in one array, indexed by (material, energy bin), and each entry holds everything needed for a step. A lookup is therefore a log,
+// a multiply, and two adjacent (in memory) entries, regardless of how many materials are loaded.
+//
+//Resampling a fine grid for many materials takes a while, so the finished table can be written to a binary cache file with the
+// build_material_cache tool. If "./Materials/Materials.cache" (or the file named by TRANSPORT_MATERIALS_CACHE; empty to disable)
+// exists, is of the current version, and was built from the same data files (names and contents, see data_files_hash()), it is
+// mapped read-only instead. Startup is then nearly instant, and every process using the cache shares the one copy in the page cache.
+//
+//Programming notes:
+//  -Do not make items here "const", because they will not show up when loading.
+//  -Avoid using macro variables here because they will be obliterated during loading.
+//  -Wrap dynamically-loaded code with extern "C", otherwise C++ compilation will mangle function names, etc.
+//  -The tables are built when the library is loaded, and are only read afterward, so lookups are safe from any thread.
+//
+// From man page for dlsym/dlopen:  For running some 'initialization' code prior to finishing loading:
+// "Instead,  libraries  should  export  routines using the __attribute__((constructor)) and __attribute__((destructor)) function attributes.  See the gcc info pages for
+//       information on these.  Constructor routines are executed before dlopen() returns, and destructor routines are executed before dlclose() returns."
+//   ---for instance, we can use this to seed a random number generator with a random seed. However, in order to pass in a specific seed (and pass that seed to the library)
+//      we need to define an explicitly callable initialization function. In general, these libraries should have both so that we can quickly adjust behaviour if desired.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+
+#include <cmath>
+
+#include <cstdint>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./Misc.h"
+#include "./MyMath.h"
+
+#include "./Constants.h"
+#include "./Structs.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+std::string MODULE_NAME(__FILE__);
+std::string FILE_TYPE("MEDIUM");
+std::string MEDIUM_TYPE("DATABASE");
+
+bool VERBOSE = false;
+
+std::string MATERIALS_DIRECTORY("./Materials/");
+std::string CACHE_FILE("./Materials/Materials.cache");
+
+double ENERGY_MIN  = 1E-3;   //Range of the energy grid (MeV). Photons outside it are an error; charged particles are clamped.
+double ENERGY_MAX  = 50.0;
+long int ENERGY_BINS = 2048;  //Log-spaced.
+
+double DEFAULT_STOPPING_POWER = 2.0;  //MeV cm^2/g. Used when a file has no electron section. (The same constant the water modules use.)
+
+
+//One (material, energy) entry. The photon coefficients are cumulative, so the interaction can be chosen with a single random
+// number. Everything is here so that a step touches a single 64 byte entry (and its neighbour.)
+struct table_entry {
+    double coherent;        //Linear attenuation coefficients (1/cm): coherent,
+    double compton;         // + incoherent,
+    double photoelectric;   // + photoelectric,
+    double total;           // + pair (nuclear and electron) = total.
+    double mass_total;      //Mass attenuation coefficient (cm^2/g).
+    double mass_transfer;   //Mass energy-transfer coefficient (cm^2/g).
+    double mass_absorption; //Mass energy-absorption coefficient (cm^2/g).
+    double stopping_power;  //Total linear stopping power for electrons (MeV/cm).
+};
+
+struct material_properties {
+    std::string name;
+    double density;
+    double binding_energy;
+    double radiation_length;  //g/cm^2. Zero if not given.
+    double z_over_a;          //Zero if not given.
+};
+
+std::vector<table_entry>         Table;             //Built from the data files. Not used if the cache is mapped.
+const table_entry               *Table_Data = nullptr; //[slot*(ENERGY_BINS+1) + bin]. Points into Table or the mapped cache.
+std::vector<material_properties> Properties;        //[slot].
+std::vector<double>              Csda_Range;        //[slot*(ENERGY_BINS+1) + bin]. CSDA range (cm) at each grid energy.
+long int                         Slot[256];          //Material -> slot, or -1 if not loaded.
+double                           Log_Energy_Min   = 0.0;
+double                           Bins_Per_Log_Unit = 0.0;
+
+void                            *Cache_Map  = nullptr;
+size_t                           Cache_Size = 0;
+uint64_t                         Data_Hash  = 0;   //Of the data files the table is (to be) built from. Written to the cache.
+
+
+//Layout of the cache file: a header, one record per material, then the table (starting on a 64 byte boundary.) It is written in
+// the native byte order. Bump CACHE_VERSION whenever this layout or table_entry changes, and old caches will be ignored.
+uint32_t CACHE_VERSION = 3;
+
+struct cache_header {
+    char     magic[8];      //"TRNSMAT".
+    uint32_t version;
+    uint32_t entry_size;    //sizeof(table_entry), as a sanity check.
+    int64_t  bins;
+    double   energy_min;
+    double   energy_max;
+    int64_t  materials;
+    int64_t  table_offset;  //In bytes, from the start of the file.
+    uint64_t data_hash;     //See data_files_hash().
+};
+
+struct cache_material {
+    char     name[48];
+    double   density;
+    double   binding_energy;
+    double   radiation_length;
+    double   z_over_a;
+};
+
+
+//------------------------------------------------ Loading --------------------------------------------------
+static unsigned char material_from_name(const std::string &name){
+    if(name == "Air")      return Material::Air;
+    if(name == "Water")    return Material::Water;
+    if(name == "Bone")     return Material::Bone;
+    if(name == "Lung")     return Material::Lung;
+    if(name == "Tissue")   return Material::Tissue;
+    if(name == "PMMA")     return Material::PMMA;
+    if(name == "Tungsten") return Material::Tungsten;
+    return Material::Unknown;
+}
+
+//A table of (E, value) pairs, sorted by energy. Absorption edges appear as two rows with the same energy.
+typedef std::vector<std::pair<double,double>> column;
+
+//Log-log interpolation, falling back to linear where a value is zero (e.g., pair production below threshold.) Clamped at the ends.
+// At an edge, the value just above the edge is used.
+static double interpolate(const column &C, const double &E){
+    if(C.empty()) return 0.0;
+    if(E <= C.front().first) return C.front().second;
+    if(E >= C.back().first)  return C.back().second;
+
+    const auto hi = std::upper_bound(C.begin(), C.end(), E, [](const double &e, const std::pair<double,double> &p) -> bool { return e < p.first; });
+    const auto lo = hi - 1;
+    if(hi->first == lo->first) return hi->second;
+    if((lo->second > 0.0) && (hi->second > 0.0)){
+        const double f = log(E/lo->first)/log(hi->first/lo->first);
+        return lo->second * pow(hi->second/lo->second, f);
+    }
+    const double f = (E - lo->first)/(hi->first - lo->first);
+    return lo->second + f*(hi->second - lo->second);
+}
+
+static void load_material_file(const std::string &filename){
+    std::ifstream FI(filename.c_str(), std::ios::in);
+    if(!FI.good()) FUNCERR("Unable to open material file '" << filename << "'");
+
+    material_properties P = { "", -1.0, water_binding_energy_oxygen_K, 0.0, 0.0 };
+    column coherent, compton, photoelectric, pair, mass_total, absorption, transfer, stopping;
+    std::string section, line;
+    while(getline(FI, line)){
+        const std::string::size_type hash = line.find('#');
+        if(hash != std::string::npos) line.erase(hash);
+        std::stringstream ss(line);
+        std::string first;
+        if(!(ss >> first)) continue;
+
+        if(first[0] == '['){
+            section = first;
+            continue;
+        }
+        if(first == "name"){             ss >> P.name;             continue; }
+        if(first == "density"){          ss >> P.density;          continue; }
+        if(first == "binding_energy"){   ss >> P.binding_energy;   continue; }
+        if(first == "radiation_length"){ ss >> P.radiation_length; continue; }
+        if(first == "z_over_a"){         ss >> P.z_over_a;         continue; }
+        if(section.empty()) FUNCERR("Material file '" << filename << "': unknown key '" << first << "'");
+
+        //Table rows. Skip the edge label, if there is one.
+        if(isalpha(first[0])){
+            if(!(ss >> first)) continue;
+        }
+        std::vector<double> row(1, atof(first.c_str()));
+        double x;
+        while(ss >> x) row.push_back(x);
+
+        if(section == "[photon]"){
+            if(row.size() < 6) FUNCERR("Material file '" << filename << "': photon rows need at least six columns");
+            coherent.push_back(      { row[0], row[1] });
+            compton.push_back(       { row[0], row[2] });
+            photoelectric.push_back( { row[0], row[3] });
+            pair.push_back(          { row[0], row[4] + row[5] });
+        }else if(section == "[energy_absorption]"){
+            if(row.size() < 3) FUNCERR("Material file '" << filename << "': energy absorption rows need at least three columns");
+            mass_total.push_back(    { row[0], row[1] });
+            absorption.push_back(    { row[0], row[2] });
+            transfer.push_back(      { row[0], (row.size() > 3) ? row[3] : row[2] });
+        }else if(section == "[electron]"){
+            if(row.size() < 4) FUNCERR("Material file '" << filename << "': electron rows need at least four columns");
+            stopping.push_back(      { row[0], row[3] });
+        }else{
+            FUNCERR("Material file '" << filename << "': unknown section '" << section << "'");
+        }
+    }
+
+    const unsigned char material = material_from_name(P.name);
+    if(material == Material::Unknown) FUNCERR("Material file '" << filename << "' names an unknown material '" << P.name << "'");
+    if(Slot[material] != -1)          FUNCERR("Material '" << P.name << "' is defined more than once");
+    if(!(P.density > 0.0))            FUNCERR("Material file '" << filename << "' needs a (positive) density");
+    if(!(P.radiation_length >= 0.0) || !(P.z_over_a >= 0.0)){
+        FUNCERR("Material file '" << filename << "' has a negative radiation length or Z/A");
+    }
+    if(coherent.empty())              FUNCERR("Material file '" << filename << "' has no photon cross sections");
+
+    //Resample onto the common energy grid. Bins are shared by adjacent cells, so there is one more entry than there are bins.
+    Slot[material] = static_cast<long int>(Properties.size());
+    Properties.push_back(P);
+    for(long int i=0; i<=ENERGY_BINS; ++i){
+        const double E = exp(Log_Energy_Min + static_cast<double>(i)/Bins_Per_Log_Unit);
+        table_entry T;
+        T.coherent        = P.density*interpolate(coherent, E);
+        T.compton         = T.coherent      + P.density*interpolate(compton, E);
+        T.photoelectric   = T.compton       + P.density*interpolate(photoelectric, E);
+        T.total           = T.photoelectric + P.density*interpolate(pair, E);
+        T.mass_total      = mass_total.empty() ? (T.total/P.density) : interpolate(mass_total, E);
+        T.mass_transfer   = interpolate(transfer, E);
+        T.mass_absorption = interpolate(absorption, E);
+        T.stopping_power  = P.density*(stopping.empty() ? DEFAULT_STOPPING_POWER : interpolate(stopping, E));
+        Table.push_back(T);
+    }
+
+    if(VERBOSE) FUNCINFO("Loaded material '" << P.name << "' from '" << filename << "'");
+    return;
+}
+
+//The data files in the material directory, sorted so that the slots do not depend on the directory order.
+static std::vector<std::string> material_files(void){
+    std::vector<std::string> files;
+    DIR *dir = opendir(MATERIALS_DIRECTORY.c_str());
+    if(dir == nullptr) return files;
+    while(struct dirent *entry = readdir(dir)){
+        const std::string name(entry->d_name);
+        const std::string ext(".material");
+        if((name.size() > ext.size()) && (name.compare(name.size() - ext.size(), ext.size(), ext) == 0)) files.push_back(MATERIALS_DIRECTORY + name);
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+//A hash (64 bit FNV-1a) of the names and contents of the data files, in order. The cache is only used if it was built from files
+// which hash the same, so renaming, adding, removing, or editing any of them (even within the same second) invalidates it. The
+// directory is left out so the cache can be moved along with the files.
+static uint64_t data_files_hash(const std::vector<std::string> &files){
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](const char *bytes, size_t N) -> void {
+        for(size_t i = 0; i < N; ++i){
+            h ^= static_cast<unsigned char>(bytes[i]);
+            h *= 1099511628211ULL;
+        }
+    };
+    for(const std::string &f : files){
+        const std::string name = f.substr(MATERIALS_DIRECTORY.size());
+        mix(name.c_str(), name.size() + 1);  //Include the terminator, so names and contents cannot run together.
+
+        std::ifstream FI(f.c_str(), std::ios::in | std::ios::binary);
+        if(!FI.good()) FUNCERR("Unable to open material file '" << f << "'");
+        std::vector<char> buffer(4096);
+        uint64_t length = 0;
+        while(FI.read(buffer.data(), buffer.size()) || (FI.gcount() > 0)){
+            mix(buffer.data(), static_cast<size_t>(FI.gcount()));
+            length += static_cast<uint64_t>(FI.gcount());
+        }
+        mix(reinterpret_cast<const char *>(&length), sizeof(length));
+    }
+    return h;
+}
+
+//Maps the cache, if it is usable. Returns false (and leaves nothing mapped) otherwise.
+static bool map_cache(const std::vector<std::string> &files){
+    struct stat cache_stat;
+    if(CACHE_FILE.empty() || (stat(CACHE_FILE.c_str(), &cache_stat) != 0)) return false;
+
+    const int fd = open(CACHE_FILE.c_str(), O_RDONLY);
+    if(fd == -1) return false;
+    const size_t size = static_cast<size_t>(cache_stat.st_size);
+    void *map = (size >= sizeof(cache_header)) ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) return false;
+
+    const char *base = static_cast<const char *>(map);
+    const cache_header *H = reinterpret_cast<const cache_header *>(base);
+    const cache_material *M = reinterpret_cast<const cache_material *>(base + sizeof(cache_header));
+    const bool valid = (memcmp(H->magic, "TRNSMAT", 8) == 0) && (H->version == CACHE_VERSION) && (H->entry_size == sizeof(table_entry))
+                    && (H->data_hash == Data_Hash)
+                    && (H->bins > 0) && (H->materials >= 0) && (H->materials == static_cast<int64_t>(files.size()))
+                    && (H->table_offset >= static_cast<int64_t>(sizeof(cache_header) + H->materials*sizeof(cache_material)))
+                    && (static_cast<size_t>(H->table_offset + H->materials*(H->bins+1)*sizeof(table_entry)) <= size);
+    if(!valid){
+        FUNCWARN("Material cache '" << CACHE_FILE << "' is not usable (wrong version, or does not match the data files). Ignoring it; rebuild it with build_material_cache");
+        munmap(map, size);
+        return false;
+    }
+
+    ENERGY_MIN  = H->energy_min;
+    ENERGY_MAX  = H->energy_max;
+    ENERGY_BINS = static_cast<long int>(H->bins);
+    Log_Energy_Min    = log(ENERGY_MIN);
+    Bins_Per_Log_Unit = static_cast<double>(ENERGY_BINS)/(log(ENERGY_MAX) - Log_Energy_Min);
+    for(int64_t i=0; i<H->materials; ++i){
+        material_properties P;
+        P.name             = std::string(M[i].name, strnlen(M[i].name, sizeof(M[i].name)));
+        P.density          = M[i].density;
+        P.binding_energy   = M[i].binding_energy;
+        P.radiation_length = M[i].radiation_length;
+        P.z_over_a         = M[i].z_over_a;
+        const unsigned char material = material_from_name(P.name);
+        if((material == Material::Unknown) || (Slot[material] != -1)) FUNCERR("Material cache '" << CACHE_FILE << "' is corrupt");
+        Slot[material] = static_cast<long int>(Properties.size());
+        Properties.push_back(P);
+    }
+    Table_Data = reinterpret_cast<const table_entry *>(base + H->table_offset);
+    Cache_Map  = map;
+    Cache_Size = size;
+    if(VERBOSE) FUNCINFO("Mapped " << H->materials << " materials from cache '" << CACHE_FILE << "'");
+    return true;
+}
+
+//Integrates the stopping powers in the table (however it was obtained) into CSDA ranges. The range at the bottom of the grid is
+// taken to be T/S there, and each bin adds the integral of dT/S = (T/S) dlogT.
+static void build_csda_ranges(void){
+    Csda_Range.resize(Properties.size()*(ENERGY_BINS+1));
+    const double dlogT = 1.0/Bins_Per_Log_Unit;
+    for(size_t slot = 0; slot < Properties.size(); ++slot){
+        const table_entry *T = &Table_Data[slot*(ENERGY_BINS+1)];
+        double *R = &Csda_Range[slot*(ENERGY_BINS+1)];
+        double prev = ENERGY_MIN/T[0].stopping_power;
+        R[0] = prev;
+        for(long int i = 1; i <= ENERGY_BINS; ++i){
+            const double next = exp(Log_Energy_Min + static_cast<double>(i)*dlogT)/T[i].stopping_power;
+            R[i] = R[i-1] + 0.5*(prev + next)*dlogT;
+            prev = next;
+        }
+    }
+    return;
+}
+
+//Builds (or maps) the table once the globals above have been constructed.
+struct table_loader {
+    table_loader(){
+        const char *env = getenv("TRANSPORT_MATERIALS");
+        if(env != nullptr) MATERIALS_DIRECTORY = env;
+        if(MATERIALS_DIRECTORY.empty() || (MATERIALS_DIRECTORY.back() != '/')) MATERIALS_DIRECTORY += '/';
+        const char *cache_env = getenv("TRANSPORT_MATERIALS_CACHE");
+        if(cache_env != nullptr) CACHE_FILE = cache_env;
+
+        for(long int &s : Slot) s = -1;
+
+        const std::vector<std::string> files = material_files();
+        Data_Hash = data_files_hash(files);
+        if(!map_cache(files)){
+            if(files.empty()) FUNCWARN("No material files found in '" << MATERIALS_DIRECTORY << "'. No materials will be available from the database");
+
+            Log_Energy_Min    = log(ENERGY_MIN);
+            Bins_Per_Log_Unit = static_cast<double>(ENERGY_BINS)/(log(ENERGY_MAX) - Log_Energy_Min);
+            Table.reserve(files.size()*(ENERGY_BINS+1));
+            for(const std::string &f : files) load_material_file(f);
+            Table_Data = Table.data();
+        }
+        build_csda_ranges();
+    }
+    ~table_loader(){
+        if(Cache_Map != nullptr) munmap(Cache_Map, Cache_Size);
+        Cache_Map  = nullptr;
+        Table_Data = nullptr;
+    }
+} Table_Loader;
+
+
+#ifdef __GNUG__
+    __attribute__((constructor)) static void init_on_dynamic_load(void){
+        //Do something automatic here.
+        if(VERBOSE) FUNCINFO("Loaded lib_materials.so");
+        return;
+    }
+
+    __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
+        //Cleanup memory (if needed) automatically here.
+        if(VERBOSE) FUNCINFO("Closed lib_materials.so");
+        return;
+    }
+#else
+    #warning Being compiled with non-gcc compiler. Unable to use gcc-specific function declarations like 'attribute.' Proceed at your own risk!
+#endif
+
+void toggle_verbosity(bool in){
+    VERBOSE = in;
+    return;
+}
+
+
+//Writes the table (as it is now) to a cache file. Used by the build_material_cache tool. The file is written under a temporary name
+// and then renamed, so processes which have the old cache mapped are not disturbed.
+bool write_material_cache(const std::string &filename){
+    cache_header H;
+    memset(&H, 0, sizeof(H));
+    memcpy(H.magic, "TRNSMAT", 8);
+    H.version      = CACHE_VERSION;
+    H.entry_size   = sizeof(table_entry);
+    H.bins         = ENERGY_BINS;
+    H.energy_min   = ENERGY_MIN;
+    H.energy_max   = ENERGY_MAX;
+    H.materials    = static_cast<int64_t>(Properties.size());
+    H.table_offset = ((sizeof(cache_header) + Properties.size()*sizeof(cache_material) + 63)/64)*64;
+    H.data_hash    = Data_Hash;
+
+    const std::string temp = filename + ".tmp";
+    std::ofstream FO(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!FO.good()){
+        FUNCWARN("Unable to write material cache '" << temp << "'");
+        return false;
+    }
+    FO.write(reinterpret_cast<const char *>(&H), sizeof(H));
+    for(const material_properties &P : Properties){
+        cache_material M;
+        memset(&M, 0, sizeof(M));
+        if(P.name.size() >= sizeof(M.name)) FUNCERR("Material name '" << P.name << "' is too long for the cache");
+        memcpy(M.name, P.name.data(), P.name.size());
+        M.density          = P.density;
+        M.binding_energy   = P.binding_energy;
+        M.radiation_length = P.radiation_length;
+        M.z_over_a         = P.z_over_a;
+        FO.write(reinterpret_cast<const char *>(&M), sizeof(M));
+    }
+    const std::vector<char> padding(static_cast<size_t>(H.table_offset) - sizeof(H) - Properties.size()*sizeof(cache_material), 0);
+    FO.write(padding.data(), padding.size());
+    FO.write(reinterpret_cast<const char *>(Table_Data), Properties.size()*(ENERGY_BINS+1)*sizeof(table_entry));
+    FO.close();
+    if(!FO.good() || (rename(temp.c_str(), filename.c_str()) != 0)){
+        FUNCWARN("Unable to write material cache '" << filename << "'");
+        return false;
+    }
+    if(VERBOSE) FUNCINFO("Wrote " << Properties.size() << " materials to cache '" << filename << "'");
+    return true;
+}
+
+
+//------------------------------------------------ Lookups --------------------------------------------------
+//Finds the pair of entries bracketing E for the material, and the fractional distance between them.
+static inline const table_entry * lookup(const unsigned char &material, const double &E, double &frac){
+    double u = (log(E) - Log_Energy_Min)*Bins_Per_Log_Unit;
+    if(u < 0.0) u = 0.0;
+    if(u > static_cast<double>(ENERGY_BINS) - 1E-9) u = static_cast<double>(ENERGY_BINS) - 1E-9;
+    const long int bin = static_cast<long int>(u);
+    frac = u - static_cast<double>(bin);
+    return &Table_Data[Slot[material]*(ENERGY_BINS+1) + bin];
+}
+
+static inline double lerp(const table_entry *T, const double &frac, double table_entry::*member){
+    return T[0].*member + frac*(T[1].*member - T[0].*member);
+}
+
+bool material_defined(const unsigned char &material){
+    return Slot[material] != -1;
+}
+
+double material_density(const unsigned char &material){
+    if(Slot[material] == -1) FUNCERR("Material " << static_cast<int>(material) << " is not in the database");
+    return Properties[Slot[material]].density;
+}
+
+//Binding energy of the (K-shell) electron ejected in photoelectric events. Materials not in the database get water's.
+double material_binding_energy(const unsigned char &material){
+    if(Slot[material] == -1) return water_binding_energy_oxygen_K;
+    return Properties[Slot[material]].binding_energy;
+}
+
+//For multiple scattering and energy-loss straggling. Zero (i.e., unknown) for materials not in the database, or whose file
+// does not give them.
+double material_radiation_length(const unsigned char &material){
+    if(Slot[material] == -1) return 0.0;
+    return Properties[Slot[material]].radiation_length;
+}
+
+double material_z_over_a(const unsigned char &material){
+    if(Slot[material] == -1) return 0.0;
+    return Properties[Slot[material]].z_over_a;
+}
+
+double material_mass_coefficient_total(const unsigned char &material, const double &E){
+    double frac;
+    const table_entry *T = lookup(material, E, frac);
+    return lerp(T, frac, &table_entry::mass_total);
+}
+
+double material_mass_coefficient_transfer(const unsigned char &material, const double &E){
+    double frac;
+    const table_entry *T = lookup(material, E, frac);
+    return lerp(T, frac, &table_entry::mass_transfer);
+}
+
+double material_mass_coefficient_absorption(const unsigned char &material, const double &E){
+    double frac;
+    const table_entry *T = lookup(material, E, frac);
+    return lerp(T, frac, &table_entry::mass_absorption);
+}
+
+//Total linear stopping power (MeV/cm) for electrons of kinetic energy T.
+double material_stopping_power(const unsigned char &material, const double &T){
+    if(Slot[material] == -1) FUNCERR("Material " << static_cast<int>(material) << " is not in the database");
+    double frac;
+    const table_entry *E = lookup(material, T, frac);
+    return lerp(E, frac, &table_entry::stopping_power);
+}
+
+
+//CSDA range (cm) of an electron of kinetic energy T. Outside the grid, the stopping power at the nearest end is used.
+static double csda_range(const unsigned char &material, const double &T){
+    const double *R = &Csda_Range[Slot[material]*(ENERGY_BINS+1)];
+    if(T <= ENERGY_MIN) return R[0]*T/ENERGY_MIN;
+    if(T >= ENERGY_MAX) return R[ENERGY_BINS] + (T - ENERGY_MAX)/Table_Data[Slot[material]*(ENERGY_BINS+1) + ENERGY_BINS].stopping_power;
+    const double u = (log(T) - Log_Energy_Min)*Bins_Per_Log_Unit;
+    const long int bin = std::min(static_cast<long int>(u), ENERGY_BINS - 1);
+    const double frac = u - static_cast<double>(bin);
+    return R[bin] + frac*(R[bin+1] - R[bin]);
+}
+
+//Same as the water modules' mean_free_path_and_which_interaction(), but for any material in the database.
+void material_mfp_and_which_interaction(const unsigned char &material, base_particle *in, const double &clamped1, const double &clamped2, unsigned char &which, double &mfp){
+    if(Slot[material] == -1) FUNCERR("Material " << static_cast<int>(material) << " is not in the database");
+    const double E = in->get_energy();
+
+    if(in->get_type() == Particletype::Photon){
+        if(!isininc(ENERGY_MIN, E, ENERGY_MAX)) FUNCERR("Photon energy " << E << " is outside of the material database's range (" << ENERGY_MIN << "-" << ENERGY_MAX << " MeV)");
+        double frac;
+        const table_entry *T = lookup(material, E, frac);
+        const double mu_tot = lerp(T, frac, &table_entry::total);
+        const double r      = clamped1*mu_tot;
+
+        mfp = -log(clamped2)/mu_tot;
+        if(r <= lerp(T, frac, &table_entry::coherent)){
+            which = Interactiontype::Coherent;
+        }else if(r <= lerp(T, frac, &table_entry::compton)){
+            which = Interactiontype::Compton;
+        }else if(r <= lerp(T, frac, &table_entry::photoelectric)){
+            which = Interactiontype::Photoelectric;
+        }else{
+            which = Interactiontype::Pair;
+        }
+        return;
+
+    }else if((in->get_type() == Particletype::Electron) || (in->get_type() == Particletype::Positron)){
+        if(USE_CSDA == true){
+            //The particle travels its full CSDA range, integrated from the stopping power table.
+            const double mass = (in->get_type() == Particletype::Electron) ? electron_mass : positron_mass;
+            mfp   = csda_range(material, E - mass);
+            which = Interactiontype::SlowDown;
+        }else{
+            mfp   = 0.0;
+            which = Interactiontype::LocalDump;
+        }
+        return;
+    }
+
+    FUNCERR("Interaction choice for unaccounted-for particle requested");
+    return;
+}
+
+#ifdef __cplusplus
+    }
+#endif
@@ -37,7 +37,9 @@ bool VERBOSE = false;
 //
 //This is almost certainly a SLOW way to handle memory. However, it is an EASY way to handle memory too.
 //
-std::list< std::unique_ptr<base_particle> > pool;
+//Each thread has its own pool, so independent simulations (e.g., CT gantry angles) can run concurrently without locking.
+//
+thread_local std::list< std::unique_ptr<base_particle> > pool;
 //std::list< std::unique_ptr<base_particle> >::iterator place;  // <----(Needed for more elaborate sampling strategies only.)
 
 #ifdef __GNUG__
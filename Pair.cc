@@ -33,6 +33,7 @@ std::string FILE_TYPE("INTERACTION");
 std::string INTERACTION_TYPE("PAIR");
 
 bool VERBOSE = false;
+bool KERMA_APPROXIMATION = false; //If true, charged particles are not created. Their kinetic energy is scored where the photon interacts.
 
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
@@ -55,6 +56,11 @@ void toggle_verbosity(bool in){
     return;
 }
 
+void toggle_kerma_approximation(bool in){
+    KERMA_APPROXIMATION = in;
+    return;
+}
+
 
 
 
@@ -79,6 +85,17 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
 
     const double Ephoton = A->get_energy();
 
+    //In the kerma approximation the pair is never created. All energy above the rest masses goes to their kinetic energy,
+    // so it is scored on the spot without sampling the angles. The positron is taken to annihilate on the spot, too.
+    if(KERMA_APPROXIMATION){
+        Loaded_Functions.voxel_localdump( (Ephoton - 2.0*electron_mass), A->get_position3(), A->get_weight(), Loaded_Functions);
+        if(Loaded_Functions.annihilation_photons != NULL){
+            Loaded_Functions.annihilation_photons( A->get_position3(), A->get_weight(), Loaded_Functions );
+        }
+        Loaded_Functions.particle_graveyard( std::move( A ) );
+        return;
+    }
+
     //These are sampled from a Gaussian distribution about a (rough) mean value. Technically only valid at HIGH photon energy ( hn >> 2*m*c*c ),
     // but should be suspect at all energies!
     //
@@ -126,6 +143,7 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     {
         std::unique_ptr<base_particle> temp = Loaded_Functions.electron_factory(elec_E,A->get_position3(),elec_momentum); 
         temp->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, temp->get_energy(), temp->get_position3()));
+        temp->set_weight( A->get_weight() );
         Loaded_Functions.particle_sink( std::move( temp ) );
     }
 
@@ -133,6 +151,7 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     {
         std::unique_ptr<base_particle> temp = Loaded_Functions.positron_factory(posi_E,A->get_position3(),posi_momentum);
         temp->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, temp->get_energy(), temp->get_position3()));
+        temp->set_weight( A->get_weight() );
         Loaded_Functions.particle_sink( std::move( temp ) );
     }
 
@@ -33,6 +33,7 @@ std::string FILE_TYPE("INTERACTION");
 std::string INTERACTION_TYPE("PHOTOELECTRIC");
 
 bool VERBOSE = false;
+bool KERMA_APPROXIMATION = false; //If true, charged particles are not created. Their kinetic energy is scored where the photon interacts.
 
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
@@ -55,6 +56,11 @@ void toggle_verbosity(bool in){
     return;
 }
 
+void toggle_kerma_approximation(bool in){
+    KERMA_APPROXIMATION = in;
+    return;
+}
+
 
 
 
@@ -72,11 +78,20 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     }
 
 
-    const double electron_energy = electron_mass + A->get_energy() - water_binding_energy_oxygen_K;
+    //The binding energy depends on the material the photon is in (recorded as its latest interaction.) Materials from the
+    // database carry their own. Below the K-edge of a heavy material, the electron comes from an outer shell; its (much smaller)
+    // binding energy is neglected.
+    double binding_energy = water_binding_energy_oxygen_K;
+    if((Loaded_Functions.material_binding_energy != NULL) && !A->Interactions.empty()){
+        binding_energy = Loaded_Functions.material_binding_energy( A->Interactions.back().material );
+        if(A->get_energy() < binding_energy) binding_energy = 0.0;
+    }
+
+    const double electron_energy = electron_mass + A->get_energy() - binding_energy;
 
     if(electron_energy < electron_mass ){
         FUNCERR("Attempted photoelectric effect without enough energy (" << A->get_energy() << " and binding energy is " \
-          << water_binding_energy_oxygen_K << "). Are the cross sections accurate?" << std::endl << \
+          << binding_energy << "). Are the cross sections accurate?" << std::endl << \
           " This particle has E, position, momentum, and type: " << A->get_energy() << " " << A->get_position3() << \
           " " << A->get_relativistic_three_momentum3() << " " << (int)(A->get_type()));
     }
@@ -90,11 +105,19 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     //  electrons produced in this interaction."
 
 
+    //In the kerma approximation the electron's kinetic energy is scored on the spot instead.
+    if(KERMA_APPROXIMATION){
+        Loaded_Functions.voxel_localdump( (electron_energy - electron_mass), A->get_position3(), A->get_weight(), Loaded_Functions);
+        Loaded_Functions.particle_graveyard( std::move( A ) );
+        return;
+    }
+
     //Create an electron with energy from the photon and at the position of the photon.
     const double B_mom_mag = sqrt( electron_energy*electron_energy - electron_mass*electron_mass );
     std::unique_ptr<base_particle> B = Loaded_Functions.electron_factory( electron_energy, A->get_position3(), (A->get_relativistic_three_momentum3()).unit() * B_mom_mag );
 
     B->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Unknown, B->get_energy(), B->get_position3()));
+    B->set_weight( A->get_weight() );
 
     //Push the electron back into memory, and let the photon be destroyed.
     Loaded_Functions.particle_sink( std::move( B ) );
@@ -0,0 +1,351 @@
+#!/usr/bin/env python3
+#derive_material_tables.py - Writes the non-water Materials/*.material files for lib_materials.so.
+#
+#The tables are derived from the elemental composition of each material rather than copied from XCOM/ESTAR output:
+#
+#  -Incoherent: water's coefficient (Materials/Water.material), scaled by electrons per gram. Binding corrections are water's.
+#  -Coherent: scaled per atom from oxygen (taken from water) by Z^n, with n going from 2 at a few keV to 2.5 above ~100 keV.
+#  -Photoelectric: scaled per atom from oxygen by Z^n. The exponent was fitted so that mu/rho reproduces the NIST X-ray tables
+#    for dry air and cortical bone (ICRU-44) to within ~2% (and mostly <1%) from 10 keV to 20 MeV. Below an element's K edge the
+#    cross section is divided by the usual jump ratio (125/Z + 3.5).
+#  -Pair production: scaled per atom from water by Z(Z+1). It is all listed in the nuclear column, as in the water table.
+#  -mu_tr/rho: photoelectric (less K fluorescence escape) + Klein-Nishina energy transfer fraction of incoherent + pair (less 2mc^2.)
+#    mu_en/rho uses a radiative fraction g scaled from water's by <Z(Z+1)>/<Z>.
+#  -Electron stopping powers: Bethe collision formula (ICRU 37) with the Sternheimer-Peierls density effect and the mean excitation
+#    energies listed below. Radiative stopping power is taken as S_col * Z T / 800 MeV. No shell corrections, so expect ~5% errors
+#    below ~50 keV (more for tungsten.)
+#  -Radiation length (for multiple scattering): the Dahl fit to Tsai's values for each element, 716.4 A/(Z(Z+1) ln(287/sqrt(Z)))
+#    g/cm^2 (within ~2.5% for Z > 2), combined as 1/X0 = sum w_i/X0_i. Z/A is the mass-weighted mean.
+#
+#Tungsten is too far from water for the photon scaling to be trusted, so its total mu/rho and mu_en/rho (with the absorption edges)
+# are transcribed from the NIST X-ray tables (by hand; check them before relying on them) and only split into partial
+# coefficients here.
+#
+#Replace any of these with XCOM/ESTAR output when better than a few percent matters; the loader takes either.
+#
+#Usage (from the repository root):   python3 Physics_Data_Extras/Materials/derive_material_tables.py
+
+import math
+import os
+
+ME = 0.51099895  #MeV.
+
+#Water, as in Materials/Water.material.
+E = [0.001, 0.0015, 0.002, 0.003, 0.004, 0.005, 0.006, 0.008, 0.01, 0.015, 0.02, 0.03, 0.04, 0.05, 0.06, 0.08, 0.1, 0.15, 0.2, 0.3,
+     0.4, 0.5, 0.6, 0.8, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0, 5.0, 6.0, 8.0, 10.0, 15.0, 20.0, 30.0, 40.0, 50.0]
+W_COH = [1.37, 1.27, 1.15, 0.909, 0.708, 0.558, 0.449, 0.31, 0.231, 0.133, 0.0886, 0.0469, 0.0287, 0.0194, 0.0139, 0.00816, 0.00535,
+         0.00244, 0.00139, 0.000622, 0.000351, 0.000225, 0.000156, 0.0000879, 0.0000563, 0.000036, 0.000025, 0.0000141, 0.00000626,
+         0.00000352, 0.00000225, 0.00000156, 0.00000088, 0.000000563, 0.00000025, 0.000000141, 0.0000000626, 0.0000000352, 0.0000000225]
+W_INC = [0.0132, 0.0267, 0.0418, 0.0707, 0.0943, 0.112, 0.126, 0.144, 0.155, 0.17, 0.177, 0.183, 0.183, 0.18, 0.177, 0.17, 0.163, 0.147,
+         0.135, 0.118, 0.106, 0.0966, 0.0894, 0.0786, 0.0707, 0.0632, 0.0574, 0.049, 0.0385, 0.0322, 0.0278, 0.0245, 0.0201, 0.0171,
+         0.0127, 0.0102, 0.0074, 0.00588, 0.00491]
+W_PE  = [4080, 1370, 616, 192, 82.0, 41.9, 24.1, 9.92, 4.94, 1.37, 0.544, 0.146, 0.0568, 0.0272, 0.0149, 0.00577, 0.00276, 0.000731,
+         0.000289, 0.0000816, 0.0000349, 0.0000188, 0.0000117, 0.00000592, 0.00000368, 0.00000233, 0.00000169, 0.00000106, 0.000000594,
+         0.000000408, 0.000000309, 0.000000248, 0.000000178, 0.000000139, 0.0000000891, 0.0000000656, 0.0000000429, 0.0000000319,
+         0.0000000253]
+W_PAIR = [0.0]*25 + [0.0000178, 0.0000982, 0.000391, 0.00113, 0.00187, 0.00254, 0.00316, 0.00421, 0.00509, 0.00675, 0.00798, 0.00971,
+         0.0109, 0.0118]
+W_MU_TR = [4065, 1372, 615.2, 191.7, 81.92, 41.89, 24.06, 9.918, 4.945, 1.374, 0.5505, 0.1557, 0.0695, 0.04225, 0.03191, 0.02598,
+         0.02547, 0.02765, 0.02969, 0.03195, 0.03282, 0.03303, 0.03289, 0.03212, 0.03111, 0.02974, 0.02844, 0.02621, 0.023, 0.02091,
+         0.01946, 0.01843, 0.01707, 0.01626, 0.01528, 0.01495, 0.0149, 0.0151, 0.01537]
+W_MU_EN = [4065, 1372, 615.2, 191.7, 81.91, 41.88, 24.05, 9.915, 4.944, 1.374, 0.5503, 0.1557, 0.06947, 0.04223, 0.0319, 0.02597,
+         0.02546, 0.02764, 0.02967, 0.03192, 0.03279, 0.03299, 0.03284, 0.03206, 0.03103, 0.02965, 0.02833, 0.02608, 0.02281, 0.02066,
+         0.01915, 0.01806, 0.01658, 0.01566, 0.01441, 0.01382, 0.01327, 0.01298, 0.01279]
+
+#Z, A, K edge (MeV), K fluorescence yield, K-alpha energy (MeV).
+ELEMENTS = {
+    'H':  (1,   1.008,  13.6e-6,   0.0,    0.0),
+    'C':  (6,  12.011, 288.0e-6,   0.0028, 0.000277),
+    'N':  (7,  14.007, 409.9e-6,   0.0052, 0.000392),
+    'O':  (8,  15.999, 543.1e-6,   0.0083, 0.000525),
+    'Na': (11, 22.990, 1.0721e-3,  0.023,  0.00104),
+    'Mg': (12, 24.305, 1.3050e-3,  0.030,  0.00125),
+    'P':  (15, 30.974, 2.1455e-3,  0.064,  0.00201),
+    'S':  (16, 32.06,  2.4720e-3,  0.078,  0.00231),
+    'Cl': (17, 35.45,  2.8224e-3,  0.097,  0.00262),
+    'Ar': (18, 39.948, 3.2029e-3,  0.118,  0.00296),
+    'K':  (19, 39.098, 3.6074e-3,  0.140,  0.00331),
+    'Ca': (20, 40.078, 4.0381e-3,  0.163,  0.00369),
+    'W':  (74, 183.84, 69.525e-3,  0.950,  0.0592),
+}
+
+ELEMENT_NAMES = { 'H': 'Hydrogen', 'C': 'Carbon', 'N': 'Nitrogen', 'O': 'Oxygen', 'Na': 'Sodium', 'Mg': 'Magnesium', 'P': 'Phosphorus',
+                  'S': 'Sulfur', 'Cl': 'Chlorine', 'Ar': 'Argon', 'K': 'Potassium', 'Ca': 'Calcium', 'W': 'Tungsten' }
+
+WATER = [('H', 0.111894), ('O', 0.888106)]
+M_WATER = 2*1.008 + 15.999
+
+#name, description, density (g/cm^3), I (eV), gas?, composition (mass fractions.)
+MATERIALS = [
+    ('Air', 'Dry air (near sea level)', 1.20479E-3, 85.7, True,
+        [('C', 0.000124), ('N', 0.755268), ('O', 0.231781), ('Ar', 0.012827)]),
+    ('Bone', 'Cortical bone (ICRU-44)', 1.92, 106.4, False,
+        [('H', 0.034), ('C', 0.155), ('N', 0.042), ('O', 0.435), ('Na', 0.001), ('Mg', 0.002), ('P', 0.103), ('S', 0.003), ('Ca', 0.225)]),
+    ('Lung', 'Lung (ICRU-44 composition, at the density of inflated lung)', 0.26, 75.3, False,
+        [('H', 0.103), ('C', 0.105), ('N', 0.031), ('O', 0.749), ('Na', 0.002), ('P', 0.002), ('S', 0.003), ('Cl', 0.003), ('K', 0.002)]),
+    ('Tissue', 'Soft tissue (ICRU-44)', 1.06, 75.3, False,
+        [('H', 0.102), ('C', 0.143), ('N', 0.034), ('O', 0.708), ('Na', 0.002), ('P', 0.003), ('S', 0.003), ('Cl', 0.002), ('K', 0.003)]),
+    ('PMMA', 'Polymethyl methacrylate (Lucite, Perspex; C5H8O2)', 1.19, 74.0, False,
+        [('H', 0.080538), ('C', 0.599848), ('O', 0.319614)]),
+    ('Tungsten', 'Tungsten', 19.3, 727.0, False,
+        [('W', 1.0)]),
+]
+
+#NIST X-ray tables for tungsten: (edge label, E (MeV), mu/rho, mu_en/rho.) Edges are listed twice (below, then above.)
+TUNGSTEN_NIST = [
+    ('',   1.00000E-03, 3.683E+03, 3.671E+03),
+    ('',   1.50000E-03, 1.643E+03, 1.632E+03),
+    ('',   1.80920E-03, 1.108E+03, 1.097E+03),
+    ('M5', 1.80920E-03, 1.327E+03, 1.311E+03),
+    ('',   1.87160E-03, 2.901E+03, 2.853E+03),
+    ('M4', 1.87160E-03, 3.170E+03, 3.116E+03),
+    ('',   2.00000E-03, 3.922E+03, 3.853E+03),
+    ('',   2.28100E-03, 2.828E+03, 2.781E+03),
+    ('M3', 2.28100E-03, 3.279E+03, 3.226E+03),
+    ('',   2.57490E-03, 2.445E+03, 2.404E+03),
+    ('M2', 2.57490E-03, 2.599E+03, 2.556E+03),
+    ('',   2.81960E-03, 2.104E+03, 2.069E+03),
+    ('M1', 2.81960E-03, 2.194E+03, 2.158E+03),
+    ('',   3.00000E-03, 1.902E+03, 1.867E+03),
+    ('',   4.00000E-03, 9.564E+02, 9.302E+02),
+    ('',   5.00000E-03, 5.534E+02, 5.338E+02),
+    ('',   6.00000E-03, 3.514E+02, 3.365E+02),
+    ('',   8.00000E-03, 1.705E+02, 1.612E+02),
+    ('',   1.00000E-02, 9.691E+01, 9.035E+01),
+    ('',   1.02068E-02, 9.201E+01, 8.567E+01),
+    ('L3', 1.02068E-02, 2.334E+02, 1.965E+02),
+    ('',   1.15440E-02, 1.689E+02, 1.443E+02),
+    ('L2', 1.15440E-02, 2.312E+02, 1.912E+02),
+    ('',   1.20998E-02, 2.065E+02, 1.722E+02),
+    ('L1', 1.20998E-02, 2.382E+02, 1.974E+02),
+    ('',   1.50000E-02, 1.389E+02, 1.176E+02),
+    ('',   2.00000E-02, 6.573E+01, 5.697E+01),
+    ('',   3.00000E-02, 2.273E+01, 2.014E+01),
+    ('',   4.00000E-02, 1.067E+01, 9.306E+00),
+    ('',   5.00000E-02, 5.949E+00, 5.034E+00),
+    ('',   6.00000E-02, 3.713E+00, 3.035E+00),
+    ('',   6.95250E-02, 2.552E+00, 1.982E+00),
+    ('K',  6.95250E-02, 1.123E+01, 3.633E+00),
+    ('',   8.00000E-02, 7.810E+00, 3.119E+00),
+    ('',   1.00000E-01, 4.438E+00, 2.271E+00),
+    ('',   1.50000E-01, 1.581E+00, 1.068E+00),
+    ('',   2.00000E-01, 7.844E-01, 5.759E-01),
+    ('',   3.00000E-01, 3.238E-01, 2.331E-01),
+    ('',   4.00000E-01, 1.925E-01, 1.217E-01),
+    ('',   5.00000E-01, 1.378E-01, 7.894E-02),
+    ('',   6.00000E-01, 1.093E-01, 5.819E-02),
+    ('',   8.00000E-01, 8.066E-02, 3.967E-02),
+    ('',   1.00000E+00, 6.618E-02, 3.141E-02),
+    ('',   1.25000E+00, 5.577E-02, 2.587E-02),
+    ('',   1.50000E+00, 5.000E-02, 2.302E-02),
+    ('',   2.00000E+00, 4.433E-02, 2.046E-02),
+    ('',   3.00000E+00, 4.075E-02, 2.007E-02),
+    ('',   4.00000E+00, 4.038E-02, 2.080E-02),
+    ('',   5.00000E+00, 4.103E-02, 2.170E-02),
+    ('',   6.00000E+00, 4.210E-02, 2.258E-02),
+    ('',   8.00000E+00, 4.472E-02, 2.401E-02),
+    ('',   1.00000E+01, 4.747E-02, 2.509E-02),
+    ('',   1.50000E+01, 5.384E-02, 2.670E-02),
+    ('',   2.00000E+01, 5.893E-02, 2.730E-02),
+]
+
+#Electron kinetic energies (MeV) for the stopping power tables, as in ESTAR's default list.
+ESTAR_E = [0.01, 0.0125, 0.015, 0.0175, 0.02, 0.025, 0.03, 0.035, 0.04, 0.045, 0.05, 0.055, 0.06, 0.07, 0.08, 0.09, 0.1, 0.125, 0.15,
+           0.175, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.5, 0.55, 0.6, 0.7, 0.8, 0.9, 1.0, 1.25, 1.5, 1.75, 2.0, 2.5, 3.0, 3.5, 4.0, 4.5,
+           5.0, 5.5, 6.0, 7.0, 8.0, 9.0, 10.0, 12.5, 15.0, 17.5, 20.0, 25.0, 30.0, 35.0, 40.0, 45.0, 50.0]
+
+
+def loglog(xs, ys, x):
+    #Log-log interpolation in a table (linear where a value is zero), clamped at the ends.
+    if x <= xs[0]: return ys[0]
+    if x >= xs[-1]: return ys[-1]
+    for i in range(1, len(xs)):
+        if x <= xs[i]:
+            x0, x1, y0, y1 = xs[i-1], xs[i], ys[i-1], ys[i]
+            if (y0 > 0.0) and (y1 > 0.0):
+                return y0*math.exp(math.log(y1/y0)*math.log(x/x0)/math.log(x1/x0))
+            return y0 + (y1 - y0)*(x - x0)/(x1 - x0)
+
+def k_jump(Z):
+    return 125.0/Z + 3.5
+
+def n_photoelectric(e):
+    return 4.0 + 0.3*min(1.0, max(0.0, math.log(e/0.01)/math.log(10.0))) + 0.34*max(0.0, 1.0 - math.exp(-(e - 0.006)/0.015))
+
+def n_coherent(e):
+    return 2.0 + 0.5*min(1.0, max(0.0, math.log(e/0.002)/math.log(50.0)))
+
+def klein_nishina_transfer_fraction(e):
+    k = e/ME
+    L = math.log(1.0 + 2.0*k)
+    s  = (1.0 + k)/k**2*(2.0*(1.0 + k)/(1.0 + 2.0*k) - L/k) + L/(2.0*k) - (1.0 + 3.0*k)/(1.0 + 2.0*k)**2
+    tr = (2.0*(1.0 + k)**2/(k**2*(1.0 + 2.0*k)) - (1.0 + 3.0*k)/(1.0 + 2.0*k)**2
+          - (1.0 + k)*(2.0*k**2 - 2.0*k - 1.0)/(k**2*(1.0 + 2.0*k)**2) - 4.0*k**2/(3.0*(1.0 + 2.0*k)**3)
+          - ((1.0 + k)/k**3 - 1.0/(2.0*k) + 1.0/(2.0*k**3))*L)
+    return tr/s
+
+def element(symbol, e):
+    #Per gram partial coefficients (cm^2/g) for one element: coherent, incoherent, photoelectric, pair, and the fraction of the
+    # photoelectric energy which stays local.
+    Z, A, Ek, wK, EKa = ELEMENTS[symbol]
+    water = lambda table: loglog(E, table, e)
+    npe, nco = n_photoelectric(e), n_coherent(e)
+    pe_O  = water(W_PE)*M_WATER/(1.0 + 2.0*(1.0/8.0)**npe)   #Per mole of oxygen atoms.
+    coh_O = water(W_COH)*M_WATER/(1.0 + 2.0*(1.0/8.0)**nco)
+    pe    = pe_O*(Z/8.0)**npe
+    if e < Ek: pe /= k_jump(Z)
+    coh   = coh_O*(Z/8.0)**nco
+    inc   = water(W_INC)*M_WATER/10.0*Z
+    pair  = water(W_PAIR)*M_WATER/(2.0*1.0*2.0 + 8.0*9.0)*Z*(Z + 1.0)
+    local = 1.0
+    if (e >= Ek) and (Z > 1):
+        local = 1.0 - (1.0 - 1.0/k_jump(Z))*wK*EKa/e
+    return coh/A, inc/A, pe/A, pair/A, local
+
+def mean_Z_rad(composition):
+    num = sum(w*ELEMENTS[s][0]*(ELEMENTS[s][0] + 1.0)/ELEMENTS[s][1] for s, w in composition)
+    den = sum(w*ELEMENTS[s][0]/ELEMENTS[s][1] for s, w in composition)
+    return num/den
+
+def radiative_fraction(composition, e):
+    #Water's g (from its mu_tr and mu_en), with g/(1-g) scaled by <Z(Z+1)>/<Z>.
+    gw = 1.0 - loglog(E, W_MU_EN, e)/loglog(E, W_MU_TR, e)
+    x  = gw/(1.0 - gw)*mean_Z_rad(composition)/mean_Z_rad(WATER)
+    return x/(1.0 + x)
+
+def transfer(composition, e, coh, inc, pe_local, pair):
+    return pe_local + inc*klein_nishina_transfer_fraction(e) + pair*max(0.0, 1.0 - 2.0*ME/e)
+
+def mixture_rows(composition):
+    #The K edges within the grid are listed twice, as in the NIST tables: just below, then (labelled) at the edge.
+    points = [('', e, e) for e in E]
+    for s, w in composition:
+        Ek = ELEMENTS[s][2]
+        if E[0] < Ek < E[-1]:
+            points += [('', Ek, Ek*(1.0 - 1E-9)), ('K', Ek, Ek)]
+    points.sort(key=lambda p: (p[1], p[0] != ''))
+
+    rows = []
+    for label, e, e_eval in points:
+        coh = inc = pe = pair = pe_local = 0.0
+        for s, w in composition:
+            c, n, p, q, f = element(s, e_eval)
+            coh += w*c; inc += w*n; pe += w*p; pair += w*q; pe_local += w*p*f
+        mu_tr = transfer(composition, e, coh, inc, pe_local, pair)
+        mu_en = mu_tr*(1.0 - radiative_fraction(composition, e))
+        rows.append((label, e, coh, inc, pe, pair, coh + inc + pe + pair, mu_en, mu_tr))
+    return rows
+
+def tungsten_rows():
+    #Totals from the NIST tables. Coherent and incoherent are modelled, pair production is modelled with a correction for
+    # screening and the Coulomb field (fitted to the totals above 2 MeV), and the photoelectric coefficient is what is left.
+    composition = [('W', 1.0)]
+    pair_corr = [(1.25, 1.35), (1.5, 1.35), (2.0, 1.31), (3.0, 1.25), (4.0, 1.14), (5.0, 1.08), (6.0, 1.03), (8.0, 0.98), (10.0, 0.95),
+                 (15.0, 0.92), (20.0, 0.90), (30.0, 0.88), (40.0, 0.87), (50.0, 0.86)]
+    corr = lambda e: loglog([p[0] for p in pair_corr], [p[1] for p in pair_corr], e)
+    pe_1MeV = None
+    rows = []
+    entries = list(TUNGSTEN_NIST) + [('', e, None, None) for e in (30.0, 40.0, 50.0)]
+    for label, e, total, mu_en in entries:
+        coh, inc, pe_model, pair, local = element('W', e)
+        pair *= corr(e) if e > 2.0*ME else 0.0
+        if e <= 1.0:
+            pe = total - coh - inc
+            if e == 1.0: pe_1MeV = pe
+        else:
+            pe = pe_1MeV*e**-1.5
+            if total is not None:
+                inc = total - coh - pe - pair
+            else:
+                total = coh + inc + pe + pair
+        if pe <= 0.0 or inc <= 0.0: raise RuntimeError("Tungsten decomposition failed at %g MeV" % e)
+        g = radiative_fraction(composition, e)
+        if mu_en is None:
+            mu_en = transfer(composition, e, coh, inc, pe*local, pair)*(1.0 - g)
+        rows.append((label, e, coh, inc, pe, pair, total, mu_en, mu_en/(1.0 - g)))
+    return rows
+
+def stopping_powers(composition, density, I, gas):
+    #Collision (ICRU 37, with the Sternheimer-Peierls density effect) and radiative stopping powers (MeV cm^2/g.)
+    ZA = sum(w*ELEMENTS[s][0]/ELEMENTS[s][1] for s, w in composition)
+    C = 2.0*math.log(I/(28.816*math.sqrt(density*ZA))) + 1.0
+    if gas:
+        X0, X1 = 1.6, 4.0
+        for limit, x0, x1 in ((10.0, 1.6, 4.0), (10.5, 1.7, 4.0), (11.0, 1.8, 4.0), (11.5, 1.9, 4.0), (12.25, 2.0, 4.0), (13.804, 2.0, 5.0)):
+            if C >= limit: X0, X1 = x0, x1
+        if C >= 13.804: X0, X1 = 0.326*C - 2.5, 5.0
+    elif I < 100.0:
+        X0, X1 = (0.2 if C < 3.681 else 0.326*C - 1.0), 2.0
+    else:
+        X0, X1 = (0.2 if C < 5.215 else 0.326*C - 1.5), 3.0
+    a = (C - 2.0*math.log(10.0)*X0)/(X1 - X0)**3
+    Zrad = mean_Z_rad(composition)
+    rows = []
+    for T in ESTAR_E:
+        tau = T/ME
+        b2  = 1.0 - 1.0/(tau + 1.0)**2
+        X   = math.log10(math.sqrt((tau + 1.0)**2 - 1.0))
+        d   = 0.0 if X < X0 else (2.0*math.log(10.0)*X - C + (a*(X1 - X)**3 if X < X1 else 0.0))
+        F   = 1.0 - b2 + (tau*tau/8.0 - (2.0*tau + 1.0)*math.log(2.0))/(tau + 1.0)**2
+        col = 0.153537*ZA/b2*(math.log(tau*tau*(tau + 2.0)/(2.0*(I*1E-6/ME)**2)) + F - d)
+        rad = col*Zrad*T/800.0
+        rows.append((T, col, rad, col + rad))
+    return rows
+
+def radiation_length(composition):
+    inverse = 0.0
+    for s, w in composition:
+        Z, A = ELEMENTS[s][0], ELEMENTS[s][1]
+        inverse += w*Z*(Z + 1.0)*math.log(287.0/math.sqrt(Z))/(716.4*A)
+    return 1.0/inverse
+
+def z_over_a(composition):
+    return sum(w*ELEMENTS[s][0]/ELEMENTS[s][1] for s, w in composition)
+
+def binding_energy(composition):
+    #K shell of the element with the largest share of photoelectric absorption (at 30 keV.)
+    share = lambda s, w: w*element(s, 0.03)[2]
+    symbol = max(composition, key=lambda sw: share(*sw))[0]
+    return ELEMENTS[symbol][2], symbol
+
+def fmt(x):
+    return ('%.4g' % x) if x != 0.0 else '0'
+
+def write(name, description, density, I, gas, composition, directory):
+    rows = tungsten_rows() if name == 'Tungsten' else mixture_rows(composition)
+    Eb, symbol = binding_energy(composition)
+    with open(os.path.join(directory, name + '.material'), 'w') as f:
+        f.write('#%s.material - %s for lib_materials.so. See Water.material for the format.\n' % (name, description))
+        f.write('#\n')
+        f.write('#Mass fractions: %s.\n' % ', '.join('%s %g' % (s, w) for s, w in composition))
+        f.write('#Mean excitation energy (for the stopping powers): %g eV.\n' % I)
+        f.write('#\n')
+        f.write('#Generated by Physics_Data_Extras/Materials/derive_material_tables.py, which describes how (and how well) the\n')
+        f.write('# coefficients were derived. Replace the tables with XCOM/ESTAR output where better than a few percent matters.\n')
+        if name == 'Tungsten':
+            f.write('# The totals and mu_en/rho below 20 MeV follow the NIST X-ray tables (with the absorption edges.) They were\n')
+            f.write('# transcribed by hand, so check them against the tables before relying on them.\n')
+        f.write('\n')
+        f.write('name              %s\n' % name)
+        f.write('density           %g\n' % density)
+        f.write('binding_energy    %s    #%s K shell.\n' % (('%gE-6' % (Eb*1E6)) if Eb < 1E-3 else ('%gE-3' % (Eb*1E3)), ELEMENT_NAMES[symbol]))
+        f.write('radiation_length  %.4g\n' % radiation_length(composition))
+        f.write('z_over_a          %.4f\n' % z_over_a(composition))
+        f.write('\n[photon]\n')
+        f.write('#    E (MeV)       Coherent      Incoherent    Photoelectric  Nuclear pair  Electron pair\n')
+        for label, e, coh, inc, pe, pair, total, mu_en, mu_tr in rows:
+            f.write('%-4s %-13s %-13s %-13s %-14s %-13s %s\n' % (label, '%.5E' % e, fmt(coh), fmt(inc), fmt(pe), fmt(pair), '0'))
+        f.write('\n[energy_absorption]\n')
+        f.write('#    E (MeV)       mu/rho        mu_en/rho     mu_tr/rho\n')
+        for label, e, coh, inc, pe, pair, total, mu_en, mu_tr in rows:
+            f.write('%-4s %-13s %-13s %-13s %s\n' % (label, '%.5E' % e, fmt(total), fmt(mu_en), fmt(mu_tr)))
+        f.write('\n[electron]\n')
+        f.write('#Kinetic E (MeV)  Collision     Radiative     Total\n')
+        for T, col, rad, tot in stopping_powers(composition, density, I, gas):
+            f.write('%-17s %-13s %-13s %s\n' % ('%g' % T, fmt(col), fmt(rad), fmt(tot)))
+    return
+
+if __name__ == '__main__':
+    directory = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'Materials')
+    for m in MATERIALS:
+        write(*m, directory=directory)
@@ -36,8 +36,10 @@ bool VERBOSE = false;
 
 
 // <Invisible>
-std::mt19937 random_engine;
-std::uniform_real_distribution<> random_distribution(0.0, 1.0);
+//Each thread has its own generator. Threads other than the one which loaded this module must be seeded explicitly (with
+// init_explicit_seed) or they will all produce the same (default-seeded) sequence.
+thread_local std::mt19937 random_engine;
+thread_local std::uniform_real_distribution<> random_distribution(0.0, 1.0);
 //auto random_src;  //Needed if we want to curry the source call.
 // </Invisible>
 
@@ -68,7 +70,7 @@ void toggle_verbosity(bool in){
 }
 
 bool init_explicit_seed(long int seed){
-    //This seeding is not required, but it can be used to re-seed the generator.
+    //This seeding is not required, but it can be used to re-seed the generator. Only affects the calling thread's generator.
     random_engine.seed( seed );
     //random_src = std::bind(random_distribution,random_engine); //No point in currying this..
     return true;
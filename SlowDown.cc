@@ -82,19 +82,23 @@ void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Fu
     //The current position of the particle will be the FINAL position of the particle, AFTER slowdown
     vec3<double> final_pos = A->get_position3();
 
-    //The initial position (PRIOR to slowdown) can be found in the interaction history.
-//    vec3<double> initial_pos = A->Interactions[A->Interactions.size()-1].position;
-    if((A->Interactions.size() != 2) || (A->Interactions[0].interaction != Interactiontype::Creation)){
-        FUNCERR("This electron has undergone more than one interaction. CSDA mixing with other interactions is not supported! (This may be the result of having vacuum in the geometry)");
+    //The initial position (PRIOR to slowdown) is where the particle was last handed to a medium: its creation, or where it
+    // crossed into this medium (e.g., after passing through a vacuum.) Either way it is the previous entry in the history.
+    if(A->Interactions.size() < 2){
+        FUNCERR("Particle has no interaction history. Unable to determine where the slowdown began");
     }
-
-    vec3<double> initial_pos = A->Interactions[0].position;
+    vec3<double> initial_pos = A->Interactions[A->Interactions.size()-2].position;
 
     //We now have enough info from the particle to raycast it through the voxel geometry if we assume the stopping power is constant. 
     // In reality, it would be much more cumbersome to handle this way  FIXME
     
     // -----> call the voxel-recording routine here!
-    Loaded_Functions.voxel_accumulation(initial_E, initial_pos,  final_E, final_pos, Loaded_Functions);
+    Loaded_Functions.voxel_accumulation(initial_E, initial_pos,  final_E, final_pos, A->get_weight(), Loaded_Functions);
+
+    //A positron annihilates where it comes to rest.
+    if((A->get_type() == Particletype::Positron) && (Loaded_Functions.annihilation_photons != NULL)){
+        Loaded_Functions.annihilation_photons(final_pos, A->get_weight(), Loaded_Functions);
+    }
 
     return;
 }
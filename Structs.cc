@@ -156,13 +156,13 @@ an_interaction::an_interaction(const unsigned char &in_interaction, const unsign
 
 //-------------------------------- base_particle --------------------------------------
 //Constructors.
-base_particle::base_particle() : type(0),mass(0),charge(0),energy(0),X(),U() { }
+base_particle::base_particle() : type(0),mass(0),charge(0),energy(0),weight(1.0),X(),U() { }
 
-base_particle::base_particle(const unsigned char &type_in, const double &mass_in, const double &charge_in, const double &energy_in) : type(type_in),mass(mass_in),charge(charge_in),energy(energy_in),X(),U() { }
+base_particle::base_particle(const unsigned char &type_in, const double &mass_in, const double &charge_in, const double &energy_in) : type(type_in),mass(mass_in),charge(charge_in),energy(energy_in),weight(1.0),X(),U() { }
 
 //base_particle::base_particle(const vec4<double> &X_in, const vec4<double> &U_in) : type(0),mass(0),charge(0),energy(0),X(X_in),U(U_in) { }
 
-base_particle::base_particle(const unsigned char &type_in, const double &mass_in, const double &charge_in, const double &energy_in, const vec4<double> &X_in, const vec4<double> &U_in) : type(type_in),mass(mass_in),charge(charge_in),energy(energy_in),X(X_in),U(U_in) { }
+base_particle::base_particle(const unsigned char &type_in, const double &mass_in, const double &charge_in, const double &energy_in, const vec4<double> &X_in, const vec4<double> &U_in) : type(type_in),mass(mass_in),charge(charge_in),energy(energy_in),weight(1.0),X(X_in),U(U_in) { }
 
 
 
@@ -170,6 +170,8 @@ base_particle::base_particle(const unsigned char &type_in, const double &mass_in
 unsigned char base_particle::get_type(void) const { return type; }
 double        base_particle::get_mass(void) const { return mass; }
 double        base_particle::get_charge(void) const { return charge; }
+double        base_particle::get_weight(void) const { return weight; }
+void          base_particle::set_weight(const double &in){ weight = in; return; }
 
 vec3<double> base_particle::get_position3(void){ return X.p; }
 void base_particle::set_position3(const vec3<double> &in){ X.p = in; return; }
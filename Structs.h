@@ -75,6 +75,7 @@ class base_particle {
         double        mass;   
         double        charge;
         double        energy;  //Total energy E, such that $E = \gamma mc^{2}$ or $E = h\nu$. NOT kinetic T!
+        double        weight;  //Statistical weight. Scales everything the particle (and its progeny) contributes to a tally.
 
         vec4<double> X; //Contravariant four-position $X^{\mu}.$
         vec4<double> U; //Contravariant four-velocity $U^{\mu}.$
@@ -96,6 +97,8 @@ class base_particle {
         unsigned char get_type(void) const;
         double get_mass(void) const;
         double get_charge(void) const;
+        double get_weight(void) const;
+        void set_weight(const double &);
 
         vec3<double> get_position3(void);
         void set_position3(const vec3<double> &);
@@ -139,11 +142,44 @@ struct Functions {
     //Returns the char value corresponding to the material at a point in space.
     FUNCTION_geometry_type         which_material;
 
+    //Classifies arrays of points (x[], y[], z[] to material[]). Never NULL: geometries without a native version get a scalar loop.
+    FUNCTION_geometry_type_batch   which_materials;
+
+    //(Optional.) Distance from a point, along a direction, to the next material boundary.
+    FUNCTION_distance_to_boundary  distance_to_boundary;
+
+    //(Optional.) Distance from a point, in any direction, to the nearest material boundary. Never an overestimate.
+    FUNCTION_safety_distance       safety_distance;
+
+    //(Optional.) Relative importance of the region containing a point. Drives photon splitting and Russian roulette.
+    FUNCTION_importance            importance;
+
+    //(Optional.) Exponential transform parameter and bias direction of the region containing a point. Stretches photon flights.
+    FUNCTION_exponential_transform exponential_transform;
+
+    //(Optional.) Maps a point in a segmented detector to a detector cell, and the number of such cells.
+    FUNCTION_detector_cell         detector_cell;
+    FUNCTION_detector_cell_count   detector_cell_count;
+    FUNCTION_detector_cell_face    detector_cell_face; //(Optional.) Entrance face of a cell, with its inward normal. Used for forced detection.
+
     //Generic particle graveyard used for logging. 
     FUNCTION_particle_graveyard    particle_graveyard;
 
+    //(Optional.) Emits the annihilation photons of a positron which has stopped. Without it, stopped positrons simply vanish.
+    FUNCTION_annihilation_photons  annihilation_photons;
+
     //Generic logging facilities.
-    FUNCTION_generic_logging       generic_logging;
+    FUNCTION_generic_logging       generic_logging;    //String-keyed. Convenient, but slow. Avoid in the hot path.
+    FUNCTION_logging_channel       logging_channel;    //Resolves a key to a text channel handle. Not for the hot path!
+    FUNCTION_logging_by_channel    logging_by_channel; //Handle-indexed text logging. Terminate records with '\n', not std::endl.
+    FUNCTION_binary_logging_channel binary_logging_channel; //(Optional.) Registers a fixed-size binary record channel. Not for the hot path!
+    FUNCTION_binary_logging_record  binary_logging_record;  //(Optional.) Queues a single record on a registered channel.
+
+    //(Optional.) In-process histogram tallies. Register once (not in the hot path!), then fill by handle.
+    FUNCTION_tally_histogram_1D    tally_histogram_1D;
+    FUNCTION_tally_histogram_2D    tally_histogram_2D;
+    FUNCTION_tally_fill            tally_fill;
+    FUNCTION_tally_fill_2D         tally_fill_2D;
 
     //Quantities required for computing Kerma and/or Dose outside of Transport.cc.
     FUNCTION_average_energy_X      photon_average_energy_absorbed;
@@ -152,9 +188,25 @@ struct Functions {
     FUNCTION_mass_coefficient_X    photon_mass_coefficient_absorption;
     FUNCTION_mass_coefficient_X    photon_mass_coefficient_total;
 
+    //(Optional.) Material database. Media other than water are handled here, if a data file for them was loaded.
+    FUNCTION_material_defined                    material_defined;
+    FUNCTION_material_mfp_and_which_interaction  material_mfp_and_which_interaction;
+    FUNCTION_material_coefficient_X              material_mass_coefficient_total;
+    FUNCTION_material_coefficient_X              material_mass_coefficient_transfer;
+    FUNCTION_material_coefficient_X              material_mass_coefficient_absorption;
+    FUNCTION_material_coefficient_X              material_stopping_power;  //Linear (MeV/cm), for kinetic energy T.
+    FUNCTION_material_property                   material_density;
+    FUNCTION_material_property                   material_binding_energy;
+    FUNCTION_material_property                   material_radiation_length;  //g/cm^2, or zero if the data file does not give it.
+    FUNCTION_material_property                   material_z_over_a;          //Likewise.
+
     //Voxels.
     FUNCTION_accumulate_slowdown   voxel_accumulation; 
     FUNCTION_voxel_localdump       voxel_localdump;
+    FUNCTION_voxel_deposit_track   voxel_deposit_track; //(Optional.) Spreads energy along one straight step of a charged particle track.
+    FUNCTION_voxel_safety          voxel_safety;       //(Optional.) Distance from a point to the nearest face of its voxel (or of the voxel grid.)
+    FUNCTION_voxel_new_history     voxel_new_history;  //(Optional.) Marks the start of a new primary history. Used for uncertainty estimation.
+    FUNCTION_voxel_track_kerma     voxel_track_kerma;  //(Optional.) Scores kerma along a photon flight (track-length estimator.)
 };
 
 
@@ -0,0 +1,315 @@
+//Tally.cc - In-process histogram tallies. Histograms are registered once (outside of the hot path) and filled by integer handle
+//           while the simulation runs. Each thread fills its own copy; copies are merged and written once, at the end.
+//
+//           This replaces the old workflow of writing one text line per event and binning the output afterward with the Lua
+//           scripts in Helpers/. Output goes to "/tmp/Transport_<key>.hist" (and "/tmp/Transport_<key>_x.hist", the projection
+//           onto the first axis, for 2D histograms.)
+//
+//Programming notes:
+//  -Do not make items here "const", because they will not show up when loading.
+//  -Avoid using macro variables here because they will be obliterated during loading.
+//  -Wrap dynamically-loaded code with extern "C", otherwise C++ compilation will mangle function names, etc.
+//
+// From man page for dlsym/dlopen:  For running some 'initialization' code prior to finishing loading:
+// "Instead,  libraries  should  export  routines using the __attribute__((constructor)) and __attribute__((destructor)) function attributes.  See the gcc info pages for
+//       information on these.  Constructor routines are executed before dlopen() returns, and destructor routines are executed before dlclose() returns."
+//   ---for instance, we can use this to seed a random number generator with a random seed. However, in order to pass in a specific seed (and pass that seed to the library)
+//      we need to define an explicitly callable initialization function. In general, these libraries should have both so that we can quickly adjust behaviour if desired.
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <memory>
+#include <cmath>
+#include <mutex>
+
+#include "./Misc.h"
+
+#include "./Constants.h"
+#include "./Structs.h"
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+std::string MODULE_NAME(__FILE__);
+std::string FILE_TYPE("TALLY");
+
+bool VERBOSE = false;
+bool DO_NOT_CLOBBER = false;
+
+
+//A single axis. Bins are either evenly spaced in x or in log(x).
+struct tally_axis {
+    long int N;
+    double min, max;
+    bool log;
+    double lo, scale;  //Cached: bin = floor((f(x) - lo)*scale), where f is the identity or log.
+
+    tally_axis() : N(1), min(0.0), max(1.0), log(false), lo(0.0), scale(1.0) { }
+    tally_axis(const double &in_min, const double &in_max, const long int &in_N, const bool &in_log)
+        : N(in_N), min(in_min), max(in_max), log(in_log) {
+        lo    = log ? std::log(min) : min;
+        scale = static_cast<double>(N) / ((log ? std::log(max) : max) - lo);
+    }
+
+    //Returns -1 for underflow and N for overflow.
+    long int bin(const double &x) const {
+        if(!(x >= min)) return -1; //(Also catches NaNs.)
+        if(x >= max)    return N;
+        const long int i = static_cast<long int>(((log ? std::log(x) : x) - lo)*scale);
+        return (i < N) ? i : (N - 1);
+    }
+
+    double edge(const long int &i) const {
+        const double f = lo + static_cast<double>(i)/scale;
+        return log ? std::exp(f) : f;
+    }
+};
+
+//A 1D or 2D histogram of weights. Tracks the sum of weights, the sum of squared weights, and the number of entries per bin.
+struct histogram {
+    std::string key;
+    long int dimensions;
+    tally_axis x, y;
+    std::vector<double>   sum, sum_sq;
+    std::vector<long int> count;
+    double underflow, overflow;  //Weights of entries falling outside the histogram (along any axis.)
+
+    histogram() : dimensions(0), underflow(0.0), overflow(0.0) { }
+
+    void clear(void){
+        const size_t bins = static_cast<size_t>(x.N * y.N);
+        sum.assign(bins, 0.0);
+        sum_sq.assign(bins, 0.0);
+        count.assign(bins, 0);
+        underflow = overflow = 0.0;
+        return;
+    }
+
+    void fill(const long int &i, const long int &j, const double &weight){
+        if((i < 0) || (j < 0)){
+            underflow += weight;
+        }else if((i >= x.N) || (j >= y.N)){
+            overflow += weight;
+        }else{
+            const size_t n = static_cast<size_t>(i + x.N*j);
+            sum[n]    += weight;
+            sum_sq[n] += weight*weight;
+            ++count[n];
+        }
+        return;
+    }
+
+    //Histograms with identical binning can be merged by adding bin-by-bin.
+    void merge(const histogram &in){
+        if((in.x.N != x.N) || (in.y.N != y.N)) FUNCERR("Attempted to merge histograms with differing bins for key \"" << key << "\"");
+        for(size_t n = 0; n < sum.size(); ++n){
+            sum[n]    += in.sum[n];
+            sum_sq[n] += in.sum_sq[n];
+            count[n]  += in.count[n];
+        }
+        underflow += in.underflow;
+        overflow  += in.overflow;
+        return;
+    }
+};
+
+//Registered histograms are prototypes which describe the binning. Each thread which fills a histogram gets its own (empty)
+// copy. The per-thread copies are owned here so that they outlive the threads, and are merged when written.
+std::vector<histogram> Prototypes;
+std::vector< std::unique_ptr< std::vector<histogram> > > Thread_Tallies;
+std::mutex Tally_Mutex; //Guards both of the above.
+
+thread_local std::vector<histogram> *This_Thread_Tallies = nullptr;
+
+
+
+static std::vector<histogram> & thread_tallies(const int &handle){
+    if((This_Thread_Tallies == nullptr) || (static_cast<size_t>(handle) >= This_Thread_Tallies->size())){
+        std::lock_guard<std::mutex> lock(Tally_Mutex);
+        if(This_Thread_Tallies == nullptr){
+            Thread_Tallies.push_back( std::unique_ptr< std::vector<histogram> >( new std::vector<histogram>() ) );
+            This_Thread_Tallies = Thread_Tallies.back().get();
+        }
+        //Pick up any histograms registered since this thread last looked.
+        for(size_t i = This_Thread_Tallies->size(); i < Prototypes.size(); ++i){
+            This_Thread_Tallies->push_back( Prototypes[i] );
+            This_Thread_Tallies->back().clear();
+        }
+    }
+    return *This_Thread_Tallies;
+}
+
+static int register_histogram(const histogram &in){
+    std::lock_guard<std::mutex> lock(Tally_Mutex);
+    for(size_t i = 0; i < Prototypes.size(); ++i){
+        if(Prototypes[i].key == in.key) FUNCERR("Histogram \"" << in.key << "\" was registered twice");
+    }
+    Prototypes.push_back(in);
+    Prototypes.back().clear();
+    return static_cast<int>(Prototypes.size() - 1);
+}
+
+static void check_axis(const std::string &key, const double &min, const double &max, const long int &N, const bool &log){
+    if((N <= 0) || !(max > min) || (log && !(min > 0.0))){
+        FUNCERR("Invalid binning requested for histogram \"" << key << "\": [" << min << "," << max << ") with " << N << (log ? " log" : "") << " bins");
+    }
+    return;
+}
+
+static void write_histogram(const histogram &h){
+    const std::string filename = "/tmp/Transport_" + h.key + ".hist";
+    std::fstream FO;
+    if(DO_NOT_CLOBBER){
+        FO.open(filename.c_str(), std::ifstream::in);
+        if(!FO.fail()) FUNCERR("Histogram file \"" << filename << "\" exists. Unwilling to overwrite it");
+        FO.close();
+    }
+    FO.open(filename.c_str(), std::ifstream::out);
+    if(FO.fail()) FUNCERR("Histogram file \"" << filename << "\" cannot be opened for writing");
+    FO.precision(10);
+
+    long int entries = 0;
+    double max_bin   = 0.0;
+    for(size_t n = 0; n < h.sum.size(); ++n){
+        entries += h.count[n];
+        if(h.sum[n] > max_bin) max_bin = h.sum[n];
+    }
+    const double norm = (max_bin != 0.0) ? 1.0/max_bin : 0.0;
+
+    FO << "# Transport histogram v1\n";
+    FO << "# key: " << h.key << "\n";
+    FO << "# dimensions: " << h.dimensions << "\n";
+    FO << "# x: " << h.x.N << (h.x.log ? " log" : " linear") << " bins over [" << h.x.min << "," << h.x.max << ")\n";
+    if(h.dimensions == 2) FO << "# y: " << h.y.N << (h.y.log ? " log" : " linear") << " bins over [" << h.y.min << "," << h.y.max << ")\n";
+    FO << "# entries: " << entries << "   underflow weight: " << h.underflow << "   overflow weight: " << h.overflow << "\n";
+    if(h.dimensions == 1){
+        FO << "#   x_low   x_high   sum_of_weights   sum_of_squared_weights   entries   (sum normalized to the maximum bin)\n";
+    }else{
+        FO << "#   x_low   x_high   y_low   y_high   sum_of_weights   sum_of_squared_weights   entries   (sum normalized to the maximum bin)\n";
+    }
+
+    for(long int j = 0; j < h.y.N; ++j){
+        for(long int i = 0; i < h.x.N; ++i){
+            const size_t n = static_cast<size_t>(i + h.x.N*j);
+            FO << h.x.edge(i) << " " << h.x.edge(i+1) << " ";
+            if(h.dimensions == 2) FO << h.y.edge(j) << " " << h.y.edge(j+1) << " ";
+            FO << h.sum[n] << " " << h.sum_sq[n] << " " << h.count[n] << " " << h.sum[n]*norm << "\n";
+        }
+        if(h.dimensions == 2) FO << "\n"; //Blank lines between rows make the output directly usable with gnuplot's splot.
+    }
+    FO.close();
+    if(VERBOSE) FUNCINFO("Wrote histogram \"" << filename << "\"");
+
+    //For 2D histograms, also write the projection onto the first axis (i.e., integrated over the second.)
+    if(h.dimensions == 2){
+        histogram p;
+        p.key        = h.key + "_x";
+        p.dimensions = 1;
+        p.x          = h.x;
+        p.clear();
+        for(long int j = 0; j < h.y.N; ++j){
+            for(long int i = 0; i < h.x.N; ++i){
+                const size_t n = static_cast<size_t>(i + h.x.N*j);
+                p.sum[i]    += h.sum[n];
+                p.sum_sq[i] += h.sum_sq[n];
+                p.count[i]  += h.count[n];
+            }
+        }
+        p.underflow = h.underflow;
+        p.overflow  = h.overflow;
+        write_histogram(p);
+    }
+    return;
+}
+
+//Merges all per-thread copies and writes each histogram. Safe to call more than once (though only the first call writes.)
+static void write_all_histograms(void){
+    std::lock_guard<std::mutex> lock(Tally_Mutex);
+    for(size_t i = 0; i < Prototypes.size(); ++i){
+        histogram total = Prototypes[i];
+        for(auto &t : Thread_Tallies){
+            if(i < t->size()) total.merge( (*t)[i] );
+        }
+        write_histogram(total);
+    }
+    Prototypes.clear();
+    Thread_Tallies.clear();
+    return;
+}
+
+//Global objects are destroyed *before* the __attribute__((destructor)) cleanup runs when the program exits normally, so the
+// histograms must be written from the destructor of an object defined after them.
+struct shutdown_guard {
+    ~shutdown_guard(){ write_all_histograms(); }
+} Shutdown_Guard;
+
+
+#ifdef __GNUG__
+    __attribute__((constructor)) static void init_on_dynamic_load(void){
+        //Do something automatic here.
+        if(VERBOSE) FUNCINFO("Loaded lib_tally.so");
+        return;
+    }
+
+    __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
+        //Cleanup memory (if needed) automatically here.
+        if(VERBOSE) FUNCINFO("Closed lib_tally.so");
+
+        //Histograms are written by Shutdown_Guard (see above.)
+        return;
+    }
+#else
+    #warning Being compiled with non-gcc compiler. Unable to use gcc-specific function declarations like 'attribute.' Proceed at your own risk!
+#endif
+
+void toggle_verbosity(bool in){
+    VERBOSE = in;
+    return;
+}
+
+
+//Registers a 1D histogram. Returns the handle to use with tally_fill(). Not meant to be called in the hot path!
+int tally_histogram_1D(const std::string &key, const double &xmin, const double &xmax, const long int &xbins, const bool &xlog){
+    check_axis(key, xmin, xmax, xbins, xlog);
+    histogram h;
+    h.key        = key;
+    h.dimensions = 1;
+    h.x          = tally_axis(xmin, xmax, xbins, xlog);
+    return register_histogram(h);
+}
+
+//Registers a 2D histogram. Returns the handle to use with tally_fill_2D(). Not meant to be called in the hot path!
+int tally_histogram_2D(const std::string &key, const double &xmin, const double &xmax, const long int &xbins, const bool &xlog,
+                                               const double &ymin, const double &ymax, const long int &ybins, const bool &ylog){
+    check_axis(key, xmin, xmax, xbins, xlog);
+    check_axis(key, ymin, ymax, ybins, ylog);
+    histogram h;
+    h.key        = key;
+    h.dimensions = 2;
+    h.x          = tally_axis(xmin, xmax, xbins, xlog);
+    h.y          = tally_axis(ymin, ymax, ybins, ylog);
+    return register_histogram(h);
+}
+
+void tally_fill(const int &handle, const double &x, const double &weight){
+    histogram &h = thread_tallies(handle)[handle];
+    h.fill(h.x.bin(x), 0, weight);
+    return;
+}
+
+void tally_fill_2D(const int &handle, const double &x, const double &y, const double &weight){
+    histogram &h = thread_tallies(handle)[handle];
+    h.fill(h.x.bin(x), h.y.bin(y), weight);
+    return;
+}
+
+
+#ifdef __cplusplus
+    }
+#endif
+
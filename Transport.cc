@@ -5,6 +5,8 @@
 #include <vector>
 #include <string>
 #include <getopt.h>      //Needed for 'getopts' argument parsing.
+#include <thread>
+#include <atomic>
 
 //#include <random>     //We use this for PRNG's. Not actually needed here?
 
@@ -25,9 +27,19 @@ const std::string VERSION("0.0.1 - Extreme Beta Version - Use at your own risk!"
 
 //Passed in as arguments.
 long int random_seed = 12345677; //Pick a prime
+long int gantry_angles = 1;       //Number of CT gantry angles to simulate. Each angle gets the full number of particles.
+long int numb_of_threads = 1;     //Number of threads to distribute gantry angles over.
+double forced_interaction_depth = 0.0; //Photons are forced to interact in regions less than this many mean free paths across. Zero disables.
+bool kerma_approximation = false; //Photon-only transport. Interaction modules score the energy given to charged particles on the spot.
+long int recycle_count = 1;       //Number of times each history is scored in the voxel tally. Extra copies are replayed, not simulated.
+bool recyclable_geometry = false; //Set by geometries which look the same from every beam entry point (see HISTORIES_RECYCLABLE.)
+bool approximate_recycling = false; //Set by recyclable geometries which only nearly look the same (see HISTORIES_RECYCLING_APPROXIMATE.)
 std::vector<void *> open_libraries;  //Keeps track of opened libraries. We need to keep them open until we are done.
 unsigned char beam_type; //Which type of particle should come from the beam source. Types are listed in Constants.cc.
 double smallest_feature = 0.1;     //The smallest feature in the geometry - useful for transporting particles through a vacuum in a sensible way. This is overwritten by geometry, if it exists in the module!
+double boundary_step_over = 1E-9;  //When a geometry reports distances to boundaries, particles are moved this far past the boundary so they land in the next material.
+const size_t vacuum_lookahead = 16; //Number of smallest_feature-length steps checked at once when crossing vacuum without a distance_to_boundary routine.
+long int max_split = 16;           //Upper limit on the number of photons one photon is split into at once, when the geometry provides importances.
 
 
 //----------------------------------------------------------------------------------------------------
@@ -40,6 +52,8 @@ FUNCTION_energy_distribution  beam_energy_distribution; //The beam-source energy
 FUNCTION_set_position         set_beam_position; //Lets us adjust the beam source outlet (ie. the source point.)
 FUNCTION_get_orientation      get_new_orientation; //Gets a new orientation unit vector for a particle ejected from the source outlet. (holds the angular distribution of the source).
 FUNCTION_random_orientation   get_random_orientation; //Gets a uniformly-distributed orientation unit vector3.
+FUNCTION_init_explicit_seed   PRNG_seed; //(Re-)seeds the calling thread's generator.
+FUNCTION_set_gantry_angle     set_gantry_angle; //(Optional.) Rotates the geometry's gantry for the calling thread.
 //FUNCTION_geometry_type        which_material; //Returns the char value corresponding to the material at a point in space.
 FUNCTION_particle_factory     photon_factory; //Derived class factory function - creates a Photon class instance on the heap.
 //FUNCTION_particle_factory     positron_factory;
@@ -57,9 +71,15 @@ FUNCTION_scatter_routine      scatter_compton; //Implements the Compton scatteri
 FUNCTION_scatter_routine      scatter_photoelectric; //Implements the photoelectric effect ("scatter") routine. 
 FUNCTION_scatter_routine      scatter_pair;  //Implements the Pair production scattering routine.
 FUNCTION_scatter_routine      scatter_localdump; //Implements the local energy dump ("scatter") routine. 
+FUNCTION_scatter_routine      scatter_annihilation; //(Optional.) Annihilates a stopping positron into two photons. Otherwise positrons are local-dumped.
 FUNCTION_scatter_routine      scatter_slowdown; //Implements a CSDA charged particle slow-down, swallows the particle.
+FUNCTION_scatter_routine      scatter_condensed_history; //(Optional.) Condensed-history charged particle transport. Used in place of scatter_slowdown.
 FUNCTION_scatter_routine      scatter_none;  //Implements a 'virtual' interaction where nothing happens.
 FUNCTION_scatter_routine      scatter_detect; //Implements a detector event - particle has hit a detector.
+FUNCTION_detector_begin_row   detector_begin_row; //(Optional.) Starts a new sinogram row (i.e., gantry angle) in the detector tally.
+FUNCTION_detector_end_row     detector_end_row;   //(Optional.) Finishes the current sinogram row and writes it.
+FUNCTION_detector_forced      detector_forced;    //(Optional.) Forced detection: scores each Compton event's expected detector contributions.
+FUNCTION_voxel_recycle        voxel_recycle;      //(Optional.) Replays the current history's voxel scores from other beam entry points.
 
 //Testing - Water/Photons.
 FUNCTION_mass_coefficient_X   compton_mass_attenuation;
@@ -72,6 +92,12 @@ FUNCTION_mass_coefficient_X   photoelectric_mass_attenuation;
 // so as to make function calling as homogeneous as possible.)
 struct Functions  Loaded_Funcs;
 
+//Classifies arrays of points with the scalar geometry_type. Used for geometries which do not provide a batched version.
+static void which_materials_scalar(const double *x, const double *y, const double *z, unsigned char *material, const size_t &N){
+    for(size_t i=0; i<N; ++i) material[i] = Loaded_Funcs.which_material(vec3<double>(x[i], y[i], z[i]));
+    return;
+}
+
 //----------------------------------------------------------------------------------------------------
 //------------------------------------- Entry into program here --------------------------------------
 //----------------------------------------------------------------------------------------------------
@@ -99,7 +125,7 @@ int main(int argc, char *argv[]){
     //---------------------------------------------------------------------------------------------------------------------
     //These are fairly common options. Run the program with -h to see them formatted properly.
     int next_options;
-    const char* const short_options    = "hVvp:s:";  //This is the list of short, single-letter options.
+    const char* const short_options    = "hVvp:s:a:t:f:kr:";  //This is the list of short, single-letter options.
                                                      //The : denotes a value passed in with the option.
     //This is the list of long options. Columns:  Name, BOOL: takes_value?, NULL, Map to short options.
     const struct option long_options[] = { { "help",        0, NULL, 'h' },
@@ -107,6 +133,11 @@ int main(int argc, char *argv[]){
                                            { "verbose",     0, NULL, 'v' },
                                            { "particles",   1, NULL, 'p' },
                                            { "seed",        1, NULL, 's' },
+                                           { "angles",      1, NULL, 'a' },
+                                           { "threads",     1, NULL, 't' },
+                                           { "force",       1, NULL, 'f' },
+                                           { "kerma",       0, NULL, 'k' },
+                                           { "recycle",     1, NULL, 'r' },
                                            { NULL,          0, NULL, 0   }  };
 
     do{
@@ -123,6 +154,15 @@ int main(int argc, char *argv[]){
                 std::cout << "   -v                 --verbose             <false>         Spit out info about what the program is doing." << std::endl;
                 std::cout << "   -p < # >           --particles           <none>          Number of particles to use, if appropriate. (Required.)" << std::endl;
                 std::cout << "   -s < seed >        --seed                <varies>        Seed value. Takes any input." << std::endl;
+                std::cout << "   -a < # >           --angles              <1>             Number of CT gantry angles to simulate, spread over 360 degrees." << std::endl;
+                std::cout << "                                                            Each angle uses the full number of particles. (Needs a rotatable geometry.)" << std::endl;
+                std::cout << "   -t < # >           --threads             <1>             Number of threads to distribute gantry angles over." << std::endl;
+                std::cout << "   -f < # >           --force               <0>             Force photons to interact in regions thinner than this many mean" << std::endl;
+                std::cout << "                                                            free paths. Useful for thin slabs. (Needs distance_to_boundary.)" << std::endl;
+                std::cout << "   -k                 --kerma               <false>         Kerma approximation: transport photons only and score the energy" << std::endl;
+                std::cout << "                                                            given to electrons and positrons where they are set in motion." << std::endl;
+                std::cout << "   -r < # >           --recycle             <1>             Score each history this many times in the voxel tally, replaying it" << std::endl;
+                std::cout << "                                                            from other beam entry points. (Needs a recyclable geometry.)" << std::endl;
                 std::cout << std::endl;
                 return 0;
                 break;
@@ -148,6 +188,26 @@ int main(int argc, char *argv[]){
                 } 
                 break;
 
+            case 'a':
+                gantry_angles = stringtoX<long int>( optarg );
+                break;
+
+            case 't':
+                numb_of_threads = stringtoX<long int>( optarg );
+                break;
+
+            case 'f':
+                forced_interaction_depth = stringtoX<double>( optarg );
+                break;
+
+            case 'k':
+                kerma_approximation = true;
+                break;
+
+            case 'r':
+                recycle_count = stringtoX<long int>( optarg );
+                break;
+
         }
     }while(next_options != -1);
 
@@ -163,6 +223,12 @@ int main(int argc, char *argv[]){
     //------------------------------------------------ Option handling ----------------------------------------------------
     //---------------------------------------------------------------------------------------------------------------------
     if(numb_of_particles == 0) FUNCERR("Number of particles to run (-p) is required for this simulation.");
+    if(gantry_angles < 1)      FUNCERR("Number of gantry angles (-a) must be at least one.");
+    if(numb_of_threads < 1)    FUNCERR("Number of threads (-t) must be at least one.");
+    if(forced_interaction_depth < 0.0) FUNCERR("Interaction forcing depth (-f) cannot be negative.");
+    if(numb_of_threads > gantry_angles) numb_of_threads = gantry_angles; //Angles are the unit of work.
+    if(recycle_count < 1)      FUNCERR("History recycling count (-r) must be at least one.");
+    if((recycle_count > 1) && (numb_of_threads > 1)) FUNCERR("History recycling (-r) cannot be used with several threads.");
 
     //Sort out which particle cache schedule to use based on the number of particles.
     numb_of_loop_multiplications = 1;
@@ -184,13 +250,17 @@ int main(int argc, char *argv[]){
     libraries.push_back("./lib_pair.so");
     libraries.push_back("./lib_no_interaction.so");
     libraries.push_back("./lib_localdump.so");
+    libraries.push_back("./lib_annihilation.so");
     libraries.push_back("./lib_slowdown.so");
+    libraries.push_back("./lib_condensed_history.so"); //Replaces the (straight-line) SlowDown routine, if present.
 //    libraries.push_back("./lib_water_fitted.so");  //Don't use - haven't updated since adding absorption, transfer,one_minus_g, etc..
     libraries.push_back("./lib_water_csplines.so");
 //    libraries.push_back("./lib_water_linear.so");  //Don't use - haven't updated since adding absorption, transfer,one_minus_g, etc..
+    libraries.push_back("./lib_materials.so");       //Media other than water. Reads the data files in ./Materials/.
     libraries.push_back("./lib_logging.so");
     libraries.push_back("./lib_detect.so");          //Not actually needed, but needs to be here for sanity checks. This situation should be handled with a toggle switch. (HAS_DETECTOR?)
     libraries.push_back("./lib_voxel_mapping.so");
+    libraries.push_back("./lib_tally.so");
 
 /*
 //------------ Infinite Water tank setup ---------------
@@ -220,6 +290,13 @@ int main(int argc, char *argv[]){
 */
 
 
+/*
+//------------ CSG scene geometry (see Geometry_CSG.scene) ------------
+    libraries.push_back("./lib_beam_6MV.so");
+    libraries.push_back("./lib_geometry_csg.so");
+*/
+
+
     FUNCINFO("Proceeding with random seed " << random_seed ); 
     FUNCINFO("Proceeding with " << numb_of_particles << " particles (using " << particles_per_loop << " per loop.)");
 
@@ -249,6 +326,12 @@ int main(int argc, char *argv[]){
                 loaded_function( VERBOSE );
             } 
 
+            //Interaction modules which create charged particles can score their energy on the spot instead.
+            if(check_for_item_in_library( loaded_library, "toggle_kerma_approximation")){
+                FUNCTION_toggle_kerma_approximation_t loaded_function = reinterpret_cast<FUNCTION_toggle_kerma_approximation_t>(load_item_from_library(loaded_library, "toggle_kerma_approximation") );
+                loaded_function( kerma_approximation );
+            }
+
             //Load the file type identifier string.
             if(check_for_item_in_library( loaded_library, "FILE_TYPE")){
                 FileType = *reinterpret_cast<std::string *>(load_item_from_library(loaded_library, "FILE_TYPE"));
@@ -273,7 +356,7 @@ int main(int argc, char *argv[]){
             if(FileType == "PRNG"){
                 //Seed the generator. It will be randomly (non-reproduceably) seeded otherwise.
                 if(check_for_item_in_library( loaded_library, "init_explicit_seed")){
-                    FUNCTION_init_explicit_seed PRNG_seed = reinterpret_cast<FUNCTION_init_explicit_seed>(load_item_from_library(loaded_library, "init_explicit_seed") );
+                    PRNG_seed = reinterpret_cast<FUNCTION_init_explicit_seed>(load_item_from_library(loaded_library, "init_explicit_seed") );
                     PRNG_seed(random_seed);
                 }
    
@@ -327,6 +410,55 @@ int main(int argc, char *argv[]){
                     Loaded_Funcs.which_material = reinterpret_cast<FUNCTION_geometry_type>(load_item_from_library(loaded_library, "geometry_type") );
                 }
 
+                //Grab the (optional) batched version. If absent, a scalar loop is substituted below.
+                if(check_for_item_in_library( loaded_library, "geometry_type_batch")){
+                    Loaded_Funcs.which_materials = reinterpret_cast<FUNCTION_geometry_type_batch>(load_item_from_library(loaded_library, "geometry_type_batch") );
+                }
+
+                //Grab the (optional) gantry rotation routine.
+                if(check_for_item_in_library( loaded_library, "set_gantry_angle")){
+                    set_gantry_angle = reinterpret_cast<FUNCTION_set_gantry_angle>(load_item_from_library(loaded_library, "set_gantry_angle") );
+                }
+
+                //Grab the (optional) detector cell lookup, for geometries with a segmented detector.
+                if(check_for_item_in_library( loaded_library, "detector_cell")
+                && check_for_item_in_library( loaded_library, "detector_cell_count")){
+                    Loaded_Funcs.detector_cell       = reinterpret_cast<FUNCTION_detector_cell>(load_item_from_library(loaded_library, "detector_cell") );
+                    Loaded_Funcs.detector_cell_count = reinterpret_cast<FUNCTION_detector_cell_count>(load_item_from_library(loaded_library, "detector_cell_count") );
+                }
+                if(check_for_item_in_library( loaded_library, "detector_cell_face")){
+                    Loaded_Funcs.detector_cell_face = reinterpret_cast<FUNCTION_detector_cell_face>(load_item_from_library(loaded_library, "detector_cell_face") );
+                }
+
+                //Grab the (optional) distance-to-boundary routine. When present, vacuum is crossed in a single step and particles
+                // stop at material interfaces.
+                if(check_for_item_in_library( loaded_library, "distance_to_boundary")){
+                    Loaded_Funcs.distance_to_boundary = reinterpret_cast<FUNCTION_distance_to_boundary>(load_item_from_library(loaded_library, "distance_to_boundary") );
+                }
+
+                //Grab the (optional) isotropic safety distance routine. Used for charged particle range rejection.
+                if(check_for_item_in_library( loaded_library, "safety_distance")){
+                    Loaded_Funcs.safety_distance = reinterpret_cast<FUNCTION_safety_distance>(load_item_from_library(loaded_library, "safety_distance") );
+                }
+
+                //Grab the (optional) region importance routine. Used for photon splitting and Russian roulette.
+                if(check_for_item_in_library( loaded_library, "importance")){
+                    Loaded_Funcs.importance = reinterpret_cast<FUNCTION_importance>(load_item_from_library(loaded_library, "importance") );
+                }
+
+                //Grab the (optional) exponential transform routine. Used to stretch photon flights along a direction.
+                if(check_for_item_in_library( loaded_library, "exponential_transform")){
+                    Loaded_Funcs.exponential_transform = reinterpret_cast<FUNCTION_exponential_transform>(load_item_from_library(loaded_library, "exponential_transform") );
+                }
+
+                //Whether histories may be replayed from other beam entry points. Only true for geometries which look the same from each.
+                if(check_for_item_in_library( loaded_library, "HISTORIES_RECYCLABLE")){
+                    recyclable_geometry = *reinterpret_cast<bool *>(load_item_from_library(loaded_library, "HISTORIES_RECYCLABLE"));
+                }
+                if(check_for_item_in_library( loaded_library, "HISTORIES_RECYCLING_APPROXIMATE")){
+                    approximate_recycling = *reinterpret_cast<bool *>(load_item_from_library(loaded_library, "HISTORIES_RECYCLING_APPROXIMATE"));
+                }
+
                 //Update the smallest_feature to that of the geometry. This will help set the length scale for vacuum transport.
                 if(check_for_item_in_library( loaded_library, "SMALLEST_FEATURE")){
                     smallest_feature = *reinterpret_cast<double *>(load_item_from_library(loaded_library, "SMALLEST_FEATURE"));
@@ -397,6 +529,39 @@ int main(int argc, char *argv[]){
                 }
 
 
+            //---------------------------------- Set up the material database ----------------------------------
+            }else if(MediumType == "DATABASE"){
+                if(check_for_item_in_library( loaded_library, "material_defined")
+                && check_for_item_in_library( loaded_library, "material_mfp_and_which_interaction")){
+                    Loaded_Funcs.material_defined = reinterpret_cast<FUNCTION_material_defined>(load_item_from_library(loaded_library, "material_defined") );
+                    Loaded_Funcs.material_mfp_and_which_interaction = reinterpret_cast<FUNCTION_material_mfp_and_which_interaction>(load_item_from_library(loaded_library, "material_mfp_and_which_interaction") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_mass_coefficient_total")){
+                    Loaded_Funcs.material_mass_coefficient_total = reinterpret_cast<FUNCTION_material_coefficient_X>(load_item_from_library(loaded_library, "material_mass_coefficient_total") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_mass_coefficient_transfer")){
+                    Loaded_Funcs.material_mass_coefficient_transfer = reinterpret_cast<FUNCTION_material_coefficient_X>(load_item_from_library(loaded_library, "material_mass_coefficient_transfer") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_mass_coefficient_absorption")){
+                    Loaded_Funcs.material_mass_coefficient_absorption = reinterpret_cast<FUNCTION_material_coefficient_X>(load_item_from_library(loaded_library, "material_mass_coefficient_absorption") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_stopping_power")){
+                    Loaded_Funcs.material_stopping_power = reinterpret_cast<FUNCTION_material_coefficient_X>(load_item_from_library(loaded_library, "material_stopping_power") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_density")){
+                    Loaded_Funcs.material_density = reinterpret_cast<FUNCTION_material_property>(load_item_from_library(loaded_library, "material_density") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_binding_energy")){
+                    Loaded_Funcs.material_binding_energy = reinterpret_cast<FUNCTION_material_property>(load_item_from_library(loaded_library, "material_binding_energy") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_radiation_length")){
+                    Loaded_Funcs.material_radiation_length = reinterpret_cast<FUNCTION_material_property>(load_item_from_library(loaded_library, "material_radiation_length") );
+                }
+                if(check_for_item_in_library( loaded_library, "material_z_over_a")){
+                    Loaded_Funcs.material_z_over_a = reinterpret_cast<FUNCTION_material_property>(load_item_from_library(loaded_library, "material_z_over_a") );
+                }
+
+
             //--------------------------------- Set up the photon functions ------------------------------------
             }else if(ParticleType == "PHOTON"){
                 //Grab the Photon particle class factory function. (It polymorphs the base_particle class!)
@@ -437,6 +602,12 @@ int main(int argc, char *argv[]){
                     scatter_slowdown = reinterpret_cast<FUNCTION_scatter_routine>(load_item_from_library(loaded_library, "scatter") );
                 }
 
+            //----------------------------- Set up the condensed-history functions ------------------------------
+            }else if(InteractionType == "CONDENSED_HISTORY"){
+                if(check_for_item_in_library( loaded_library, "scatter")){
+                    scatter_condensed_history = reinterpret_cast<FUNCTION_scatter_routine>(load_item_from_library(loaded_library, "scatter") );
+                }
+
 
             //---------------------------- Set up the Photoelectric effect functions --------------------------------
             }else if(InteractionType == "PHOTOELECTRIC"){
@@ -475,6 +646,15 @@ int main(int argc, char *argv[]){
                     scatter_localdump = reinterpret_cast<FUNCTION_scatter_routine>(load_item_from_library(loaded_library, "scatter") );
                 }
 
+            }else if(InteractionType == "ANNIHILATION"){
+                //Grab the positron annihilation routine, and the photon emission routine the charged particle routines use.
+                if(check_for_item_in_library( loaded_library, "scatter")){
+                    scatter_annihilation = reinterpret_cast<FUNCTION_scatter_routine>(load_item_from_library(loaded_library, "scatter") );
+                }
+                if(check_for_item_in_library( loaded_library, "annihilation_photons")){
+                    Loaded_Funcs.annihilation_photons = reinterpret_cast<FUNCTION_annihilation_photons>(load_item_from_library(loaded_library, "annihilation_photons") );
+                }
+
             //---------------------------- Set up the Detection scatter functions --------------------------------
             }else if(InteractionType == "DETECTION"){
                 //Grab the detection scattering routine.
@@ -482,6 +662,18 @@ int main(int argc, char *argv[]){
                     scatter_detect = reinterpret_cast<FUNCTION_scatter_routine>(load_item_from_library(loaded_library, "scatter") );
                 }
 
+                //Grab the (optional) sinogram row routines.
+                if(check_for_item_in_library( loaded_library, "detector_begin_row")
+                && check_for_item_in_library( loaded_library, "detector_end_row")){
+                    detector_begin_row = reinterpret_cast<FUNCTION_detector_begin_row>(load_item_from_library(loaded_library, "detector_begin_row") );
+                    detector_end_row   = reinterpret_cast<FUNCTION_detector_end_row>(load_item_from_library(loaded_library, "detector_end_row") );
+                }
+
+                //Grab the (optional) forced detection routine.
+                if(check_for_item_in_library( loaded_library, "detector_forced")){
+                    detector_forced = reinterpret_cast<FUNCTION_detector_forced>(load_item_from_library(loaded_library, "detector_forced") );
+                }
+
 
             //---------------------------- Set up the logging routines --------------------------------
             }else if(FileType == "LOGGING"){
@@ -495,6 +687,33 @@ int main(int argc, char *argv[]){
                     Loaded_Funcs.generic_logging = reinterpret_cast<FUNCTION_generic_logging>(load_item_from_library(loaded_library, "logging_generic") );
                 }
 
+                //Grab the handle-based text logging functions.
+                if(check_for_item_in_library( loaded_library, "logging_channel")
+                && check_for_item_in_library( loaded_library, "logging_by_channel")){
+                    Loaded_Funcs.logging_channel    = reinterpret_cast<FUNCTION_logging_channel>(load_item_from_library(loaded_library, "logging_channel") );
+                    Loaded_Funcs.logging_by_channel = reinterpret_cast<FUNCTION_logging_by_channel>(load_item_from_library(loaded_library, "logging_by_channel") );
+                }
+
+                //Grab the (optional) binary logging functions.
+                if(check_for_item_in_library( loaded_library, "logging_binary_channel")
+                && check_for_item_in_library( loaded_library, "logging_binary_record")){
+                    Loaded_Funcs.binary_logging_channel = reinterpret_cast<FUNCTION_binary_logging_channel>(load_item_from_library(loaded_library, "logging_binary_channel") );
+                    Loaded_Funcs.binary_logging_record  = reinterpret_cast<FUNCTION_binary_logging_record>(load_item_from_library(loaded_library, "logging_binary_record") );
+                }
+
+
+            //---------------------------- Set up the tally routines --------------------------------
+            }else if(FileType == "TALLY"){
+                if(check_for_item_in_library( loaded_library, "tally_histogram_1D")
+                && check_for_item_in_library( loaded_library, "tally_histogram_2D")
+                && check_for_item_in_library( loaded_library, "tally_fill")
+                && check_for_item_in_library( loaded_library, "tally_fill_2D")){
+                    Loaded_Funcs.tally_histogram_1D = reinterpret_cast<FUNCTION_tally_histogram_1D>(load_item_from_library(loaded_library, "tally_histogram_1D") );
+                    Loaded_Funcs.tally_histogram_2D = reinterpret_cast<FUNCTION_tally_histogram_2D>(load_item_from_library(loaded_library, "tally_histogram_2D") );
+                    Loaded_Funcs.tally_fill         = reinterpret_cast<FUNCTION_tally_fill>(load_item_from_library(loaded_library, "tally_fill") );
+                    Loaded_Funcs.tally_fill_2D      = reinterpret_cast<FUNCTION_tally_fill_2D>(load_item_from_library(loaded_library, "tally_fill_2D") );
+                }
+
 
             //---------------------------- Set up the voxel routines --------------------------------
             }else if(FileType == "VOXEL"){
@@ -508,6 +727,31 @@ int main(int argc, char *argv[]){
                     Loaded_Funcs.voxel_localdump = reinterpret_cast<FUNCTION_voxel_localdump>(load_item_from_library(loaded_library, "voxel_localdump") );
                 }
 
+                //Grab the (optional) track-step routine. Required by the condensed-history module.
+                if(check_for_item_in_library( loaded_library, "voxel_deposit_track")){
+                    Loaded_Funcs.voxel_deposit_track = reinterpret_cast<FUNCTION_voxel_deposit_track>(load_item_from_library(loaded_library, "voxel_deposit_track") );
+                }
+
+                //Grab the (optional) voxel safety routine. Used for charged particle range rejection.
+                if(check_for_item_in_library( loaded_library, "voxel_safety")){
+                    Loaded_Funcs.voxel_safety = reinterpret_cast<FUNCTION_voxel_safety>(load_item_from_library(loaded_library, "voxel_safety") );
+                }
+
+                //Grab the (optional) history marker routine. Used for history-by-history uncertainty estimation.
+                if(check_for_item_in_library( loaded_library, "voxel_new_history")){
+                    Loaded_Funcs.voxel_new_history = reinterpret_cast<FUNCTION_voxel_new_history>(load_item_from_library(loaded_library, "voxel_new_history") );
+                }
+
+                //Grab the (optional) track-length kerma routine.
+                if(check_for_item_in_library( loaded_library, "voxel_track_kerma")){
+                    Loaded_Funcs.voxel_track_kerma = reinterpret_cast<FUNCTION_voxel_track_kerma>(load_item_from_library(loaded_library, "voxel_track_kerma") );
+                }
+
+                //Grab the (optional) history recycling routine.
+                if(check_for_item_in_library( loaded_library, "voxel_recycle")){
+                    voxel_recycle = reinterpret_cast<FUNCTION_voxel_recycle>(load_item_from_library(loaded_library, "voxel_recycle") );
+                }
+
             }
 
         }else{
@@ -515,6 +759,17 @@ int main(int argc, char *argv[]){
         }
 
     }   
+
+    //Now that everything is loaded, let modules resolve their logging channel keys into handles. Keys are not looked up
+    // again after this point.
+    if((Loaded_Funcs.logging_channel != NULL) && (Loaded_Funcs.logging_by_channel != NULL)){
+        for(void *loaded_library : open_libraries){
+            if(check_for_item_in_library( loaded_library, "resolve_logging_handles")){
+                FUNCTION_resolve_logging_handles resolve = reinterpret_cast<FUNCTION_resolve_logging_handles>(load_item_from_library(loaded_library, "resolve_logging_handles") );
+                resolve( Loaded_Funcs );
+            }
+        }
+    }
  
 
 
@@ -539,12 +794,15 @@ int main(int argc, char *argv[]){
           || (Loaded_Funcs.electron_factory == NULL )
           || (Loaded_Funcs.positron_factory == NULL )
           || (Loaded_Funcs.particle_graveyard == NULL )
+          || (Loaded_Funcs.logging_channel == NULL )
+          || (Loaded_Funcs.logging_by_channel == NULL )
           || (scatter_coherent == NULL )
           || (scatter_photoelectric == NULL )
           || (scatter_compton == NULL )
           || (scatter_pair == NULL )
           || (scatter_localdump == NULL )
           || (scatter_slowdown == NULL )
+          || ((scatter_condensed_history != NULL) && (Loaded_Funcs.voxel_deposit_track == NULL))
           || (scatter_detect == NULL )
           || (scatter_none == NULL )
           || (which_interaction_water == NULL )
@@ -565,6 +823,21 @@ int main(int argc, char *argv[]){
         FUNCERR("Do not have necessary information to continue - check modules were loaded properly");
     }
 
+    if(Loaded_Funcs.which_materials == NULL) Loaded_Funcs.which_materials = which_materials_scalar;
+
+    if((forced_interaction_depth > 0.0) && (Loaded_Funcs.distance_to_boundary == NULL)){
+        FUNCERR("Interaction forcing (-f) needs a geometry which provides distance_to_boundary");
+    }
+    if((recycle_count > 1) && !recyclable_geometry){
+        FUNCERR("History recycling (-r) needs a geometry which looks the same from every beam entry point, e.g. Inf_Water or Water_Tank");
+    }
+    if((recycle_count > 1) && approximate_recycling){
+        FUNCWARN("History recycling (-r) is only approximate in this geometry. Replayed histories ignore its edges, so doses near them will be biased");
+    }
+    if((recycle_count > 1) && ((voxel_recycle == NULL) || (Loaded_Funcs.voxel_new_history == NULL))){
+        FUNCERR("History recycling (-r) needs a voxel module which provides voxel_recycle and voxel_new_history");
+    }
+
     //----------------------------------------------------------------------------------------------------
     //----------------------------------- Bind functions, if desired -------------------------------------
     //----------------------------------------------------------------------------------------------------
@@ -646,216 +919,502 @@ int main(int argc, char *argv[]){
     }
 
 
+    //Resolve logging channels (or histograms) once, up front, so that the hot path only deals with integer handles.
+    // Binary records are tightly-packed doubles (see the channel's file header for the record size.) Per-event records (text or
+    // binary) end with the photon's weight, which is not 1 once splitting, roulette, or interaction forcing is in play.
+    //
+    // Histograms are binned in-process and replace the per-event output entirely. The 6MV dose histogram is binned in depth
+    // and photon energy, weighted by E*mu(E)*<Eabs>(E); its projection onto depth is the (unnormalized) percent-depth dose.
+    const bool use_histograms  = LoggingQuantities::HistogramEventLogs && (Loaded_Funcs.tally_histogram_1D != NULL)
+                                                                       && (Loaded_Funcs.tally_histogram_2D != NULL);
+    const bool use_binary_logs = !use_histograms && LoggingQuantities::BinaryEventLogs && (Loaded_Funcs.binary_logging_channel != NULL) 
+                                                                                       && (Loaded_Funcs.binary_logging_record  != NULL);
+    int handle_PD_Kerma_1MeV = -1, handle_PD_Kerma_10MeV = -1, handle_PD_Dose_6MV = -1;
+    if(use_histograms){
+        if(LoggingQuantities::PDK_1MEV)  handle_PD_Kerma_1MeV  = Loaded_Funcs.tally_histogram_1D("PD_Kerma_1MeV",  0.0, 100.0, 1000, false);
+        if(LoggingQuantities::PDK_10MEV) handle_PD_Kerma_10MeV = Loaded_Funcs.tally_histogram_1D("PD_Kerma_10MeV", 0.0, 100.0, 1000, false);
+        if(LoggingQuantities::PDD_6MV)   handle_PD_Dose_6MV    = Loaded_Funcs.tally_histogram_2D("PD_Dose_6MV",    0.0, 100.0, 1000, false,
+                                                                                                                    1E-3,  10.0,   50, true);
+    }else if(use_binary_logs){
+        if(LoggingQuantities::PDK_1MEV)  handle_PD_Kerma_1MeV  = Loaded_Funcs.binary_logging_channel("PD_Kerma_1MeV",  2*sizeof(double)); // depth, weight.
+        if(LoggingQuantities::PDK_10MEV) handle_PD_Kerma_10MeV = Loaded_Funcs.binary_logging_channel("PD_Kerma_10MeV", 2*sizeof(double)); // depth, weight.
+        if(LoggingQuantities::PDD_6MV)   handle_PD_Dose_6MV    = Loaded_Funcs.binary_logging_channel("PD_Dose_6MV",    4*sizeof(double)); // depth, E, mu*<Eabs>, weight.
+    }else{
+        if(LoggingQuantities::PDK_1MEV)  handle_PD_Kerma_1MeV  = Loaded_Funcs.logging_channel("PD_Kerma_1MeV");
+        if(LoggingQuantities::PDK_10MEV) handle_PD_Kerma_10MeV = Loaded_Funcs.logging_channel("PD_Kerma_10MeV");
+        if(LoggingQuantities::PDD_6MV)   handle_PD_Dose_6MV    = Loaded_Funcs.logging_channel("PD_Dose_6MV");
+    }
+
     //----------------------------------------------------------------------------------------------------
     //------------------------------------- Perform the simulation ---------------------------------------
     //----------------------------------------------------------------------------------------------------
-
-    for(long int loop_multiplier=0; loop_multiplier<numb_of_loop_multiplications; ++loop_multiplier){ //This is a simple loop used to repeatedly fill the particle cache with new particles. This is used to reduce memory usage.
-
-        //First, we create a bunch of photons at the beam position with a distribution of energy and orientation
-        // as indicated by the beam arrangement.
-        for(long int i=0; i<particles_per_loop; ++i){
-            const double E   =  beam_energy_distribution( Loaded_Funcs );
-            vec3<double> pos =  Loaded_Funcs.beam_position( Loaded_Funcs );
-            vec3<double> mom =  get_new_orientation(PRNG_source(),PRNG_source(),PRNG_source()) * E;
+    //Runs the full number of histories, in the calling thread, for the current geometry (i.e., gantry angle.) Everything used
+    // here is either read-only or kept per-thread by the modules, so several of these can run at once.
+    //Linear attenuation and energy-transfer coefficients (1/cm) of a medium. Water comes from its own modules (at 1 g/cm^3.)
+    auto linear_mu = [&](const unsigned char &material, const double &E) -> double {
+        if(material == Material::Water) return Loaded_Funcs.photon_mass_coefficient_total(E);
+        return Loaded_Funcs.material_mass_coefficient_total(material, E)*Loaded_Funcs.material_density(material);
+    };
+    auto linear_mu_tr = [&](const unsigned char &material, const double &E) -> double {
+        if(material == Material::Water) return Loaded_Funcs.photon_mass_coefficient_transfer(E);
+        return Loaded_Funcs.material_mass_coefficient_transfer(material, E)*Loaded_Funcs.material_density(material);
+    };
+
+    auto simulate_histories = [&](void) -> void {
+        for(long int loop_multiplier=0; loop_multiplier<numb_of_loop_multiplications; ++loop_multiplier){ //This is a simple loop used to repeatedly fill the particle cache with new particles. This is used to reduce memory usage.
+
+            //First, we create a bunch of photons at the beam position with a distribution of energy and orientation
+            // as indicated by the beam arrangement.
+            for(long int i=0; i<particles_per_loop; ++i){
+                const double E   =  beam_energy_distribution( Loaded_Funcs );
+                vec3<double> pos =  Loaded_Funcs.beam_position( Loaded_Funcs );
+                vec3<double> mom =  get_new_orientation(PRNG_source(),PRNG_source(),PRNG_source()) * E;
     
-            std::unique_ptr<base_particle> temp = photon_factory(E, pos, mom);
-            temp->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Beam, E, pos));
-            particle_sink( std::move( temp ) );
-        }
+                std::unique_ptr<base_particle> temp = photon_factory(E, pos, mom);
+                temp->Interactions.push_back( an_interaction(Interactiontype::Creation, Material::Beam, E, pos));
+                particle_sink( std::move( temp ) );
+            }
     
     
-        //Now we cycle through the remaining particles until they have all deposited their energy somewhere.
-        std::unique_ptr<base_particle> current_particle = next_particle();
-    //    vec3<double> pos_copy;  //If needed, to try speed up vec3<double> calculations.
-    //    double step_factor;     //Used for variable-length ray casting through vacuum.
-        while(current_particle != nullptr){
+            //Now we cycle through the remaining particles until they have all deposited their energy somewhere.
+            std::vector<vec3<double>> recycled_positions, recycled_dirs;
+            std::unique_ptr<base_particle> current_particle = next_particle();
+            while(current_particle != nullptr){
+
+                //Move the particle this distance in the direction of the momentum vector.
+                vec3<double> pos = current_particle->get_position3();
+                vec3<double> dir = (current_particle->get_relativistic_three_momentum3()).unit(); //This is the unit vector in the direction of travel. Need to have a .unit() here to homogeneously treat particles.
+
+                //Particles are handed out last-in-first-out, so each beam particle (and all its progeny) is finished before the next beam
+                // particle is handed out. A beam particle which has not yet moved therefore marks the start of a new history.
+                const bool new_history = (current_particle->Interactions.size() == 1)
+                                      && (current_particle->Interactions[0].material == Material::Beam)
+                                      && (pos == current_particle->Interactions[0].position);
+                if(new_history && (Loaded_Funcs.voxel_new_history != NULL)){
+                    Loaded_Funcs.voxel_new_history();
+                }
+
+                //History recycling. The voxel tally records this history and, once it is finished, replays it from further entry
+                // points drawn from the beam. The physics is not resampled; only where (and which way) the history starts.
+                if(new_history && (recycle_count > 1)){
+                    recycled_positions.clear();
+                    recycled_dirs.clear();
+                    for(long int k = 1; k < recycle_count; ++k){
+                        recycled_positions.push_back( Loaded_Funcs.beam_position( Loaded_Funcs ) );
+                        recycled_dirs.push_back( get_new_orientation(PRNG_source(),PRNG_source(),PRNG_source()) );
+                    }
+                    voxel_recycle(pos, dir, recycled_positions, recycled_dirs);
+                }
 
-            //Move the particle this distance in the direction of the momentum vector.
-            vec3<double> pos = current_particle->get_position3();
-            vec3<double> dir = (current_particle->get_relativistic_three_momentum3()).unit(); //This is the unit vector in the direction of travel. Need to have a .unit() here to homogeneously treat particles.
+                //Importance-based splitting and Russian roulette. Photons are kept within a factor of two of weight 1/importance: a
+                // photon which is too heavy for its region is split into several identical photons sharing its weight, and one which
+                // is too light survives with probability weight*importance (and weight 1/importance) or is dropped. Each copy samples
+                // its own flight from here, which is fair because the path length distribution has no memory.
+                //
+                //This is only done where a photon has just collided (or been created), not where it merely crossed a boundary, so
+                // an unscattered photon is never split into copies which would follow exactly the same path. Photons still sitting at
+                // the source are left alone, so that copies cannot be mistaken for new histories.
+                if((Loaded_Funcs.importance != NULL)
+                    && (current_particle->get_type() == Particletype::Photon)
+                    && (current_particle->Interactions.back().interaction != Interactiontype::None)
+                    && !new_history){
+                    const double ratio = current_particle->get_weight() * Loaded_Funcs.importance(pos);
+
+                    if(ratio < 0.5){
+                        if(PRNG_source() >= ratio){
+                            current_particle = next_particle();
+                            continue;
+                        }
+                        current_particle->set_weight( current_particle->get_weight() / ratio );
+
+                    }else if(ratio >= 2.0){
+                        long int copies = static_cast<long int>(ratio);
+                        if(PRNG_source() < (ratio - static_cast<double>(copies))) ++copies;
+                        if(copies > max_split) copies = max_split;
+
+                        const double w = current_particle->get_weight() / static_cast<double>(copies);
+                        current_particle->set_weight( w );
+                        for(long int k = 1; k < copies; ++k){
+                            std::unique_ptr<base_particle> copy = photon_factory(current_particle->get_energy(), pos, current_particle->get_relativistic_three_momentum3());
+                            copy->Interactions = current_particle->Interactions;
+                            copy->set_weight( w );
+                            particle_sink( std::move( copy ) );
+                        }
+                    }
+                }
     
-            double dl;
-            unsigned char material = Loaded_Funcs.which_material(pos); //The *current* particle position, so we know which mfp to use.
-            unsigned char which_interaction;
+                double dl;
+                unsigned char material = Loaded_Funcs.which_material(pos); //The *current* particle position, so we know which mfp to use.
+                unsigned char which_interaction;
+                double stretch_mu = 0.0, stretch_mu_star = 0.0; //Set when the exponential transform has stretched this flight.
+                const double weight_at_start = current_particle->get_weight();
     
-            //Determine the distance the photon will travel prior to next interaction and also which interaction type to perform.
-            //
-            //We can override what the material told us if the particle satisfies our sepuku criteria (if they exist and are turned on.)
+                //Determine the distance the photon will travel prior to next interaction and also which interaction type to perform.
+                //
+                //We can override what the material told us if the particle satisfies our sepuku criteria (if they exist and are turned on.)
     
-            //Interaction-number discriminating conditions.
-            if((INTERACTION_COUNT_MAX_CULL != 0) && (current_particle->Interactions.size() > INTERACTION_COUNT_MAX_CULL)){
-                dl = 0.0;
-                which_interaction = Interactiontype::Disappear;
+                //Interaction-number discriminating conditions.
+                if((INTERACTION_COUNT_MAX_CULL != 0) && (current_particle->Interactions.size() > INTERACTION_COUNT_MAX_CULL)){
+                    dl = 0.0;
+                    which_interaction = Interactiontype::Disappear;
     
-            //Sepuku-discriminating conditions.
-            }else if((ELECTRON_SEPUKU_LOCALDUMP == true) && (current_particle->get_type() == Particletype::Electron) && (current_particle->get_energy() <= ELECTRON_SEPUKU_ENERGY_THRESHOLD)){
-                dl = 0.0;
-                which_interaction = Interactiontype::LocalDump;
+                //Sepuku-discriminating conditions.
+                }else if((ELECTRON_SEPUKU_LOCALDUMP == true) && (current_particle->get_type() == Particletype::Electron) && (current_particle->get_energy() <= ELECTRON_SEPUKU_ENERGY_THRESHOLD)){
+                    dl = 0.0;
+                    which_interaction = Interactiontype::LocalDump;
     
-            }else if((POSITRON_SEPUKU_LOCALDUMP == true) && (current_particle->get_type() == Particletype::Positron) && (current_particle->get_energy() <= POSITRON_SEPUKU_ENERGY_THRESHOLD)){
-                dl = 0.0;
-                which_interaction = Interactiontype::LocalDump;
+                }else if((POSITRON_SEPUKU_LOCALDUMP == true) && (current_particle->get_type() == Particletype::Positron) && (current_particle->get_energy() <= POSITRON_SEPUKU_ENERGY_THRESHOLD)){
+                    dl = 0.0;
+                    which_interaction = (scatter_annihilation != NULL) ? Interactiontype::Annihilation : Interactiontype::LocalDump;
     
-            //Material-discriminating conditions.
-            }else if(material == Material::Beam){
-                FUNCERR("Particle detected in region of material 'beam'. This is not a geometrically accessible material. Please verify the geometry module and this code.");
+                //Material-discriminating conditions.
+                }else if(material == Material::Beam){
+                    FUNCERR("Particle detected in region of material 'beam'. This is not a geometrically accessible material. Please verify the geometry module and this code.");
     
-            }else if(material == Material::Black){
-                dl = 0.0;
-                which_interaction = Interactiontype::Disappear; //Particle will be completely removed and not logged.
+                }else if(material == Material::Black){
+                    dl = 0.0;
+                    which_interaction = Interactiontype::Disappear; //Particle will be completely removed and not logged.
     
-            }else if(material == Material::Vacuum){
-                dl = Loaded_Funcs.PRNG_source() * smallest_feature;  //This should look ahead to a non-vacuum region and set the mfp to that distance to speed up transport to interacting media..
+                }else if((material == Material::Vacuum) && (Loaded_Funcs.distance_to_boundary != NULL)){
+                    //Fly straight to the next material. If there is none, the particle is gone for good.
+                    dl = Loaded_Funcs.distance_to_boundary(pos, dir);
+                    if(dl >= 1E99){
+                        dl = 0.0;
+                        which_interaction = Interactiontype::Disappear;
+                    }else{
+                        dl += boundary_step_over;
+                        which_interaction = Interactiontype::None;
+                    }
+
+                }else if(material == Material::Vacuum){
+                    //Look ahead along the path, a batch of smallest_feature-length steps at a time so no feature can be stepped over,
+                    // and jump to a random point between the last step still in vacuum and the first which is not.
+                    double xs[vacuum_lookahead], ys[vacuum_lookahead], zs[vacuum_lookahead];
+                    unsigned char ms[vacuum_lookahead];
+                    for(size_t k=0; k<vacuum_lookahead; ++k){
+                        const double s = smallest_feature * static_cast<double>(k+1);
+                        xs[k] = pos.x + dir.x*s;
+                        ys[k] = pos.y + dir.y*s;
+                        zs[k] = pos.z + dir.z*s;
+                    }
+                    Loaded_Funcs.which_materials(xs, ys, zs, ms, vacuum_lookahead);
+
+                    size_t steps = 0;
+                    while((steps < vacuum_lookahead) && (ms[steps] == Material::Vacuum)) ++steps;
+                    dl = smallest_feature * static_cast<double>(steps);
+                    if(steps != vacuum_lookahead) dl += Loaded_Funcs.PRNG_source() * smallest_feature;
     
-    /*   //Test this scheme more when I have a better data flow :/
-                dl = 0.0;  
-                step_factor = 1.0;
-                pos_copy = pos; 
+                    which_interaction = Interactiontype::None;
     
-                do {
-                    if(step_factor <= 7.5){ //7.5 times the smallest feature.    ...this is probably a bad idea...
-                        step_factor += 0.47501*step_factor;   //Used to try reduce the total number of times we have to evaluate the geometry, whilst not overshooting the next material.
-                    }    
-               
-                    pos_copy += dir*smallest_feature * step_factor;
-                    dl       += smallest_feature * step_factor;
-                   
-                }while(Loaded_Funcs.which_material(pos_copy) != Material::Vacuum);
+                }else if((material == Material::Water)
+                      || ((Loaded_Funcs.material_defined != NULL) && Loaded_Funcs.material_defined(material))){
+                    //Water has its own modules. Everything else comes from the material database.
+                    if(material == Material::Water){
+                        water_mfp_and_which_interaction( current_particle.get(), PRNG_source(), PRNG_source(), which_interaction, dl);
+                    }else{
+                        Loaded_Funcs.material_mfp_and_which_interaction( material, current_particle.get(), PRNG_source(), PRNG_source(), which_interaction, dl);
+                    }
+
+                    //The condensed-history routine moves charged particles itself, starting from here.
+                    //
+                    //Otherwise, if the particle would leave the medium first, stop it just past the interface instead. The path
+                    // length is resampled in the next medium, which is exact for the (memoryless) exponential distribution.
+                    if((which_interaction == Interactiontype::SlowDown) && (scatter_condensed_history != NULL)){
+                        dl = 0.0;
+                    }
+
+                    //Exponential transform. Where the geometry asks for it, a photon's path length is resampled with the reduced
+                    // coefficient mu* = mu(1 - p cos) (where cos is between the flight and the bias direction) so photons heading along
+                    // the bias direction travel further. The weight is corrected by the ratio of the true to the stretched probability
+                    // of the flight, once its end is known. (The choice of interaction does not depend on the path length.)
+                    if((Loaded_Funcs.exponential_transform != NULL)
+                        && (current_particle->get_type() == Particletype::Photon)
+                        && (dl > 0.0)){
+                        vec3<double> bias;
+                        const double p = Loaded_Funcs.exponential_transform(pos, bias);
+                        if(p != 0.0){
+                            if(!(fabs(p) < 1.0)) FUNCERR("Exponential transform stretching parameter must be within (-1,1). Got " << p);
+                            stretch_mu      = linear_mu(material, current_particle->get_energy());
+                            stretch_mu_star = stretch_mu*(1.0 - p*(dir.x*bias.x + dir.y*bias.y + dir.z*bias.z));
+                            dl = -log(1.0 - PRNG_source())/stretch_mu_star;
+                        }
+                    }
+
+                    if((Loaded_Funcs.distance_to_boundary != NULL) && (dl > 0.0)){
+                        const double to_boundary = Loaded_Funcs.distance_to_boundary(pos, dir);
+
+                        //Interaction forcing. In a thin region, a photon is split in two: an uncollided copy, carrying the weight
+                        // fraction exp(-tau) which would have crossed, continues from the far side; the rest of the weight is made to
+                        // interact within the region, at a distance drawn from the exponential truncated at the boundary.
+                        if((forced_interaction_depth > 0.0)
+                            && (stretch_mu_star == 0.0)
+                            && (current_particle->get_type() == Particletype::Photon)
+                            && (to_boundary < 1E99)){
+                            const double E  = current_particle->get_energy();
+                            const double mu  = linear_mu(material, E);
+                            const double tau = mu*to_boundary;
+                            if(tau < forced_interaction_depth){
+                                const double crossing = exp(-tau);
+                                const double w = current_particle->get_weight();
+
+                                vec3<double> exit = dir*(to_boundary + boundary_step_over);
+                                exit += pos;
+                                std::unique_ptr<base_particle> uncollided = photon_factory(E, exit, current_particle->get_relativistic_three_momentum3());
+                                uncollided->Interactions = current_particle->Interactions;
+                                uncollided->Interactions.push_back( an_interaction( Interactiontype::None, material, E, exit ) );
+                                uncollided->set_weight( w*crossing );
+                                if(Loaded_Funcs.voxel_track_kerma != NULL){
+                                    Loaded_Funcs.voxel_track_kerma(E*linear_mu_tr(material, E), pos, exit, w*crossing);
+                                }
+                                particle_sink( std::move( uncollided ) );
+
+                                current_particle->set_weight( w*(1.0 - crossing) );
+                                dl = -log(1.0 - PRNG_source()*(1.0 - crossing))/mu;
+                            }
+                        }
+
+                        if(dl > to_boundary){
+                            dl = to_boundary + boundary_step_over;
+                            which_interaction = Interactiontype::None;
+                        }
+                    }
     
-                //Now back off one step so we remain in the material.
-                dl -= smallest_feature * step_factor;
-    */
+                }else if(material == Material::Detector){
+                    dl = 0.0;
+                    which_interaction = Interactiontype::Detect; //Particle will be logged. in *typical* detector setups, we *only* log particles at the detector.
     
-                which_interaction = Interactiontype::None;
+                }else{
+                    FUNCERR("Particle is in a region of material " << (int)(material) << ", for which no data is loaded. Verify the geometry module, and that lib_materials.so has a data file for it");
+                }
     
-            }else if(material == Material::Air){
-                FUNCERR("This material type is not yet defined. Fix me first!");
+                //Track-length kerma: every photon flight through matter scores E * mu_tr along its length. Flights end at (or just
+                // past) material boundaries when the geometry can report them, so the medium is the one the flight started in.
+                if((Loaded_Funcs.voxel_track_kerma != NULL)
+                    && (dl > 0.0)
+                    && (current_particle->get_type() == Particletype::Photon)
+                    && (material != Material::Vacuum)){
+                    const double E = current_particle->get_energy();
+                    const double kerma_per_length = E*linear_mu_tr(material, E);
+                    if(stretch_mu_star == 0.0){
+                        vec3<double> end = dir*dl;
+                        end += pos;
+                        Loaded_Funcs.voxel_track_kerma(kerma_per_length, pos, end, current_particle->get_weight());
+                    }else{
+                        //Along a stretched flight the weight falls off (or grows) as exp(-(mu - mu*)s). Score in pieces short enough
+                        // that it varies by a few percent across each, using the exact average weight over the piece.
+                        const double a = stretch_mu - stretch_mu_star;
+                        const long int pieces = std::min(64L, std::max(1L, static_cast<long int>(ceil(fabs(a)*dl/0.05))));
+                        const double piece = dl/static_cast<double>(pieces);
+                        vec3<double> start = pos;
+                        for(long int k = 0; k < pieces; ++k){
+                            const double s0 = piece*static_cast<double>(k);
+                            const double w = (fabs(a*piece) < 1E-12) ? weight_at_start*exp(-a*s0)
+                                                                     : weight_at_start*(exp(-a*s0) - exp(-a*(s0 + piece)))/(a*piece);
+                            vec3<double> end = dir*(s0 + piece);
+                            end += pos;
+                            Loaded_Funcs.voxel_track_kerma(kerma_per_length, start, end, w);
+                            start = end;
+                        }
+                    }
+                }
+
+                //The weight correction for a stretched flight. A photon which reaches the end of it had probability exp(-mu dl) to
+                // get there (against exp(-mu* dl) as sampled), and one which collides there also had density mu (against mu*.)
+                if(stretch_mu_star != 0.0){
+                    double correction = exp(-(stretch_mu - stretch_mu_star)*dl);
+                    if(which_interaction != Interactiontype::None) correction *= stretch_mu/stretch_mu_star;
+                    current_particle->set_weight( weight_at_start*correction );
+                }
+
+                pos +=  dir*dl;
+                current_particle->set_position3( pos );
+
+    //std::cout << "Transport: dl, dir, pos = " << dl << " " << dir << " " << pos << std::endl;    
     
-            }else if(material == Material::Water){
-                water_mfp_and_which_interaction( current_particle.get(), PRNG_source(), PRNG_source(), which_interaction, dl);
+                //Now I need to decide if the material has changed whilst moving through the MFP distance. If it did, maybe we should re-choose the interaction type.
+                //Maybe it is too much of a hassle/too costly to do so?
+        /*
+                const unsigned char material2 = Loaded_Funcs.which_material(pos);
+                if(material != material2){
+                    material = material2;
     
-            }else if(material == Material::Detector){
-                dl = 0.0;
-                which_interaction = Interactiontype::Detect; //Particle will be logged. in *typical* detector setups, we *only* log particles at the detector.
     
-            }else{
-                FUNCERR("Particle is in a region of unknown material. Verify the geometry module and this code.");
-            }
+                }
+        */
     
-            pos +=  dir*dl;
-            current_particle->set_position3( pos );
-
-//std::cout << "Transport: dl, dir, pos = " << dl << " " << dir << " " << pos << std::endl;    
+                // ------  Logging -------------------------
+                //Percentage-Depth Kerma for delta-function beam sources.
+                if( (LoggingQuantities::PDK_1MEV || LoggingQuantities::PDK_10MEV)
+                    && ((Beam_ID == "1MEV") || (Beam_ID == "10MEV"))
+                    && (current_particle->get_type() == Particletype::Photon) 
+                    && (current_particle->Interactions.size() == 1) 
+                    && (which_interaction != Interactiontype::None)
+                    && (which_interaction != Interactiontype::Disappear)
+                    && (which_interaction != Interactiontype::LocalDump)
+                    && (which_interaction != Interactiontype::Detect)
+                  ){
+                    //If the photon is originally of energy 1 MeV or 10 MeV, we use its energy to compute the average energy transferred
+                    // and the total mass attenuation coefficient. This will give us Kerma. 
+                    //
+                    //BUT, because we are interested in specific beam energies, and only interested in on-beam-axis (non-scattered) photons,
+                    // we can simply output the depth the photon is at
     
-            //Now I need to decide if the material has changed whilst moving through the MFP distance. If it did, maybe we should re-choose the interaction type.
-            //Maybe it is too much of a hassle/too costly to do so?
-    /*
-            const unsigned char material2 = Loaded_Funcs.which_material(pos);
-            if(material != material2){
-                material = material2;
+                    const double depth = pos.distance( current_particle->Interactions[0].position );
+                    const double record[2] = { depth, current_particle->get_weight() };
+                    if( (current_particle->Interactions[0].energy == 1.0) && (LoggingQuantities::PDK_1MEV) ){
+                        if(use_histograms){
+                            Loaded_Funcs.tally_fill(handle_PD_Kerma_1MeV, depth, current_particle->get_weight());
+                        }else if(use_binary_logs){
+                            Loaded_Funcs.binary_logging_record(handle_PD_Kerma_1MeV, record);
+                        }else{
+                            Loaded_Funcs.logging_by_channel(handle_PD_Kerma_1MeV) << record[0] << " " << record[1] << '\n';
+                        }
     
+                    }else if( (current_particle->Interactions[0].energy == 10.0) && (LoggingQuantities::PDK_10MEV) ){
+                        if(use_histograms){
+                            Loaded_Funcs.tally_fill(handle_PD_Kerma_10MeV, depth, current_particle->get_weight());
+                        }else if(use_binary_logs){
+                            Loaded_Funcs.binary_logging_record(handle_PD_Kerma_10MeV, record);
+                        }else{
+                            Loaded_Funcs.logging_by_channel(handle_PD_Kerma_10MeV) << record[0] << " " << record[1] << '\n';
+                        }
+                    }
+     
+                //Percentage-Depth Dose for 6MV beam.
+                }else if( (LoggingQuantities::PDD_6MV)
+                    && (Beam_ID == "6MV") 
+                    && (current_particle->get_type() == Particletype::Photon)
+                    && (current_particle->Interactions.size() == 1) 
+                    && (which_interaction != Interactiontype::None)
+                    && (which_interaction != Interactiontype::Disappear)
+                    && (which_interaction != Interactiontype::LocalDump)
+                    && (which_interaction != Interactiontype::Detect)
+                  ){
     
-            }
-    */
-    
-            // ------  Logging -------------------------
-            //Percentage-Depth Kerma for delta-function beam sources.
-            if( (LoggingQuantities::PDK_1MEV || LoggingQuantities::PDK_10MEV)
-                && ((Beam_ID == "1MEV") || (Beam_ID == "10MEV"))
-                && (current_particle->get_type() == Particletype::Photon) 
-                && (current_particle->Interactions.size() == 1) 
-                && (which_interaction != Interactiontype::None)
-                && (which_interaction != Interactiontype::Disappear)
-                && (which_interaction != Interactiontype::LocalDump)
-                && (which_interaction != Interactiontype::Detect)
-              ){
-                //If the photon is originally of energy 1 MeV or 10 MeV, we use its energy to compute the average energy transferred
-                // and the total mass attenuation coefficient. This will give us Kerma. 
-                //
-                //BUT, because we are interested in specific beam energies, and only interested in on-beam-axis (non-scattered) photons,
-                // we can simply output the depth the photon is at
+                    //The kerma and/or dose for a non-delta function spectrum is more difficult to compute. We do it in two steps. First, we
+                    // output three pieces of data: distance, photon energy, and a part of the kerma integral. We will piece the rest together
+                    // with a script to bin two dimensions (distance and energy) and then numerically integrate the bins over energy. This 
+                    // will leave us with binned data along the distance dimension. We can scale it to the maximum bin to get the percent-depth
+                    // kerma and/or dose.
+                    const double E = current_particle->get_energy();
+                    //Dose (use <Eabs>)
+                    const double record[4] = { pos.distance( current_particle->Interactions[0].position ), E,
+                                               Loaded_Funcs.photon_mass_coefficient_total(E)*Loaded_Funcs.photon_average_energy_absorbed(E),
+                                               current_particle->get_weight() };
+                    if(use_histograms){
+                        Loaded_Funcs.tally_fill_2D(handle_PD_Dose_6MV, record[0], E, E*record[2]*current_particle->get_weight());
+                    }else if(use_binary_logs){
+                        Loaded_Funcs.binary_logging_record(handle_PD_Dose_6MV, record);
+                    }else{
+                        Loaded_Funcs.logging_by_channel(handle_PD_Dose_6MV) << record[0] << " " << record[1] << " " << record[2] << " " << record[3] << '\n';
+                    }
+     
+                    //Kerma (use <Etrans>)
+                    //Loaded_Funcs.generic_logging("PD_Dose_6MV") << pos.distance( current_particle->Interactions[0].position ) << " " << E << " " \
+                    //                      << Loaded_Funcs.photon_mass_coefficient_total(E)*Loaded_Funcs.photon_average_energy_absorbed(E) << std::endl;
+            
+    
+                }
     
-                if( (current_particle->Interactions[0].energy == 1.0) && (LoggingQuantities::PDK_1MEV) ){
-                    Loaded_Funcs.generic_logging("PD_Kerma_1MeV") << pos.distance( current_particle->Interactions[0].position ) << std::endl;
+                //if(VERBOSE)  FUNCINFO("Newly moved particle has E, position, momentum, and type: " << current_particle->get_energy() << " " << current_particle->get_position3() << " " << current_particle->get_relativistic_three_momentum3() << " " << (int)(current_particle->get_type()) );
     
-                }else if( (current_particle->Interactions[0].energy == 10.0) && (LoggingQuantities::PDK_10MEV) ){
-                    Loaded_Funcs.generic_logging("PD_Kerma_10MeV") << pos.distance( current_particle->Interactions[0].position ) << std::endl;
+                //Mark the particle as having undergone the interaction it is about to undergo (so that we do not have to stick this in each interaction library..)
+                if( track_interactions == true ){
+                    current_particle->Interactions.push_back( an_interaction( which_interaction, material, current_particle->get_energy(), current_particle->get_position3() ) );     
                 }
-     
-            //Percentage-Depth Dose for 6MV beam.
-            }else if( (LoggingQuantities::PDD_6MV)
-                && (Beam_ID == "6MV") 
-                && (current_particle->get_type() == Particletype::Photon)
-                && (current_particle->Interactions.size() == 1) 
-                && (which_interaction != Interactiontype::None)
-                && (which_interaction != Interactiontype::Disappear)
-                && (which_interaction != Interactiontype::LocalDump)
-                && (which_interaction != Interactiontype::Detect)
-              ){
-    
-                //The kerma and/or dose for a non-delta function spectrum is more difficult to compute. We do it in two steps. First, we
-                // output three pieces of data: distance, photon energy, and a part of the kerma integral. We will piece the rest together
-                // with a script to bin two dimensions (distance and energy) and then numerically integrate the bins over energy. This 
-                // will leave us with binned data along the distance dimension. We can scale it to the maximum bin to get the percent-depth
-                // kerma and/or dose.
-                const double E = current_particle->get_energy();
-                //Dose (use <Eabs>)
-                Loaded_Funcs.generic_logging("PD_Dose_6MV") << pos.distance( current_particle->Interactions[0].position ) << " " << E << " " \
-                                      << Loaded_Funcs.photon_mass_coefficient_total(E)*Loaded_Funcs.photon_average_energy_absorbed(E) << std::endl;
-     
-                //Kerma (use <Etrans>)
-                //Loaded_Funcs.generic_logging("PD_Dose_6MV") << pos.distance( current_particle->Interactions[0].position ) << " " << E << " " \
-                //                      << Loaded_Funcs.photon_mass_coefficient_total(E)*Loaded_Funcs.photon_average_energy_absorbed(E) << std::endl;
-            
     
-            }
+                //Send the particle into the interaction function. It takes ownership and will probably destroy it,
+                // so do not use the reference after this point.
+                if( which_interaction == Interactiontype::Compton ){
+                    if(detector_forced != NULL) detector_forced( *current_particle, Loaded_Funcs );
+                    scatter_compton( std::move( current_particle ), Loaded_Funcs );
     
-            //if(VERBOSE)  FUNCINFO("Newly moved particle has E, position, momentum, and type: " << current_particle->get_energy() << " " << current_particle->get_position3() << " " << current_particle->get_relativistic_three_momentum3() << " " << (int)(current_particle->get_type()) );
+                }else if( which_interaction == Interactiontype::Coherent ){
+                    scatter_coherent( std::move( current_particle ), Loaded_Funcs );
     
-            //Mark the particle as having undergone the interaction it is about to undergo (so that we do not have to stick this in each interaction library..)
-            if( track_interactions == true ){
-                current_particle->Interactions.push_back( an_interaction( which_interaction, material, current_particle->get_energy(), current_particle->get_position3() ) );     
-            }
+                }else if( which_interaction == Interactiontype::Photoelectric ){
+                    scatter_photoelectric( std::move( current_particle ), Loaded_Funcs );
     
-            //Send the particle into the interaction function. It takes ownership and will probably destroy it,
-            // so do not use the reference after this point.
-            if( which_interaction == Interactiontype::Compton ){
-                scatter_compton( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::Pair ){
+                    scatter_pair( std::move( current_particle ), Loaded_Funcs );
     
-            }else if( which_interaction == Interactiontype::Coherent ){
-                scatter_coherent( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::LocalDump ){
+                    scatter_localdump( std::move( current_particle ), Loaded_Funcs );
     
-            }else if( which_interaction == Interactiontype::Photoelectric ){
-                scatter_photoelectric( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::Annihilation ){
+                    scatter_annihilation( std::move( current_particle ), Loaded_Funcs );
     
-            }else if( which_interaction == Interactiontype::Pair ){
-                scatter_pair( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::SlowDown ){
+                    if(scatter_condensed_history != NULL){
+                        scatter_condensed_history( std::move( current_particle ), Loaded_Funcs );
+                    }else{
+                        scatter_slowdown( std::move( current_particle ), Loaded_Funcs );
+                    }
     
-            }else if( which_interaction == Interactiontype::LocalDump ){
-                scatter_localdump( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::Detect ){
+                    scatter_detect( std::move( current_particle ), Loaded_Funcs );
     
-            }else if( which_interaction == Interactiontype::SlowDown ){
-                scatter_slowdown( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::None ){
+                    scatter_none( std::move( current_particle ), Loaded_Funcs ); //This is here in case we want to log or cull particles.
     
-            }else if( which_interaction == Interactiontype::Detect ){
-                scatter_detect( std::move( current_particle ), Loaded_Funcs );
+                }else if( which_interaction == Interactiontype::Disappear ){
+                    //Particle will simply disappear right now. We do not log this - disappearance means we don't care about it.
     
-            }else if( which_interaction == Interactiontype::None ){
-                scatter_none( std::move( current_particle ), Loaded_Funcs ); //This is here in case we want to log or cull particles.
+                }else{
+                    FUNCERR("Instructed to perform an interaction (" << (int)(which_interaction) << ") which is unknown!");
+                }
     
-            }else if( which_interaction == Interactiontype::Disappear ){
-                //Particle will simply disappear right now. We do not log this - disappearance means we don't care about it.
     
-            }else{
-                FUNCERR("Instructed to perform an interaction (" << (int)(which_interaction) << ") which is unknown!");
+                //Grab the next available active particle.
+                current_particle = next_particle();
+            }
+
+            //Replay the last history of the batch, if it is being recycled.
+            if(recycle_count > 1){
+                recycled_positions.clear();
+                recycled_dirs.clear();
+                voxel_recycle(vec3<double>(0.0, 0.0, 0.0), vec3<double>(0.0, 0.0, 1.0), recycled_positions, recycled_dirs);
             }
     
-    
-            //Grab the next available active particle.
-            current_particle = next_particle();
         }
-    
+
+    };
+
+    if((gantry_angles > 1) && (set_gantry_angle == NULL)){
+        FUNCERR("Multiple gantry angles were requested, but the geometry cannot be rotated");
+    }
+    if((gantry_angles > 1) && (PRNG_seed == NULL)){
+        FUNCERR("Multiple gantry angles were requested, but the PRNG cannot be explicitly seeded");
+    }
+    //(Text logging is refused by the logging module if a second thread attempts it.)
+
+    if(gantry_angles == 1){
+        //The gantry does not move, so the whole run makes up a single sinogram row.
+        if(detector_begin_row != NULL) detector_begin_row(0.0, Loaded_Funcs);
+        simulate_histories();
+        if(detector_end_row != NULL) detector_end_row();
+
+    }else{
+        //Angles are handed out to threads one at a time. Each angle reseeds the generator with a seed derived from the angle's
+        // index, so the results do not depend on the number of threads or the order in which angles are processed. Geometry,
+        // cross-section tables, and all other setup are shared by all angles.
+        std::atomic<long int> next_angle(0);
+        auto worker = [&](void) -> void {
+            for(long int i = next_angle++; i < gantry_angles; i = next_angle++){
+                const double angle = 2.0*M_PI*static_cast<double>(i)/static_cast<double>(gantry_angles);
+                PRNG_seed(random_seed + 1 + i);
+                set_gantry_angle(angle);
+                if(detector_begin_row != NULL) detector_begin_row(angle, Loaded_Funcs);
+                simulate_histories();
+                if(detector_end_row != NULL) detector_end_row();
+                if(VERBOSE) FUNCINFO("Finished gantry angle " << (i+1) << " of " << gantry_angles);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(long int t = 1; t < numb_of_threads; ++t) threads.push_back( std::thread(worker) );
+        worker();
+        for(auto &t : threads) t.join();
     }
 
     //----------------------------------------------------------------------------------------------------
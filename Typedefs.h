@@ -8,6 +8,7 @@
 #include "./Constants.h"
 
 #include <string>
+#include <vector>
 #include <fstream>
 
 //#include "./Structs.h"    // <---- Forward declaration is better.
@@ -20,6 +21,9 @@ class base_particle;
 //Used for: void toggle_verbosity(bool)
 typedef void (*FUNCTION_toggle_verbosity_t)(bool);
 
+//Used for: void toggle_kerma_approximation(bool)
+typedef void (*FUNCTION_toggle_kerma_approximation_t)(bool);
+
 
 //-------------------------------------------------------------------------------------------------------
 //----------------------------------------------- PRNG's ------------------------------------------------
@@ -57,6 +61,43 @@ typedef double (*FUNCTION_energy_distribution)(const struct Functions &);
 //Used for: unsigned char geometry_type(const vec3<double> &in);
 typedef unsigned char (*FUNCTION_geometry_type)(const vec3<double> &in);
 
+//Used for: void geometry_type_batch(const double *x, const double *y, const double *z, unsigned char *material, const size_t &N);
+// (Optional.) Classifies N points at once, given as separate coordinate arrays. Written so that the compiler can vectorize it.
+typedef void (*FUNCTION_geometry_type_batch)(const double *, const double *, const double *, unsigned char *, const size_t &);
+
+//Used for: void set_gantry_angle(const double &in);    (Geometries which can rotate, e.g., CT imagers. Per-thread.)
+typedef void (*FUNCTION_set_gantry_angle)(const double &);
+
+//Used for: long int detector_cell(const vec3<double> &in);    (Geometries with a segmented detector only.)
+typedef long int (*FUNCTION_detector_cell)(const vec3<double> &);
+
+//Used for: long int detector_cell_count(void);
+typedef long int (*FUNCTION_detector_cell_count)(void);
+
+//Used for: void detector_cell_face(const long int &cell, vec3<double> &centre, vec3<double> &normal, double &area);    (Optional.)
+// The entrance face of a detector cell, as a flat patch: its centre, unit normal (either sense), and area.
+typedef void (*FUNCTION_detector_cell_face)(const long int &, vec3<double> &, vec3<double> &, double &);
+
+//Used for: double distance_to_boundary(const vec3<double> &pos, const vec3<double> &dir);    (Optional.)
+// Distance along the unit vector dir from pos to the nearest surface where the material may change. It may stop short at
+// a surface which turns out not to change the material, but must never overshoot a real one. Returns 1E99 if nothing lies ahead.
+typedef double (*FUNCTION_distance_to_boundary)(const vec3<double> &pos, const vec3<double> &dir);
+
+//Used for: double safety_distance(const vec3<double> &pos);    (Optional.)
+// Distance from pos, in any direction, to the nearest surface where the material may change. May underestimate, but must never
+// overestimate. Used to decide when a charged particle cannot possibly leave its region.
+typedef double (*FUNCTION_safety_distance)(const vec3<double> &pos);
+
+//Used for: double importance(const vec3<double> &pos);    (Optional.)
+// Relative importance of the region containing pos (> 0). Photons colliding there are split or rouletted so that their weight
+// stays within a factor of two of 1/importance. Regions of equal importance see no change.
+typedef double (*FUNCTION_importance)(const vec3<double> &pos);
+
+//Used for: double exponential_transform(const vec3<double> &pos, vec3<double> &bias);    (Optional.)
+// Exponential transform stretching parameter p of the region containing pos, within (-1,1), and the (unit) bias direction. Photon
+// flights there are sampled with mu(1 - p cos), where cos is between the flight and the bias. Zero leaves the region unbiased.
+typedef double (*FUNCTION_exponential_transform)(const vec3<double> &pos, vec3<double> &bias);
+
 
 //-------------------------------------------------------------------------------------------------------
 //---------------------------------------------- Memory -------------------------------------------------
@@ -104,6 +145,25 @@ typedef unsigned char (*FUNCTION_which_interaction)( base_particle *, const doub
 //Used for: void mean_free_path_and_which_interaction( base_particle *in, const double &clamped1, const double &clamped2, unsigned char &which, double &mfp);
 typedef void (*FUNCTION_mfp_and_which_interaction)( base_particle *, const double &, const double &, unsigned char &, double &);
 
+//-------------------------------------------------------------------------------------------------------
+//------------------------------------------ Material Database ------------------------------------------
+//-------------------------------------------------------------------------------------------------------
+//Used for: bool material_defined(const unsigned char &material);
+typedef bool (*FUNCTION_material_defined)(const unsigned char &);
+
+//Used for: void material_mfp_and_which_interaction(const unsigned char &material, base_particle *in, const double &clamped1, const double &clamped2, unsigned char &which, double &mfp);
+typedef void (*FUNCTION_material_mfp_and_which_interaction)(const unsigned char &, base_particle *, const double &, const double &, unsigned char &, double &);
+
+//Used for: double material_mass_coefficient_total(const unsigned char &material, const double &E);
+//Used for: double material_mass_coefficient_transfer(const unsigned char &material, const double &E);
+//Used for: double material_mass_coefficient_absorption(const unsigned char &material, const double &E);
+//Used for: double material_stopping_power(const unsigned char &material, const double &T);
+typedef double (*FUNCTION_material_coefficient_X)(const unsigned char &, const double &);
+
+//Used for: double material_density(const unsigned char &material);
+//Used for: double material_binding_energy(const unsigned char &material);
+typedef double (*FUNCTION_material_property)(const unsigned char &);
+
 //-------------------------------------------------------------------------------------------------------
 //--------------------------------------- Scattering Routines -------------------------------------------
 //-------------------------------------------------------------------------------------------------------
@@ -112,12 +172,17 @@ typedef void (*FUNCTION_mfp_and_which_interaction)( base_particle *, const doubl
 //Used for: void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions);   (Compton Scattering)
 //Used for: void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions);   (Pair-production)
 //Used for: void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions);   ('Local dump' scattering)
+//Used for: void scatter(std::unique_ptr<base_particle> A, const struct Functions &Loaded_Functions);   (Condensed-history charged particle transport)
 typedef void (*FUNCTION_scatter_routine)(std::unique_ptr<base_particle> , const struct Functions &);
 
 
 //-------------------------------------------------------------------------------------------------------
 //--------------------------------------------- Logging -------------------------------------------------
 //-------------------------------------------------------------------------------------------------------
+//Used for: void annihilation_photons(const vec3<double> &pos, const double &weight, const struct Functions &);
+// Emits the photon pair from a positron annihilating at rest at pos.
+typedef void (*FUNCTION_annihilation_photons)(const vec3<double> &, const double &, const struct Functions &);
+
 //Used for: void particle_graveyard(std::unique_ptr<base_particle> in);
 typedef void (*FUNCTION_particle_graveyard)(std::unique_ptr<base_particle>);
 
@@ -127,13 +192,76 @@ typedef void (*FUNCTION_particle_graveyard)(std::unique_ptr<base_particle>);
 //Used for: std::ostream & logging_generic( const std::string &key );
 typedef std::ostream & (*FUNCTION_generic_logging)(const std::string &);
 
+//Used for: int logging_channel( const std::string &key );
+typedef int (*FUNCTION_logging_channel)(const std::string &);
+
+//Used for: std::ostream & logging_by_channel( const int &handle );
+typedef std::ostream & (*FUNCTION_logging_by_channel)(const int &);
+
+//Used for: void resolve_logging_handles(const struct Functions &);   (Optional, in any module. Called once all modules are loaded.)
+typedef void (*FUNCTION_resolve_logging_handles)(const struct Functions &);
+
+//Used for: int logging_binary_channel( const std::string &key, const size_t &record_size );
+typedef int (*FUNCTION_binary_logging_channel)(const std::string &, const size_t &);
+
+//Used for: void logging_binary_record( const int &handle, const void *record );
+typedef void (*FUNCTION_binary_logging_record)(const int &, const void *);
+
+//-------------------------------------------------------------------------------------------------------
+//--------------------------------------------- Detection -----------------------------------------------
+//-------------------------------------------------------------------------------------------------------
+//Used for: void detector_begin_row(const double &gantry_angle, const struct Functions &);
+typedef void (*FUNCTION_detector_begin_row)(const double &, const struct Functions &);
+
+//Used for: void detector_end_row(void);
+typedef void (*FUNCTION_detector_end_row)(void);
+
+//Used for: void detector_forced(base_particle &photon, const struct Functions &);    (Optional.)
+// Scores, in every detector cell, the expected contribution of the photon about to Compton scatter where it stands.
+typedef void (*FUNCTION_detector_forced)(base_particle &, const struct Functions &);
+
+//-------------------------------------------------------------------------------------------------------
+//--------------------------------------------- Tallies -------------------------------------------------
+//-------------------------------------------------------------------------------------------------------
+//Used for: int tally_histogram_1D(const std::string &key, const double &xmin, const double &xmax, const long int &xbins, const bool &xlog);
+typedef int (*FUNCTION_tally_histogram_1D)(const std::string &, const double &, const double &, const long int &, const bool &);
+
+//Used for: int tally_histogram_2D(const std::string &key, const double &xmin, const double &xmax, const long int &xbins, const bool &xlog,
+//                                                         const double &ymin, const double &ymax, const long int &ybins, const bool &ylog);
+typedef int (*FUNCTION_tally_histogram_2D)(const std::string &, const double &, const double &, const long int &, const bool &,
+                                                                const double &, const double &, const long int &, const bool &);
+
+//Used for: void tally_fill(const int &handle, const double &x, const double &weight);
+typedef void (*FUNCTION_tally_fill)(const int &, const double &, const double &);
+
+//Used for: void tally_fill_2D(const int &handle, const double &x, const double &y, const double &weight);
+typedef void (*FUNCTION_tally_fill_2D)(const int &, const double &, const double &, const double &);
+
 //-------------------------------------------------------------------------------------------------------
 //---------------------------------------------- Voxels -------------------------------------------------
 //-------------------------------------------------------------------------------------------------------
-//Used for: void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_pos,  const double &final_E, const vec3<double> &final_pos);
-typedef void (*FUNCTION_accumulate_slowdown)(const double &, const vec3<double> &,  const double &, const vec3<double> &, const struct Functions &);
+//Used for: void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_pos,  const double &final_E, const vec3<double> &final_pos, const double &weight);
+typedef void (*FUNCTION_accumulate_slowdown)(const double &, const vec3<double> &,  const double &, const vec3<double> &, const double &, const struct Functions &);
+
+//Used for: void voxel_localdump(const double &E, const vec3<double> &pos, const double &weight);
+typedef void (*FUNCTION_voxel_localdump)(const double &, const vec3<double> &, const double &, const struct Functions &);
+
+//Used for: void voxel_deposit_track(const double &T_transferred, const double &E_deposited, const vec3<double> &from, const vec3<double> &to, const double &weight);
+typedef void (*FUNCTION_voxel_deposit_track)(const double &, const double &, const vec3<double> &, const vec3<double> &, const double &, const struct Functions &);
+
+//Used for: double voxel_safety(const vec3<double> &pos);
+typedef double (*FUNCTION_voxel_safety)(const vec3<double> &);
+
+//Used for: void voxel_new_history(void);
+typedef void (*FUNCTION_voxel_new_history)(void);
+
+//Used for: void voxel_track_kerma(const double &kerma_per_length, const vec3<double> &from, const vec3<double> &to, const double &weight);
+// Track-length kerma estimator. kerma_per_length is E * mu_tr (linear) for the photon flying from 'from' to 'to' in one medium.
+typedef void (*FUNCTION_voxel_track_kerma)(const double &, const vec3<double> &, const vec3<double> &, const double &);
 
-//Used for: void voxel_localdump(const double &E, const vec3<double> &pos);
-typedef void (*FUNCTION_voxel_localdump)(const double &, const vec3<double> &, const struct Functions &);
+//Used for: void voxel_recycle(const vec3<double> &pos, const vec3<double> &dir, const std::vector<vec3<double>> &positions, const std::vector<vec3<double>> &dirs);
+// Records the history which starts at pos (heading along dir) and, when it is finished, scores it again from each positions[i]
+// heading along dirs[i].
+typedef void (*FUNCTION_voxel_recycle)(const vec3<double> &, const vec3<double> &, const std::vector<vec3<double>> &, const std::vector<vec3<double>> &);
 
 #endif
@@ -1,5 +1,6 @@
 //Voxel_Mapping.cc - Provides functions for scoring the geometry into voxels. This is a simplistic version which does *not* speak to the Geometry file.
-//                   This file is equipped to score LocalDump and SlowDown scatter routines.
+//                   This file is equipped to score LocalDump, SlowDown, and condensed-history scatter routines, as well as
+//                   track-length kerma along photon flights.
 //
 //Programming notes:
 //  -Do not make items here "const", because they will not show up when loading.
@@ -17,9 +18,15 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 
 #include <memory>
 #include <cmath>
+#include <mutex>
+
+#include <fcntl.h>    //open.
+#include <unistd.h>   //close.
+#include <sys/uio.h>  //writev.
 
 #include "./Misc.h"
 #include "./MyMath.h"
@@ -42,10 +49,22 @@ struct voxel {
     long int photon_primary_interactions;
     double accumulated_dose;
     double accumulated_kerma;
+    double track_kerma;    //Same quantity as accumulated_kerma, but estimated from photon track lengths rather than collisions.
     double Etransferred;
-    voxel():photon_primary_interactions(0),accumulated_dose(0.0),accumulated_kerma(0.0),Etransferred(0.0) { }
+
+    //History-by-history uncertainty bookkeeping. Sums of the squared contributions of each history (see history_buffer.)
+    double dose_sq, kerma_sq, track_sq;
+
+    voxel():photon_primary_interactions(0),accumulated_dose(0.0),accumulated_kerma(0.0),track_kerma(0.0),Etransferred(0.0),
+            dose_sq(0.0),kerma_sq(0.0),track_sq(0.0) { }
 };
 
+//Voxel grid layout. The grid spans x,y in [-15,15] and z in [-50,0] with cubic voxels. Voxel centers sit on the grid lines
+// (see to_voxel_coords().)
+const long int voxel_Nx = 60;
+const long int voxel_Ny = 60;
+const long int voxel_Nz = 100;
+const double   voxel_width = 0.5;
 
 
 vec3<long int> voxel_coords;
@@ -53,6 +72,176 @@ voxel data[60][60][100]; // <---- x,y,z
 bool  mask[60][60][100];
 double   max_dose, max_kerma;   //Used for normalization - dose or kerma.
 long int max_count;   //Used for normalization - number of primary events.
+long int current_history; //Number of histories marked by voxel_new_history(). Zero if the core never marks histories.
+
+//The contributions of the history currently being run by each thread are held separately, per thread, and only squared (and
+// summed) when that thread starts its next history (or when the data is dumped.) Histories run at the same time by different
+// threads therefore never get mixed up, however their scores interleave. Only the touched voxels are visited when folding.
+struct pending_score {
+    size_t n;                    //Voxel, as an offset into data.
+    double dose, kerma, track;
+};
+struct history_buffer {
+    std::vector<long int> slot;  //Voxel -> entry in touched, or -1.
+    std::vector<pending_score> touched;
+    history_buffer() : slot(voxel_Nx*voxel_Ny*voxel_Nz, -1) { }
+};
+std::vector<std::unique_ptr<history_buffer>> History_Buffers;  //One per thread which has scored anything.
+thread_local history_buffer *This_Thread_History = nullptr;
+
+//History recycling. While a history is being recycled, everything it scores is also recorded (as it was scored) so that it can be
+// replayed in each recycled frame once the history is finished. A frame is the rigid motion x -> origin + R (x - Recycle_Origin).
+enum recorded_kind : unsigned char { Recorded_Slowdown, Recorded_Localdump, Recorded_DepositTrack, Recorded_TrackKerma };
+struct recorded_score {
+    recorded_kind kind;
+    double a, b;              //Energies, in the order the scoring routine takes them.
+    vec3<double> from, to;
+    double weight;
+};
+struct recycled_frame {
+    vec3<double> origin;
+    double R[3][3];
+};
+vec3<double> Recycle_Origin;
+std::vector<recycled_frame> Recycle_Frames;  //Empty unless the current history is being recycled.
+std::vector<recorded_score> Recorded;
+const struct Functions *Recorded_Funcs = nullptr;
+
+std::mutex Voxel_Mutex;   //Scoring may be called from several threads (e.g., one per CT gantry angle.) Guards all of the above.
+
+
+//The calling thread's contribution to the voxel from its current history. Callers must hold Voxel_Mutex.
+static inline pending_score & pending(const voxel &v){
+    if(This_Thread_History == nullptr){
+        History_Buffers.push_back( std::unique_ptr<history_buffer>( new history_buffer() ) );
+        This_Thread_History = History_Buffers.back().get();
+    }
+    history_buffer &b = *This_Thread_History;
+    const size_t n = static_cast<size_t>(&v - &data[0][0][0]);
+    if(b.slot[n] < 0){
+        b.slot[n] = static_cast<long int>(b.touched.size());
+        b.touched.push_back({ n, 0.0, 0.0, 0.0 });
+    }
+    return b.touched[ static_cast<size_t>(b.slot[n]) ];
+}
+
+
+//Folds a finished history's contributions into the sums of squares. Callers must hold Voxel_Mutex.
+static void fold_history(history_buffer &b){
+    voxel *all = &data[0][0][0];
+    for(const pending_score &p : b.touched){
+        voxel &v = all[p.n];
+        v.dose_sq  += p.dose*p.dose;
+        v.kerma_sq += p.kerma*p.kerma;
+        v.track_sq += p.track*p.track;
+        b.slot[p.n] = -1;
+    }
+    b.touched.clear();
+    return;
+}
+
+
+//Writes a single raw binary volume (with an attached NRRD header) using a single write. The x index varies fastest.
+// See http://teem.sourceforge.net/nrrd/format.html for the header format.
+static bool write_nrrd_volume(const std::string &filename, const std::string &content, const std::vector<double> &vals){
+    const unsigned short int endian_probe = 1;
+    const bool little_endian = (*reinterpret_cast<const unsigned char *>(&endian_probe) == 1);
+
+    std::stringstream header;
+    header << "NRRD0004" << "\n";
+    header << "# Written by " << __FILE__ << ". Units are MeV (per simulation) unless noted otherwise." << "\n";
+    header << "content: " << content << "\n";
+    header << "type: double" << "\n";
+    header << "dimension: 3" << "\n";
+    header << "sizes: " << voxel_Nx << " " << voxel_Ny << " " << voxel_Nz << "\n";
+    header << "spacings: " << voxel_width << " " << voxel_width << " " << voxel_width << "\n";
+    //With cell centering the axis mins are the lower faces of the first cells, which sit half a voxel below the first centers.
+    header << "axis mins: " << (-15.0 - 0.5*voxel_width) << " " << (-15.0 - 0.5*voxel_width) << " " << (0.0 - 0.5*voxel_width) << "\n";
+    header << "centers: cell cell cell" << "\n";
+    header << "labels: \"x\" \"y\" \"depth\"" << "\n";
+    header << "units: \"cm\" \"cm\" \"cm\"" << "\n";
+    header << "endian: " << (little_endian ? "little" : "big") << "\n";
+    header << "encoding: raw" << "\n";
+    header << "\n";
+    const std::string header_str = header.str();
+
+    const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1){
+        FUNCWARN("Unable to open file \"" << filename << "\" for writing. Skipping it");
+        return false;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(header_str.data());
+    iov[0].iov_len  = header_str.size();
+    iov[1].iov_base = const_cast<double *>(vals.data());
+    iov[1].iov_len  = vals.size()*sizeof(double);
+
+    const ssize_t expected = static_cast<ssize_t>(iov[0].iov_len + iov[1].iov_len);
+    const ssize_t written  = writev(fd, iov, 2);
+    close(fd);
+
+    if(written != expected){
+        FUNCWARN("Short write to file \"" << filename << "\" (" << written << " of " << expected << " bytes)");
+        return false;
+    }
+    return true;
+}
+
+
+//Dumps each quantity as a single binary volume. Optionally dumps the (absolute) standard uncertainty of the dose and kerma sums.
+static void dump_nrrd_volumes(void){
+    const size_t N = static_cast<size_t>(voxel_Nx*voxel_Ny*voxel_Nz);
+    std::vector<double> events(N), dose(N), kerma(N), track(N), Etrans(N);
+    std::vector<double> dose_unc, kerma_unc, track_unc;
+
+    //We need at least two histories to say anything about the spread.
+    const bool do_uncertainty = LoggingQuantities::VoxelAutoDumpUncertainty && (current_history > 1);
+    if(do_uncertainty){
+        dose_unc.resize(N);
+        kerma_unc.resize(N);
+        track_unc.resize(N);
+    }else if(LoggingQuantities::VoxelAutoDumpUncertainty){
+        FUNCWARN("Histories were not marked by the core. Unable to provide uncertainty volumes");
+    }
+    const double Nhist = static_cast<double>(current_history);
+
+    //The final history of each thread has not been folded in yet.
+    if(do_uncertainty) for(auto &b : History_Buffers) fold_history(*b);
+
+    for(long int k=0; k<voxel_Nz; ++k) for(long int j=0; j<voxel_Ny; ++j) for(long int i=0; i<voxel_Nx; ++i){
+        const size_t n = static_cast<size_t>(i + voxel_Nx*(j + voxel_Ny*k));
+        voxel &v = data[i][j][k];
+
+        events[n] = static_cast<double>(v.photon_primary_interactions);
+        dose[n]   = v.accumulated_dose;
+        kerma[n]  = v.accumulated_kerma;
+        track[n]  = v.track_kerma;
+        Etrans[n] = v.Etransferred;
+
+        if(do_uncertainty){
+            //The variance of the sum over N histories is N/(N-1) * (sum(x^2) - sum(x)^2/N).
+            const double dose_var  = (Nhist/(Nhist-1.0))*(v.dose_sq  - v.accumulated_dose*v.accumulated_dose/Nhist);
+            const double kerma_var = (Nhist/(Nhist-1.0))*(v.kerma_sq - v.accumulated_kerma*v.accumulated_kerma/Nhist);
+            const double track_var = (Nhist/(Nhist-1.0))*(v.track_sq - v.track_kerma*v.track_kerma/Nhist);
+            dose_unc[n]  = (dose_var  > 0.0) ? sqrt(dose_var)  : 0.0;
+            kerma_unc[n] = (kerma_var > 0.0) ? sqrt(kerma_var) : 0.0;
+            track_unc[n] = (track_var > 0.0) ? sqrt(track_var) : 0.0;
+        }
+    }
+
+    write_nrrd_volume("/tmp/Transport_primary_events.nrrd", "primary events (counts)", events);
+    write_nrrd_volume("/tmp/Transport_dose.nrrd", "dose (energy deposited)", dose);
+    write_nrrd_volume("/tmp/Transport_kerma.nrrd", "kerma (energy transferred)", kerma);
+    write_nrrd_volume("/tmp/Transport_kerma_track.nrrd", "kerma (track-length estimate)", track);
+    write_nrrd_volume("/tmp/Transport_Etransferred.nrrd", "Etransferred", Etrans);
+    if(do_uncertainty){
+        write_nrrd_volume("/tmp/Transport_dose_uncertainty.nrrd", "dose standard uncertainty (same units as dose)", dose_unc);
+        write_nrrd_volume("/tmp/Transport_kerma_uncertainty.nrrd", "kerma standard uncertainty (same units as kerma)", kerma_unc);
+        write_nrrd_volume("/tmp/Transport_kerma_track_uncertainty.nrrd", "track-length kerma standard uncertainty (same units as kerma)", track_unc);
+    }
+    return;
+}
 
 #ifdef __GNUG__
     __attribute__((constructor)) static void init_on_dynamic_load(void){
@@ -61,6 +250,7 @@ long int max_count;   //Used for normalization - number of primary events.
         max_dose  = 0.0;
         max_kerma = 0.0;
         max_count = 0;
+        current_history = 0;
 
         if(VERBOSE) FUNCINFO("Loaded lib_voxel_mapping.so");
         return;
@@ -68,8 +258,13 @@ long int max_count;   //Used for normalization - number of primary events.
 
     __attribute__((destructor)) static void cleanup_on_dynamic_unload(void){
         //Cleanup memory (if needed) automatically here.
+        if(!Recorded.empty()) FUNCWARN("The last recycled history was never replayed. It is only scored once");
 
-        if(LoggingQuantities::VoxelAutoDump){
+        if(LoggingQuantities::VoxelAutoDump && LoggingQuantities::VoxelAutoDumpNRRD){
+            dump_nrrd_volumes();
+        }
+
+        if(LoggingQuantities::VoxelAutoDump && LoggingQuantities::VoxelAutoDumpPPM){
 
             //Primary Events.
             for(long int k=0; k<100; ++k){
@@ -212,8 +407,35 @@ bool to_voxel_coords(const vec3<double> &in){  //This is a STATEFUL function. It
 
 
 
-void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_pos,  const double &final_E, const vec3<double> &final_pos, const struct Functions &Loaded_Funcs){
+//Distance from a point, in any direction, to the nearest face of the voxel containing it. Outside of the grid, it is the distance
+// to the grid. Nothing moving less than this far can change where its energy is scored.
+double voxel_safety(const vec3<double> &in){
+    //The part of space which is scored (see to_voxel_coords().) The far faces are cut by the index limits.
+    const double lo[3] = { -15.0, -15.0, -50.0 + 0.5*voxel_width };
+    const double hi[3] = { -15.0 + (static_cast<double>(voxel_Nx) - 0.5)*voxel_width,
+                           -15.0 + (static_cast<double>(voxel_Ny) - 0.5)*voxel_width, 0.0 };
+    const double p[3]  = { in.x, in.y, in.z };
+
+    double outside = 0.0, dist = 1E99;
+    for(size_t i=0; i<3; ++i){
+        const double out = std::max(lo[i] - p[i], p[i] - hi[i]);
+        if(out > 0.0){
+            outside += out*out;
+        }else{
+            dist = std::min(dist, -out);
+        }
+    }
+    if(outside > 0.0) return sqrt(outside);
+
+    //Voxel centers sit on the grid lines, so the faces are half a width either side of them.
+    const double u[3] = { (in.x + 15.0)/voxel_width, (in.y + 15.0)/voxel_width, -in.z/voxel_width };
+    for(const double &v : u) dist = std::min(dist, (0.5 - fabs(v - rint(v)))*voxel_width);
+    return dist;
+}
+
 
+//The scoring routines proper. Callers must hold Voxel_Mutex.
+static void score_slowdown(const double &initial_E, const vec3<double> &initial_pos,  const double &final_E, const vec3<double> &final_pos, const double &weight, const struct Functions &Loaded_Funcs){
 /*
     //Troubleshooting.
     std::cout << "Performed a slowdown accumulation with E,R = " << initial_E << ", " << initial_pos << " --> " << final_E << ", " << final_pos << ". ";
@@ -231,18 +453,19 @@ void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_po
 
     const double distance  = path.length();
     vec3<double> dir       = path.unit();
-    const double Elost     = initial_E - final_E;
+    const double Elost     = (initial_E - final_E)*weight;
 
     //Register the primary event, if it occurs inside the voxel geometry.
     if( to_voxel_coords( initial_pos ) ){
         ++(data[voxel_coords.x][voxel_coords.y][voxel_coords.z].photon_primary_interactions);
 
         data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_kerma += Elost;
+        pending(data[voxel_coords.x][voxel_coords.y][voxel_coords.z]).kerma   += Elost;
 
                  double probable_photon_E = 6.0*(initial_E - electron_mass);
                  if( probable_photon_E > 50.0) probable_photon_E = 49.9;
 
-        data[voxel_coords.x][voxel_coords.y][voxel_coords.z].Etransferred += probable_photon_E * 
+        data[voxel_coords.x][voxel_coords.y][voxel_coords.z].Etransferred += weight * probable_photon_E * 
                  (Loaded_Funcs.photon_mass_coefficient_transfer(probable_photon_E) / Loaded_Funcs.photon_mass_coefficient_total(probable_photon_E) );
  
         //Used for normalization afterward.
@@ -268,6 +491,7 @@ void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_po
 
             //Accumulate the quantities required.
             data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_dose  += (dx/distance)*Elost;
+            pending(data[voxel_coords.x][voxel_coords.y][voxel_coords.z]).dose    += (dx/distance)*Elost;
 
             //Running maximum value to save us having to determine it later.
             if(max_dose < data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_dose){
@@ -282,19 +506,22 @@ void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_po
 }
 
 
-void voxel_localdump(const double &T, const vec3<double> &pos, const struct Functions &Loaded_Funcs){ //Requires kinetic energy because it cannot tell which particle is being dumped!
+static void score_localdump(const double &T, const vec3<double> &pos, const double &weight, const struct Functions &Loaded_Funcs){ //Requires kinetic energy because it cannot tell which particle is being dumped!
     //This function takes a localdump event and registers it in a single voxel.
     if( to_voxel_coords( pos ) ){
 
            //Accumulate the quantities required.
-            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_dose  += T;
+            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_dose  += T*weight;
+            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_kerma += T*weight;
 
-            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].accumulated_kerma += T;
+            pending_score &p = pending(data[voxel_coords.x][voxel_coords.y][voxel_coords.z]);
+            p.dose  += T*weight;
+            p.kerma += T*weight;
 
                      double probable_photon_E = 6.0*T ;
                      if(probable_photon_E > 50.0) probable_photon_E = 49.9;
 
-            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].Etransferred += probable_photon_E * 
+            data[voxel_coords.x][voxel_coords.y][voxel_coords.z].Etransferred += weight * probable_photon_E * 
                  (Loaded_Funcs.photon_mass_coefficient_transfer(probable_photon_E) / Loaded_Funcs.photon_mass_coefficient_total(probable_photon_E) );
 
 
@@ -311,6 +538,240 @@ void voxel_localdump(const double &T, const vec3<double> &pos, const struct Func
 }
 
 
+static void score_deposit_track(const double &T_transferred, const double &E_deposited, const vec3<double> &from, const vec3<double> &to, const double &weight, const struct Functions &Loaded_Funcs){
+    //Scores one straight step of a charged particle track. E_deposited is spread evenly along the step. If T_transferred is
+    // nonzero, the step is the first of a newly-set-in-motion particle, and T_transferred (its kinetic energy) is scored as
+    // a primary event at 'from', the same way accumulate_slowdown() does. Everything but the primary count is scaled by weight.
+
+    if((T_transferred > 0.0) && to_voxel_coords( from )){
+        voxel &v = data[voxel_coords.x][voxel_coords.y][voxel_coords.z];
+        ++(v.photon_primary_interactions);
+
+        v.accumulated_kerma   += T_transferred*weight;
+        pending(v).kerma      += T_transferred*weight;
+
+                 double probable_photon_E = 6.0*T_transferred;
+                 if( probable_photon_E > 50.0) probable_photon_E = 49.9;
+
+        v.Etransferred += weight * probable_photon_E *
+                 (Loaded_Funcs.photon_mass_coefficient_transfer(probable_photon_E) / Loaded_Funcs.photon_mass_coefficient_total(probable_photon_E) );
+
+        if(v.photon_primary_interactions > max_count) max_count = v.photon_primary_interactions;
+        if(max_kerma < v.accumulated_kerma) max_kerma = v.accumulated_kerma;
+    }
+
+    if(E_deposited <= 0.0) return;
+
+    //Split the step into equal pieces shorter than a voxel and deposit an equal share at the middle of each. Unlike the crawl
+    // in accumulate_slowdown(), the shares always add up to E_deposited.
+    vec3<double> path = to;
+    path -= from;
+    const double distance = path.length();
+    const long int pieces = (distance > 0.24) ? static_cast<long int>(ceil(distance/0.24)) : 1;
+    const double share    = E_deposited*weight/static_cast<double>(pieces);
+
+    for(long int i = 0; i < pieces; ++i){
+        vec3<double> pos = from;
+        pos += path*((static_cast<double>(i) + 0.5)/static_cast<double>(pieces));
+        if( to_voxel_coords( pos ) ){
+            voxel &v = data[voxel_coords.x][voxel_coords.y][voxel_coords.z];
+            v.accumulated_dose += share;
+            pending(v).dose    += share;
+            if(max_dose < v.accumulated_dose) max_dose = v.accumulated_dose;
+        }
+    }
+    return;
+}
+
+
+
+//Track-length kerma estimator. Each voxel crossed by the segment is scored kerma_per_length times the length of the segment within
+// it. The voxels are visited in order with a 3D DDA (Amanatides and Woo), in grid units where voxel i spans [i, i+1).
+static void score_track_kerma(const double &kerma_per_length, const vec3<double> &from, const vec3<double> &to, const double &weight){
+    //Grid units. Voxel centers sit on the grid lines (see to_voxel_coords()), hence the half-voxel shift.
+    const double p0[3] = { (from.x + 15.0)/voxel_width + 0.5, (from.y + 15.0)/voxel_width + 0.5, -from.z/voxel_width + 0.5 };
+    const double p1[3] = { (to.x   + 15.0)/voxel_width + 0.5, (to.y   + 15.0)/voxel_width + 0.5, -to.z/voxel_width   + 0.5 };
+    const double d[3]  = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+
+    //The scored region (the same one as to_voxel_coords()) is [0.5, N) along each axis. Clip the segment, as t in [0,1], to it.
+    const double lo[3] = { 0.5, 0.5, 0.5 };
+    const double hi[3] = { static_cast<double>(voxel_Nx), static_cast<double>(voxel_Ny), static_cast<double>(voxel_Nz) };
+    double t0 = 0.0, t1 = 1.0;
+    for(size_t i=0; i<3; ++i){
+        if(d[i] == 0.0){
+            if((p0[i] < lo[i]) || (p0[i] >= hi[i])) return;
+            continue;
+        }
+        double ta = (lo[i] - p0[i])/d[i], tb = (hi[i] - p0[i])/d[i];
+        if(ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+    }
+    if(!(t1 > t0)) return;
+
+    vec3<double> path = to;
+    path -= from;
+    const double score = kerma_per_length * weight * path.length();  //Per unit t.
+
+    //Start in the voxel containing the midpoint of the first (tiny) bit of the clipped segment, to stay clear of faces.
+    long int v[3], step[3];
+    double t_next[3], t_delta[3];
+    for(size_t i=0; i<3; ++i){
+        const double start = p0[i] + d[i]*t0;
+        v[i] = static_cast<long int>(floor(start + ((d[i] > 0.0) ? 1E-12 : ((d[i] < 0.0) ? -1E-12 : 0.0))));
+        if(d[i] > 0.0){
+            step[i]    = 1;
+            t_next[i]  = (static_cast<double>(v[i] + 1) - p0[i])/d[i];
+            t_delta[i] = 1.0/d[i];
+        }else if(d[i] < 0.0){
+            step[i]    = -1;
+            t_next[i]  = (static_cast<double>(v[i]) - p0[i])/d[i];
+            t_delta[i] = -1.0/d[i];
+        }else{
+            step[i]    = 0;
+            t_next[i]  = 1E99;
+            t_delta[i] = 1E99;
+        }
+    }
+    const long int N[3] = { voxel_Nx, voxel_Ny, voxel_Nz };
+
+    double t = t0;
+    while(t < t1){
+        const size_t a = (t_next[0] < t_next[1]) ? ((t_next[0] < t_next[2]) ? 0 : 2) : ((t_next[1] < t_next[2]) ? 1 : 2);
+        const double t_exit = std::min(t_next[a], t1);
+
+        if((v[0] >= 0) && (v[0] < N[0]) && (v[1] >= 0) && (v[1] < N[1]) && (v[2] >= 0) && (v[2] < N[2])){
+            voxel &vox = data[v[0]][v[1]][v[2]];
+            vox.track_kerma      += score*(t_exit - t);
+            pending(vox).track   += score*(t_exit - t);
+        }
+
+        t = t_exit;
+        v[a]      += step[a];
+        t_next[a] += t_delta[a];
+    }
+    return;
+}
+
+
+//Replays the recorded history in each recycled frame, then forgets it. Callers must hold Voxel_Mutex.
+static void replay_recorded(void){
+    for(const recycled_frame &f : Recycle_Frames){
+        auto place = [&](const vec3<double> &x) -> vec3<double> {
+            const double r[3] = { x.x - Recycle_Origin.x, x.y - Recycle_Origin.y, x.z - Recycle_Origin.z };
+            return vec3<double>( f.origin.x + f.R[0][0]*r[0] + f.R[0][1]*r[1] + f.R[0][2]*r[2],
+                                 f.origin.y + f.R[1][0]*r[0] + f.R[1][1]*r[1] + f.R[1][2]*r[2],
+                                 f.origin.z + f.R[2][0]*r[0] + f.R[2][1]*r[1] + f.R[2][2]*r[2] );
+        };
+        for(const recorded_score &r : Recorded){
+            const vec3<double> from = place(r.from);
+            if(r.kind == Recorded_Localdump){
+                score_localdump(r.a, from, r.weight, *Recorded_Funcs);
+                continue;
+            }
+            const vec3<double> to = place(r.to);
+            if(r.kind == Recorded_Slowdown){
+                score_slowdown(r.a, from, r.b, to, r.weight, *Recorded_Funcs);
+            }else if(r.kind == Recorded_DepositTrack){
+                score_deposit_track(r.a, r.b, from, to, r.weight, *Recorded_Funcs);
+            }else{
+                score_track_kerma(r.a, from, to, r.weight);
+            }
+        }
+    }
+    Recycle_Frames.clear();
+    Recorded.clear();
+    return;
+}
+
+
+//Marks the start of a new (primary) history. Everything scored until the next call is considered to be correlated.
+void voxel_new_history(void){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    replay_recorded();
+    if(This_Thread_History != nullptr) fold_history(*This_Thread_History);
+    ++current_history;
+    return;
+}
+
+
+//Asks for the current history to be recycled: once it is finished, everything it scored is scored again in each of the given
+// frames (i.e., as if the history had started at positions[i] heading along dirs[i] rather than at pos heading along dir.) The
+// replays belong to the same history for the uncertainty estimate. Only valid where the geometry looks the same from each frame.
+//
+//A history still waiting to be replayed is replayed first, so calling this with no frames finishes the last one. (This must be
+// done by the core while the other modules are still loaded.)
+void voxel_recycle(const vec3<double> &pos, const vec3<double> &dir, const std::vector<vec3<double>> &positions, const std::vector<vec3<double>> &dirs){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    replay_recorded();
+    Recycle_Origin = pos;
+    Recycle_Frames.resize(positions.size());
+    for(size_t i = 0; i < positions.size(); ++i){
+        recycled_frame &f = Recycle_Frames[i];
+        f.origin = positions[i];
+
+        //The rotation taking dir to dirs[i] about their common perpendicular (Rodrigues' formula.) Antiparallel directions are
+        // turned half way around an axis perpendicular to dir.
+        const vec3<double> &b = dirs[i];
+        const double c = dir.x*b.x + dir.y*b.y + dir.z*b.z;
+        const double v[3] = { dir.y*b.z - dir.z*b.y, dir.z*b.x - dir.x*b.z, dir.x*b.y - dir.y*b.x };
+        const double s2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+        if(s2 > 1E-24){
+            const double h = (1.0 - c)/s2;
+            f.R[0][0] = c + h*v[0]*v[0];     f.R[0][1] = h*v[0]*v[1] - v[2];  f.R[0][2] = h*v[0]*v[2] + v[1];
+            f.R[1][0] = h*v[0]*v[1] + v[2];  f.R[1][1] = c + h*v[1]*v[1];     f.R[1][2] = h*v[1]*v[2] - v[0];
+            f.R[2][0] = h*v[0]*v[2] - v[1];  f.R[2][1] = h*v[1]*v[2] + v[0];  f.R[2][2] = c + h*v[2]*v[2];
+        }else{
+            vec3<double> u = (fabs(dir.x) < 0.9) ? vec3<double>(0.0, dir.z, -dir.y) : vec3<double>(-dir.z, 0.0, dir.x);
+            u = u.unit();
+            const double a[3] = { u.x, u.y, u.z };
+            for(size_t r = 0; r < 3; ++r) for(size_t q = 0; q < 3; ++q){
+                f.R[r][q] = (c > 0.0) ? ((r == q) ? 1.0 : 0.0) : (2.0*a[r]*a[q] - ((r == q) ? 1.0 : 0.0));
+            }
+        }
+    }
+    return;
+}
+
+
+void accumulate_slowdown(const double &initial_E, const vec3<double> &initial_pos,  const double &final_E, const vec3<double> &final_pos, const double &weight, const struct Functions &Loaded_Funcs){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    score_slowdown(initial_E, initial_pos, final_E, final_pos, weight, Loaded_Funcs);
+    if(!Recycle_Frames.empty()){
+        Recorded.push_back({ Recorded_Slowdown, initial_E, final_E, initial_pos, final_pos, weight });
+        Recorded_Funcs = &Loaded_Funcs;
+    }
+    return;
+}
+
+void voxel_localdump(const double &T, const vec3<double> &pos, const double &weight, const struct Functions &Loaded_Funcs){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    score_localdump(T, pos, weight, Loaded_Funcs);
+    if(!Recycle_Frames.empty()){
+        Recorded.push_back({ Recorded_Localdump, T, 0.0, pos, pos, weight });
+        Recorded_Funcs = &Loaded_Funcs;
+    }
+    return;
+}
+
+void voxel_deposit_track(const double &T_transferred, const double &E_deposited, const vec3<double> &from, const vec3<double> &to, const double &weight, const struct Functions &Loaded_Funcs){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    score_deposit_track(T_transferred, E_deposited, from, to, weight, Loaded_Funcs);
+    if(!Recycle_Frames.empty()){
+        Recorded.push_back({ Recorded_DepositTrack, T_transferred, E_deposited, from, to, weight });
+        Recorded_Funcs = &Loaded_Funcs;
+    }
+    return;
+}
+
+void voxel_track_kerma(const double &kerma_per_length, const vec3<double> &from, const vec3<double> &to, const double &weight){
+    std::lock_guard<std::mutex> lock(Voxel_Mutex);
+    score_track_kerma(kerma_per_length, from, to, weight);
+    if(!Recycle_Frames.empty()) Recorded.push_back({ Recorded_TrackKerma, kerma_per_length, 0.0, from, to, weight });
+    return;
+}
+
+
 
 #ifdef __cplusplus
     }